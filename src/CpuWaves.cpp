@@ -22,10 +22,14 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #include "CpuWaves.h"
+#include "ThreadPool.h"
+#include "StencilKernels.h"
+#include "HalfFloat.h"
 #include <algorithm>
 #include <vector>
 #include <cassert>
 #include <iostream>
+#include <cmath>
 
 CPUWaves::CPUWaves()
     : m_nRows(0),
@@ -37,19 +41,39 @@ CPUWaves::CPUWaves()
       m_k3(0.0f),
       m_timeStep(0.0f),
       m_spatialStep(0.0f),
-      m_prevSolution(0),
-      m_currSolution(0),
+      m_halfWidth(0.0f),
+      m_halfDepth(0.0f),
+      m_prevHeights(0),
+      m_currHeights(0),
       m_normals(0),
-      m_tangentX(0)
+      m_tangentX(0),
+      m_positions(0),
+      m_outputPositions(0),
+      m_outputNormals(0),
+      m_elapsedTime(0.0),
+      m_threadPool(0),
+      m_kernels(&StencilKernels::best()),
+      m_passMode(FUSED),
+      m_normalOutput(true),
+      m_blockSteps(0),
+      m_tileSize(0),
+      m_nextPrevHeights(0),
+      m_nextCurrHeights(0),
+      m_halfStorage(false),
+      m_halfConversions(&HalfFloat::best())
 {
 }
 
 CPUWaves::~CPUWaves()
 {
-    delete[] m_prevSolution;
-    delete[] m_currSolution;
+    delete[] m_prevHeights;
+    delete[] m_currHeights;
     delete[] m_normals;
     delete[] m_tangentX;
+    delete[] m_positions;
+    delete[] m_nextPrevHeights;
+    delete[] m_nextCurrHeights;
+    delete m_threadPool;
 }
 
 unsigned int CPUWaves::rowCount() const
@@ -98,6 +122,26 @@ const float* CPUWaves::k3() const
     return &m_k3;
 }
 
+float CPUWaves::timeStep() const
+{
+    return m_timeStep;
+}
+
+glm::vec4* CPUWaves::getCurrentWaves() const
+{
+    if(m_positions == 0)
+    {
+        m_positions = new glm::vec4[m_nVertices];
+    }
+
+    for(unsigned int i = 0; i < m_nVertices; ++i)
+    {
+        m_positions[i] = position(i);
+    }
+
+    return m_positions;
+}
+
 void CPUWaves::init(unsigned int m, unsigned int n, float dx, float dt, float speed, float damping)
 {
     m_nRows = m;
@@ -116,97 +160,605 @@ void CPUWaves::init(unsigned int m, unsigned int n, float dx, float dt, float sp
     m_k3     = (2.0f*e) / d;
 
     // In case Init() called again.
-    delete[] m_prevSolution;
-    delete[] m_currSolution;
+    delete[] m_prevHeights;
+    delete[] m_currHeights;
     delete[] m_normals;
     delete[] m_tangentX;
+    delete[] m_positions;
+    delete[] m_nextPrevHeights;
+    delete[] m_nextCurrHeights;
 
-    m_prevSolution = new glm::vec4[m*n];
-    m_currSolution = new glm::vec4[m*n];
+    m_prevHeights  = new float[m*n];
+    m_currHeights  = new float[m*n];
     m_normals      = new glm::vec4[m*n];
     m_tangentX     = new glm::vec4[m*n];
+    m_positions    = 0;
+    m_outputPositions = 0;
+    m_outputNormals = 0;
+    m_nextPrevHeights = 0;
+    m_nextCurrHeights = 0;
 
-    // create grid vertices in system memory (as the highfield)
-    float halfWidth = (n-1)*dx*0.5f;
-    float halfDepth = (m-1)*dx*0.5f;
+    // the grid is centered at the origin, see position()
+    m_halfWidth = (n-1)*dx*0.5f;
+    m_halfDepth = (m-1)*dx*0.5f;
 
-    for(unsigned int i = 0; i < m; ++i)
+    for(unsigned int i = 0; i < m*n; ++i)
     {
-        float z = halfDepth - i*dx;
-        for(unsigned int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j * dx;
+        m_prevHeights[i] = 0.0f;
+        m_currHeights[i] = 0.0f;
+        m_normals[i]     = glm::vec4(0.0f , 1.0f, 0.0f, 1.0f);
+        m_tangentX[i]    = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+    }
 
-            m_prevSolution[i*n+j] = glm::vec4(x, 0.0f, z, 1.0f);
-            m_currSolution[i*n+j] = glm::vec4(x, 0.0f, z, 1.0f);
-            m_normals[i*n+j]      = glm::vec4(0.0f , 1.0f, 0.0f, 1.0f);
-            m_tangentX[i*n+j]     = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
-        }
+    // a flat grid is all zeros in fp16 as well
+    if(m_halfStorage)
+    {
+        m_prevHalfHeights.assign(m*n, 0);
+        m_currHalfHeights.assign(m*n, 0);
     }
 }
 
 void CPUWaves::update(double dt)
 {
-    static double t = 0;
+    if(stepDue(dt))
+    {
+        step();
+    }
+}
 
+bool CPUWaves::stepDue(double dt)
+{
     // accumulate time
-    t += dt;
+    m_elapsedTime += dt;
 
     // Only update the simulation at the specified time step
-    if(t >= m_timeStep)
+    if(m_elapsedTime >= m_timeStep)
+    {
+        m_elapsedTime = 0.0; // reset time
+        return true;
+    }
+    return false;
+}
+
+void CPUWaves::setOutput(glm::vec4* positions, glm::vec4* normals)
+{
+    m_outputPositions = positions;
+    m_outputNormals = normals;
+}
+
+void CPUWaves::writeOutput(glm::vec4* positions, glm::vec4* normals)
+{
+    glm::vec4* outputPositions = m_outputPositions;
+    glm::vec4* outputNormals = m_outputNormals;
+    setOutput(positions, normals);
+
+    forEachRowBand(&CPUWaves::computeNormals);
+    writeOutputBoundaryRows();
+
+    setOutput(outputPositions, outputNormals);
+}
+
+void CPUWaves::setThreadCount(unsigned int n)
+{
+    delete m_threadPool;
+    m_threadPool = (n > 1) ? new ThreadPool(n) : 0;
+}
+
+unsigned int CPUWaves::threadCount() const
+{
+    return m_threadPool ? m_threadPool->threadCount() : 1;
+}
+
+void CPUWaves::setStencilKernels(const StencilKernelSet& kernels)
+{
+    m_kernels = &kernels;
+}
+
+const StencilKernelSet& CPUWaves::stencilKernels() const
+{
+    return *m_kernels;
+}
+
+void CPUWaves::setTemporalBlocking(unsigned int stepsPerPass, unsigned int tileSize)
+{
+    m_blockSteps = (stepsPerPass > 1) ? stepsPerPass : 0;
+    m_tileSize = tileSize;
+}
+
+unsigned int CPUWaves::temporalBlockingSteps() const
+{
+    return m_blockSteps;
+}
+
+void CPUWaves::setPassMode(PassMode mode)
+{
+    m_passMode = mode;
+}
+
+CPUWaves::PassMode CPUWaves::passMode() const
+{
+    return m_passMode;
+}
+
+void CPUWaves::setNormalOutput(bool enabled)
+{
+    m_normalOutput = enabled;
+}
+
+bool CPUWaves::normalOutput() const
+{
+    return m_normalOutput;
+}
+
+void CPUWaves::setHalfStorage(bool enabled)
+{
+    if(enabled == m_halfStorage)
+    {
+        return;
+    }
+    m_halfStorage = enabled;
+    if(m_nVertices == 0)
+    {
+        return;
+    }
+
+    if(enabled)
+    {
+        m_prevHalfHeights.resize(m_nVertices);
+        m_currHalfHeights.resize(m_nVertices);
+        m_halfConversions->toHalfRow(m_prevHeights, &m_prevHalfHeights[0], m_nVertices);
+        m_halfConversions->toHalfRow(m_currHeights, &m_currHalfHeights[0], m_nVertices);
+        m_halfConversions->toFloatRow(&m_currHalfHeights[0], m_currHeights, m_nVertices);
+    }
+    else
+    {
+        m_halfConversions->toFloatRow(&m_prevHalfHeights[0], m_prevHeights, m_nVertices);
+        m_halfConversions->toFloatRow(&m_currHalfHeights[0], m_currHeights, m_nVertices);
+        std::vector<uint16_t>().swap(m_prevHalfHeights);
+        std::vector<uint16_t>().swap(m_currHalfHeights);
+    }
+}
+
+bool CPUWaves::halfStorage() const
+{
+    return m_halfStorage;
+}
+
+void CPUWaves::step()
+{
+    stepN(1);
+}
+
+void CPUWaves::stepN(unsigned int n)
+{
+    if(n == 0)
+    {
+        return;
+    }
+
+    if(m_halfStorage)
+    {
+        stepHalf(n);
+        return;
+    }
+
+    // the normals only depend on the final heights, the fused pass handles the last step
+    const unsigned int heightSteps = (m_passMode == FUSED && m_normalOutput) ? n-1 : n;
+
+    for(unsigned int remaining = heightSteps; remaining > 0; )
+    {
+        takeStepDrops();
+        unsigned int s = m_stepDrops.empty() ? std::min(remaining, m_blockSteps) : 1;
+        if(s > 1)
+        {
+            advanceBlocked(s);
+        }
+        else
+        {
+            forEachRowBand(&CPUWaves::updateHeights);
+
+            // We just overwrote the previous buffer with the new data, so
+            // this data needs to become the current solution and the old
+            // current solution becomes the new previous solution.
+            // All bands have finished at this point, so this is the barrier
+            // between the height and the normal pass.
+            std::swap(m_prevHeights, m_currHeights);
+            s = 1;
+        }
+        remaining -= s;
+    }
+
+    if(!m_normalOutput)
+    {
+        return;
+    }
+
+    if(m_passMode == FUSED)
+    {
+        takeStepDrops();
+        forEachRowBand(&CPUWaves::updateHeightsAndNormals);
+        std::swap(m_prevHeights, m_currHeights);
+        if(m_threadPool != 0)
+        {
+            forEachRowBand(&CPUWaves::computeBandEdgeNormals);
+        }
+    }
+    else
+    {
+        forEachRowBand(&CPUWaves::computeNormals);
+    }
+    writeOutputBoundaryRows();
+}
+
+void CPUWaves::stepHalf(unsigned int n)
+{
+    for(unsigned int k = 0; k < n; ++k)
+    {
+        takeStepDrops();
+        forEachRowBand(&CPUWaves::updateHalfHeights);
+        m_prevHalfHeights.swap(m_currHalfHeights);
+    }
+
+    forEachRowBand(&CPUWaves::decodeHalfHeights);
+    if(m_normalOutput)
+    {
+        forEachRowBand(&CPUWaves::computeNormals);
+        writeOutputBoundaryRows();
+    }
+}
+
+void CPUWaves::updateHalfHeights(unsigned int rowBegin, unsigned int rowEnd)
+{
+    if(rowBegin >= rowEnd)
+    {
+        return;
+    }
+
+    // every band converts its rows into float rows of its pool thread, allocated once per
+    // thread and grid width. The rows i and i+1 of the current heights are reused for the next row.
+    static thread_local std::vector<float> rows;
+    if(rows.size() < 4 * m_nCols)
+    {
+        rows.resize(4 * m_nCols);
+    }
+    float* prev = &rows[0];
+    float* up = prev + m_nCols;
+    float* curr = up + m_nCols;
+    float* down = curr + m_nCols;
+
+    m_halfConversions->toFloatRow(&m_currHalfHeights[(rowBegin-1)*m_nCols], up, m_nCols);
+    m_halfConversions->toFloatRow(&m_currHalfHeights[rowBegin*m_nCols], curr, m_nCols);
+    for(unsigned int i = rowBegin; i < rowEnd; ++i)
+    {
+        m_halfConversions->toFloatRow(&m_currHalfHeights[(i+1)*m_nCols], down, m_nCols);
+        m_halfConversions->toFloatRow(&m_prevHalfHeights[i*m_nCols], prev, m_nCols);
+
+        m_kernels->updateHeightRow(prev, up, curr, down, m_nCols, m_k1, m_k2, m_k3);
+        applyStepDrops(prev, i);
+        m_halfConversions->toHalfRow(prev, &m_prevHalfHeights[i*m_nCols], m_nCols);
+
+        float* swap = up;
+        up = curr;
+        curr = down;
+        down = swap;
+    }
+}
+
+void CPUWaves::decodeHalfHeights(unsigned int rowBegin, unsigned int rowEnd)
+{
+    // the boundary rows never change and stay decoded
+    for(unsigned int i = rowBegin; i < rowEnd; ++i)
+    {
+        m_halfConversions->toFloatRow(&m_currHalfHeights[i*m_nCols], &m_currHeights[i*m_nCols], m_nCols);
+    }
+}
+
+void CPUWaves::advanceBlocked(unsigned int s)
+{
+    // Tiles read the state of the previous pass while writing the new one, so the
+    // result of a pass goes to a second pair of planes. A tile covers its core plus
+    // a halo of s cells; every step the valid region shrinks by one cell per side,
+    // leaving exactly the core valid after s steps (the trapezoid in time).
+    if(m_nextPrevHeights == 0)
+    {
+        m_nextPrevHeights = new float[m_nVertices];
+        m_nextCurrHeights = new float[m_nVertices];
+    }
+
+    unsigned int tileSize = m_tileSize;
+    if(tileSize == 0)
+    {
+        // two scratch planes of (tileSize+2s)^2 floats should stay within 512 KB of L2
+        const unsigned int scratchEdge = 256;
+        tileSize = (scratchEdge > 2*s + 16) ? ((scratchEdge - 2*s) / 16) * 16 : 16;
+    }
+
+    const unsigned int tileRows = (m_nRows + tileSize - 1) / tileSize;
+    const unsigned int tileCols = (m_nCols + tileSize - 1) / tileSize;
+    const unsigned int tileCount = tileRows * tileCols;
+    const unsigned int scratchSize = 2 * (tileSize + 2*s) * (tileSize + 2*s);
+
+    // every thread works on a contiguous range of tiles with its own scratch planes
+    const unsigned int tasks = std::min(threadCount(), tileCount);
+    if(m_tileScratch.size() < tasks * scratchSize)
     {
-        // only update interior points; we use zero boundary conditions.
-        for(unsigned int i = 1; i < m_nRows-1; ++i)
+        m_tileScratch.resize(tasks * scratchSize);
+    }
+
+    if(m_threadPool == 0 || tasks == 1)
+    {
+        for(unsigned int tile = 0; tile < tileCount; ++tile)
+        {
+            advanceTile(tile, tileSize, s, &m_tileScratch[0]);
+        }
+    }
+    else
+    {
+        m_threadPool->run(tasks, [this, tileSize, s, tasks, tileCount, scratchSize](unsigned int task)
         {
-            for(unsigned int j = 1; j < m_nCols-1; ++j)
+            unsigned int tileBegin = task * tileCount / tasks;
+            unsigned int tileEnd   = (task+1) * tileCount / tasks;
+            for(unsigned int tile = tileBegin; tile < tileEnd; ++tile)
             {
-                // After this update we will be discarding the old previous
-                // buffer, so overwrite that buffer with the new update.
-                // Note how we can do this inplace (read/write to same element) 
-                // because we won't need prev_ij again and the assignment happens last.
-
-                // Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-                // Moreover, our +z axis goes "down"; this is just to 
-                // keep consistent with our row indices going down.
-
-                m_prevSolution[i*m_nCols+j].y = m_k1*m_prevSolution[i*m_nCols+j].y +
-                    m_k2*m_currSolution[i*m_nCols+j].y +
-                    m_k3*(m_currSolution[(i+1)*m_nCols+j].y + 
-                    m_currSolution[(i-1)*m_nCols+j].y + 
-                    m_currSolution[i*m_nCols+j+1].y + 
-                    m_currSolution[i*m_nCols+j-1].y);
+                advanceTile(tile, tileSize, s, &m_tileScratch[task * scratchSize]);
             }
-        }
+        });
+    }
+
+    std::swap(m_prevHeights, m_nextPrevHeights);
+    std::swap(m_currHeights, m_nextCurrHeights);
+}
+
+void CPUWaves::advanceTile(unsigned int tile, unsigned int tileSize, unsigned int s, float* scratch)
+{
+    const unsigned int tileCols = (m_nCols + tileSize - 1) / tileSize;
+
+    // core of the tile in grid coordinates
+    const unsigned int i0 = (tile / tileCols) * tileSize;
+    const unsigned int j0 = (tile % tileCols) * tileSize;
+    const unsigned int i1 = std::min(i0 + tileSize, m_nRows);
+    const unsigned int j1 = std::min(j0 + tileSize, m_nCols);
+
+    // core plus halo, clipped to the grid
+    const unsigned int r0 = (i0 > s) ? i0 - s : 0;
+    const unsigned int c0 = (j0 > s) ? j0 - s : 0;
+    const unsigned int r1 = std::min(i1 + s, m_nRows);
+    const unsigned int c1 = std::min(j1 + s, m_nCols);
+    const unsigned int width = c1 - c0;
 
-        // We just overwrote the previous buffer with the new data, so
-        // this data needs to become the current solution and the old
-        // current solution becomes the new previous solution.
-        std::swap(m_prevSolution, m_currSolution);
+    float* prev = scratch;
+    float* curr = scratch + (tileSize + 2*s) * (tileSize + 2*s);
 
-        t = 0.0f; // reset time
+    for(unsigned int i = r0; i < r1; ++i)
+    {
+        std::copy(&m_prevHeights[i*m_nCols + c0], &m_prevHeights[i*m_nCols + c1], &prev[(i-r0)*width]);
+        std::copy(&m_currHeights[i*m_nCols + c0], &m_currHeights[i*m_nCols + c1], &curr[(i-r0)*width]);
+    }
+
+    for(unsigned int k = 1; k <= s; ++k)
+    {
+        // cells still valid after k steps; the grid boundary never changes and needs no halo
+        const unsigned int rowBegin = std::max(1u, (i0 + k > s) ? i0 + k - s : 0);
+        const unsigned int rowEnd   = std::min(m_nRows-1, i1 + s - k);
+        const unsigned int colBegin = std::max(1u, (j0 + k > s) ? j0 + k - s : 0);
+        const unsigned int colEnd   = std::min(m_nCols-1, j1 + s - k);
 
-        //
-        // Compute normals using finite difference scheme.
-        //
-        for(unsigned int i = 1; i < m_nRows-1; ++i)
+        if(colBegin < colEnd)
         {
-            for(unsigned int j = 1; j < m_nCols-1; ++j)
+            // the row kernels update the columns [1, n-1) of the row segment they get
+            const unsigned int offset = colBegin - 1 - c0;
+            for(unsigned int i = rowBegin; i < rowEnd; ++i)
             {
-                float l = m_currSolution[i*m_nCols+j-1].y;
-                float r = m_currSolution[i*m_nCols+j+1].y;
-                float t = m_currSolution[(i-1)*m_nCols+j].y;
-                float b = m_currSolution[(i+1)*m_nCols+j].y;
-                m_normals[i*m_nCols+j].x = l-r;
-                m_normals[i*m_nCols+j].y = 2.0f*m_spatialStep;
-                m_normals[i*m_nCols+j].z = b-t;
-
-                m_normals[i*m_nCols+j] = glm::normalize(m_normals[i*m_nCols+j]);
-
-                m_tangentX[i*m_nCols+j] = glm::vec4(2.0f*m_spatialStep, r-l, 0.0f, 1.0f);
-                m_tangentX[i*m_nCols+j] = glm::normalize(m_tangentX[i*m_nCols+j]);
+                const unsigned int row = (i-r0)*width + offset;
+                m_kernels->updateHeightRow(&prev[row], &curr[row - width], &curr[row], &curr[row + width],
+                                           colEnd - colBegin + 2, m_k1, m_k2, m_k3);
             }
         }
+        std::swap(prev, curr);
+    }
+
+    for(unsigned int i = i0; i < i1; ++i)
+    {
+        std::copy(&prev[(i-r0)*width + (j0-c0)], &prev[(i-r0)*width + (j1-c0)], &m_nextPrevHeights[i*m_nCols + j0]);
+        std::copy(&curr[(i-r0)*width + (j0-c0)], &curr[(i-r0)*width + (j1-c0)], &m_nextCurrHeights[i*m_nCols + j0]);
+    }
+}
+
+void CPUWaves::forEachRowBand(void (CPUWaves::*pass)(unsigned int, unsigned int))
+{
+    // only update interior points; we use zero boundary conditions.
+    if(m_threadPool == 0)
+    {
+        (this->*pass)(1, m_nRows-1);
+        return;
     }
+
+    const unsigned int interiorRows = m_nRows-2;
+    const unsigned int bands = m_threadPool->threadCount();
+    m_threadPool->run(bands, [this, pass, interiorRows, bands](unsigned int band)
+    {
+        unsigned int rowBegin = 1 + band * interiorRows / bands;
+        unsigned int rowEnd   = 1 + (band+1) * interiorRows / bands;
+        (this->*pass)(rowBegin, rowEnd);
+    });
+}
+
+void CPUWaves::updateHeights(unsigned int rowBegin, unsigned int rowEnd)
+{
+    // After this update we will be discarding the old previous
+    // buffer, so overwrite that buffer with the new update.
+    // Note how we can do this inplace (read/write to same element) 
+    // because we won't need prev_ij again and the assignment happens last.
+
+    // Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+    // Moreover, our +z axis goes "down"; this is just to 
+    // keep consistent with our row indices going down.
+    for(unsigned int i = rowBegin; i < rowEnd; ++i)
+    {
+        m_kernels->updateHeightRow(&m_prevHeights[i*m_nCols],
+                                   &m_currHeights[(i-1)*m_nCols],
+                                   &m_currHeights[i*m_nCols],
+                                   &m_currHeights[(i+1)*m_nCols],
+                                   m_nCols, m_k1, m_k2, m_k3);
+        applyStepDrops(&m_prevHeights[i*m_nCols], i);
+    }
+}
+
+void CPUWaves::computeNormals(unsigned int rowBegin, unsigned int rowEnd)
+{
+    //
+    // Compute normals using finite difference scheme.
+    //
+    for(unsigned int i = rowBegin; i < rowEnd; ++i)
+    {
+        computeNormalRow(m_currHeights, i);
+    }
+}
+
+void CPUWaves::computeNormalRow(const float* heights, unsigned int i)
+{
+    glm::vec4* normals = (m_outputNormals != 0) ? m_outputNormals : m_normals;
+    m_kernels->computeNormalRow(&heights[(i-1)*m_nCols],
+                                &heights[i*m_nCols],
+                                &heights[(i+1)*m_nCols],
+                                reinterpret_cast<float*>(&normals[i*m_nCols]),
+                                reinterpret_cast<float*>(&m_tangentX[i*m_nCols]),
+                                m_nCols, m_spatialStep);
+    writeOutputRow(heights, i);
+}
+
+void CPUWaves::writeOutputRow(const float* heights, unsigned int i)
+{
+    // the row was just read by the normal kernel and is still in cache
+    if(m_outputPositions != 0)
+    {
+        glm::vec4* positions = &m_outputPositions[i*m_nCols];
+        const float* row = &heights[i*m_nCols];
+        const float z = m_halfDepth - i*m_spatialStep;
+        for(unsigned int j = 0; j < m_nCols; ++j)
+        {
+            positions[j] = glm::vec4(-m_halfWidth + j*m_spatialStep, row[j], z, 1.0f);
+        }
+    }
+
+    // the boundary keeps the flat normal set by init(), a foreign target has to get it every step
+    if(m_outputNormals != 0)
+    {
+        m_outputNormals[i*m_nCols] = glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+        m_outputNormals[(i+1)*m_nCols - 1] = glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+    }
+}
+
+void CPUWaves::writeOutputBoundaryRows()
+{
+    if(m_nRows < 2 || (m_outputPositions == 0 && m_outputNormals == 0))
+    {
+        return;
+    }
+
+    const unsigned int boundaryRows[] = {0, m_nRows-1};
+    for(unsigned int k = 0; k < 2; ++k)
+    {
+        unsigned int i = boundaryRows[k];
+        writeOutputRow(m_currHeights, i);
+        if(m_outputNormals != 0)
+        {
+            std::fill(m_outputNormals + i*m_nCols, m_outputNormals + (i+1)*m_nCols, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+        }
+    }
+}
+
+void CPUWaves::updateHeightsAndNormals(unsigned int rowBegin, unsigned int rowEnd)
+{
+    // The new heights go to m_prevHeights. The normals of row i-1 need the new rows
+    // i-2 to i, so they are computed right after row i while those rows are still in cache.
+    // The first and last row of a band also need a new row of the neighbouring band,
+    // unless that row is the boundary, which is never updated.
+    if(rowBegin >= rowEnd)
+    {
+        return;
+    }
+
+    const bool firstDeferred = rowBegin > 1;
+    const bool lastDeferred = rowEnd < m_nRows-1;
+
+    for(unsigned int i = rowBegin; i < rowEnd; ++i)
+    {
+        m_kernels->updateHeightRow(&m_prevHeights[i*m_nCols],
+                                   &m_currHeights[(i-1)*m_nCols],
+                                   &m_currHeights[i*m_nCols],
+                                   &m_currHeights[(i+1)*m_nCols],
+                                   m_nCols, m_k1, m_k2, m_k3);
+        applyStepDrops(&m_prevHeights[i*m_nCols], i);
+
+        unsigned int normalRow = i-1;
+        if(normalRow > rowBegin || (normalRow == rowBegin && !firstDeferred))
+        {
+            computeNormalRow(m_prevHeights, normalRow);
+        }
+    }
+
+    if(!lastDeferred && (rowEnd-1 > rowBegin || !firstDeferred))
+    {
+        computeNormalRow(m_prevHeights, rowEnd-1);
+    }
+}
+
+void CPUWaves::computeBandEdgeNormals(unsigned int rowBegin, unsigned int rowEnd)
+{
+    // runs after the swap, the new heights of all bands are in m_currHeights now
+    if(rowBegin >= rowEnd)
+    {
+        return;
+    }
+
+    const bool firstDeferred = rowBegin > 1;
+    const bool lastDeferred = rowEnd < m_nRows-1;
+    if(firstDeferred)
+    {
+        computeNormalRow(m_currHeights, rowBegin);
+    }
+    if(lastDeferred && (rowEnd-1 > rowBegin || !firstDeferred))
+    {
+        computeNormalRow(m_currHeights, rowEnd-1);
+    }
+}
+
+void CPUWaves::takeStepDrops()
+{
+    m_stepDrops.clear();
+    m_disturbances.take(m_stepDrops, m_disturbances.size());
+
+    unsigned int firstRainDrop = m_disturbances.advanceRain(1);
+    for(unsigned int n = 0; n < m_disturbances.rainPerStep(); ++n)
+    {
+        m_stepDrops.push_back(m_disturbances.rainDrop(firstRainDrop + n, m_nRows, m_nCols));
+    }
+}
+
+void CPUWaves::applyStepDrops(float* row, unsigned int i)
+{
+    // the row was just updated and is still in cache, the boundary is never disturbed
+    for(unsigned int d = 0; d < m_stepDrops.size(); ++d)
+    {
+        const Drop& drop = m_stepDrops[d];
+        if(fabsf(static_cast<float>(i) - drop.row) > drop.radius)
+        {
+            continue;
+        }
+
+        int columnBegin = std::max(1, static_cast<int>(ceilf(drop.column - drop.radius)));
+        int columnEnd = std::min(static_cast<int>(m_nCols)-1, static_cast<int>(floorf(drop.column + drop.radius)) + 1);
+        for(int j = columnBegin; j < columnEnd; ++j)
+        {
+            row[j] += DisturbanceQueue::dropHeight(drop, i, j);
+        }
+    }
+}
+
+DisturbanceQueue& CPUWaves::disturbances()
+{
+    return m_disturbances;
 }
 
 void CPUWaves::disturb(unsigned int i, unsigned int j, float magnitude)
@@ -218,9 +770,16 @@ void CPUWaves::disturb(unsigned int i, unsigned int j, float magnitude)
     float halfMag = 0.5f * magnitude;
 
     // Disturb the ijth vertex height and its neighbors.
-    m_currSolution[i*m_nCols+j].y     += magnitude;
-    m_currSolution[i*m_nCols+j+1].y   += halfMag;
-    m_currSolution[i*m_nCols+j-1].y   += halfMag;
-    m_currSolution[(i+1)*m_nCols+j].y += halfMag;
-    m_currSolution[(i-1)*m_nCols+j].y += halfMag;
+    m_currHeights[i*m_nCols+j]     += magnitude;
+    m_currHeights[i*m_nCols+j+1]   += halfMag;
+    m_currHeights[i*m_nCols+j-1]   += halfMag;
+    m_currHeights[(i+1)*m_nCols+j] += halfMag;
+    m_currHeights[(i-1)*m_nCols+j] += halfMag;
+
+    // the float heights are the decoded fp16 heights, so the disturbed rows are stored again
+    if(m_halfStorage)
+    {
+        m_halfConversions->toHalfRow(&m_currHeights[(i-1)*m_nCols], &m_currHalfHeights[(i-1)*m_nCols], 3*m_nCols);
+        m_halfConversions->toFloatRow(&m_currHalfHeights[(i-1)*m_nCols], &m_currHeights[(i-1)*m_nCols], 3*m_nCols);
+    }
 }
\ No newline at end of file
@@ -24,14 +24,32 @@
 #ifndef CPU_WAVES_H
 #define CPU_WAVES_H
 
+// own
+#include "DisturbanceQueue.h"
+
 // glm
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform2.hpp>
 
+// std
+#include <vector>
+#include <cstdint>
+
+class ThreadPool;
+struct StencilKernelSet;
+struct HalfConversionSet;
+
 class CPUWaves
 {
 public:
+    // TWO_PASS sweeps the grid once for the heights and once for the normals,
+    // FUSED emits the normals of row i-1 right after updating row i+1.
+    enum PassMode
+    {
+        TWO_PASS, FUSED
+    };
+
     CPUWaves();
     ~CPUWaves();
 
@@ -44,12 +62,26 @@ public:
     const float* k1() const;
     const float* k2() const;
     const float* k3() const;
+    float timeStep() const;
 
-    inline glm::vec4* getCurrentWaves() const {return m_currSolution;}
+    // assembles the vec4 positions of the current solution for renderers that need them.
+    glm::vec4* getCurrentWaves() const;
     inline glm::vec4* getCurrentNormals() const {return m_normals;}
 
+    // returns the height plane of the current solution (rowCount() x columnCount() floats).
+    inline const float* getCurrentHeights() const {return m_currHeights;}
+
     // returns the solution at the ith grid point
-    inline const glm::vec4& operator[](int i) const {return m_currSolution[i];}
+    inline glm::vec4 operator[](int i) const {return position(i);}
+
+    // returns the position of the ith grid point, x and z are computed from the grid index.
+    inline glm::vec4 position(int i) const
+    {
+        return glm::vec4(-m_halfWidth + (i % m_nCols) * m_spatialStep,
+                         m_currHeights[i],
+                         m_halfDepth - (i / m_nCols) * m_spatialStep,
+                         1.0f);
+    }
 
     // returns the solution normal at the ith grid point.
     inline const glm::vec4& normal(int i) const { return m_normals[i]; }
@@ -59,9 +91,100 @@ public:
 
     void init(unsigned int m, unsigned int n, float dx, float dt, float speed, float damping);
     void update(double dt);
+
+    // accumulates the elapsed time and returns true if update() would step now, resetting
+    // the clock. Lets callers prepare the output target only for frames that step.
+    bool stepDue(double dt);
+
+    // advances the simulation by exactly one time step, independent of the elapsed time.
+    void step();
+
+    // advances the simulation by n time steps with the same result as n calls of step().
+    // Normals and tangents are only computed for the final step.
+    void stepN(unsigned int n);
+
+    // lets stepN() advance cache sized tiles by up to stepsPerPass steps per sweep
+    // over the grid instead of sweeping the whole grid once per step. The tiles
+    // recompute a halo of stepsPerPass cells. tileSize 0 picks a size that fits into L2.
+    // stepsPerPass <= 1 disables temporal blocking.
+    void setTemporalBlocking(unsigned int stepsPerPass, unsigned int tileSize = 0);
+    unsigned int temporalBlockingSteps() const;
+
+    // selects how the last step of step()/stepN() produces the normals, defaults to FUSED.
+    void setPassMode(PassMode mode);
+    PassMode passMode() const;
+
+    // lets step()/stepN() skip the normals and tangents for renderers that derive them from
+    // the heights. normal() and tangentX() keep the values of the last step computing them.
+    void setNormalOutput(bool enabled);
+    bool normalOutput() const;
+
+    // redirects the output stage of the steps computing normals: the positions and normals
+    // of all vertices are written to the given arrays of vertexCount() elements, e.g. a
+    // mapped vertex buffer, which saves copying them out of the solver. The arrays are only
+    // written, never read. Without normals the internal ones of normal() stay the target,
+    // without positions none are written. setOutput(0, 0) restores the defaults.
+    void setOutput(glm::vec4* positions, glm::vec4* normals);
+
+    // runs the output stage on the current heights without stepping, e.g. to fill a new buffer
+    void writeOutput(glm::vec4* positions, glm::vec4* normals);
+
+    // splits the interior rows into bands processed by a persistent pool of n threads.
+    // n <= 1 steps on the calling thread only.
+    void setThreadCount(unsigned int n);
+    unsigned int threadCount() const;
+
+    // row kernels used by step(), defaults to the fastest set the CPU supports.
+    void setStencilKernels(const StencilKernelSet& kernels);
+    const StencilKernelSet& stencilKernels() const;
+
+    // stores the height planes as fp16 and computes in fp32, which halves the traffic of
+    // the height updates. Every step converts the rows it needs, the normals and
+    // getCurrentHeights() use a float copy of the heights decoded after the last step.
+    // Temporal blocking and the pass mode don't apply. Switching on rounds the heights.
+    void setHalfStorage(bool enabled);
+    bool halfStorage() const;
+
     void disturb(unsigned int i, unsigned int j, float magnitude);
 
+    // drops added to the new heights of the next step while the rows are updated,
+    // steps with drops or rain run without temporal blocking
+    DisturbanceQueue& disturbances();
+
 private:
+    CPUWaves(const CPUWaves&);
+    CPUWaves& operator=(const CPUWaves&);
+
+    // passes of a time step over the rows [rowBegin, rowEnd)
+    void updateHeights(unsigned int rowBegin, unsigned int rowEnd);
+    void computeNormals(unsigned int rowBegin, unsigned int rowEnd);
+    void computeNormalRow(const float* heights, unsigned int i);
+
+    // positions and boundary normals of an output target, the kernels only write interior normals
+    void writeOutputRow(const float* heights, unsigned int i);
+    void writeOutputBoundaryRows();
+
+    // moves the queued drops and the rain of the next step to m_stepDrops
+    void takeStepDrops();
+    void applyStepDrops(float* row, unsigned int i);
+
+    // time steps on the fp16 planes, rows are converted to float around the row kernels
+    void stepHalf(unsigned int n);
+    void updateHalfHeights(unsigned int rowBegin, unsigned int rowEnd);
+    void decodeHalfHeights(unsigned int rowBegin, unsigned int rowEnd);
+
+    // fused height and normal pass; the normals of the band edge rows depend on
+    // the neighbouring bands and are left to computeBandEdgeNormals()
+    void updateHeightsAndNormals(unsigned int rowBegin, unsigned int rowEnd);
+    void computeBandEdgeNormals(unsigned int rowBegin, unsigned int rowEnd);
+
+    // runs a pass over all interior rows, split into one band per thread
+    void forEachRowBand(void (CPUWaves::*pass)(unsigned int, unsigned int));
+
+    // advances the heights by s steps in one sweep of temporally blocked tiles
+    void advanceBlocked(unsigned int s);
+    void advanceTile(unsigned int tile, unsigned int tileSize, unsigned int s, float* scratch);
+
     unsigned int m_nRows;
     unsigned int m_nCols;
 
@@ -75,11 +198,45 @@ private:
 
     float m_timeStep;
     float m_spatialStep;
+    float m_halfWidth;
+    float m_halfDepth;
 
-    glm::vec4* m_prevSolution;
-    glm::vec4* m_currSolution;
+    // the simulation only evolves the heights, x and z are implied by the grid
+    float* m_prevHeights;
+    float* m_currHeights;
     glm::vec4* m_normals;
     glm::vec4* m_tangentX;
+
+    // vec4 positions, only filled by getCurrentWaves()
+    mutable glm::vec4* m_positions;
+
+    // output target of the normal passes, see setOutput()
+    glm::vec4* m_outputPositions;
+    glm::vec4* m_outputNormals;
+
+    // time accumulated by stepDue() since the last step
+    double m_elapsedTime;
+
+    ThreadPool* m_threadPool;
+    const StencilKernelSet* m_kernels;
+    PassMode m_passMode;
+    bool m_normalOutput;
+
+    // temporal blocking
+    unsigned int m_blockSteps;
+    unsigned int m_tileSize;
+    float* m_nextPrevHeights;
+    float* m_nextCurrHeights;
+    std::vector<float> m_tileScratch;
+
+    DisturbanceQueue m_disturbances;
+    std::vector<Drop> m_stepDrops;
+
+    // fp16 storage, m_currHeights holds the decoded current heights
+    bool m_halfStorage;
+    const HalfConversionSet* m_halfConversions;
+    std::vector<uint16_t> m_prevHalfHeights;
+    std::vector<uint16_t> m_currHalfHeights;
 };
 
 #endif // CPU_WAVES_H
\ No newline at end of file
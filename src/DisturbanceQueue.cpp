@@ -0,0 +1,151 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "DisturbanceQueue.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+
+DisturbanceQueue::DisturbanceQueue()
+    : m_rainPerStep(0),
+      m_rainMinMagnitude(1.0f),
+      m_rainMaxMagnitude(2.0f),
+      m_rainRadius(1.0f),
+      m_rainSeed(0),
+      m_rainCounter(0)
+{
+}
+
+void DisturbanceQueue::push(unsigned int i, unsigned int j, float magnitude, float radius)
+{
+    Drop drop = {static_cast<float>(i), static_cast<float>(j), magnitude, radius};
+    m_drops.push_back(drop);
+}
+
+unsigned int DisturbanceQueue::size() const
+{
+    return m_drops.size();
+}
+
+bool DisturbanceQueue::empty() const
+{
+    return m_drops.empty();
+}
+
+void DisturbanceQueue::clear()
+{
+    m_drops.clear();
+}
+
+unsigned int DisturbanceQueue::take(std::vector<Drop>& drops, unsigned int maxDrops)
+{
+    unsigned int count = std::min(maxDrops, size());
+    drops.insert(drops.end(), m_drops.begin(), m_drops.begin() + count);
+    m_drops.erase(m_drops.begin(), m_drops.begin() + count);
+    return count;
+}
+
+void DisturbanceQueue::setRain(unsigned int dropsPerStep, float minMagnitude, float maxMagnitude, float radius)
+{
+    m_rainPerStep = dropsPerStep;
+    m_rainMinMagnitude = minMagnitude;
+    m_rainMaxMagnitude = maxMagnitude;
+    m_rainRadius = radius;
+}
+
+unsigned int DisturbanceQueue::rainPerStep() const
+{
+    return m_rainPerStep;
+}
+
+float DisturbanceQueue::rainMinMagnitude() const
+{
+    return m_rainMinMagnitude;
+}
+
+float DisturbanceQueue::rainMaxMagnitude() const
+{
+    return m_rainMaxMagnitude;
+}
+
+float DisturbanceQueue::rainRadius() const
+{
+    return m_rainRadius;
+}
+
+void DisturbanceQueue::setRainSeed(unsigned int seed)
+{
+    m_rainSeed = seed;
+}
+
+unsigned int DisturbanceQueue::rainSeed() const
+{
+    return m_rainSeed;
+}
+
+unsigned int DisturbanceQueue::advanceRain(unsigned int steps)
+{
+    unsigned int first = m_rainCounter;
+    m_rainCounter += steps * m_rainPerStep;
+    return first;
+}
+
+Drop DisturbanceQueue::rainDrop(unsigned int n, unsigned int rows, unsigned int cols) const
+{
+    // three independent values per drop, the boundary is never disturbed
+    unsigned int row = hash(m_rainSeed ^ hash(3*n));
+    unsigned int column = hash(m_rainSeed ^ hash(3*n + 1));
+    unsigned int magnitude = hash(m_rainSeed ^ hash(3*n + 2));
+
+    Drop drop;
+    drop.row = static_cast<float>(1 + row % (rows-2));
+    drop.column = static_cast<float>(1 + column % (cols-2));
+    drop.magnitude = m_rainMinMagnitude + (m_rainMaxMagnitude - m_rainMinMagnitude) * ((magnitude >> 8) * (1.0f / 16777216.0f));
+    drop.radius = m_rainRadius;
+    return drop;
+}
+
+float DisturbanceQueue::dropHeight(const Drop& drop, unsigned int i, unsigned int j)
+{
+    float di = static_cast<float>(i) - drop.row;
+    float dj = static_cast<float>(j) - drop.column;
+    float distanceSquared = di*di + dj*dj;
+    if(distanceSquared > drop.radius * drop.radius)
+    {
+        return 0.0f;
+    }
+    return drop.magnitude * (1.0f - sqrtf(distanceSquared) / (2.0f * drop.radius));
+}
+
+unsigned int DisturbanceQueue::hash(unsigned int x)
+{
+    // integer finalizer with good avalanche, cheap enough to evaluate per work item
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
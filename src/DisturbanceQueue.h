@@ -0,0 +1,99 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef DISTURBANCE_QUEUE_H
+#define DISTURBANCE_QUEUE_H
+
+// std
+#include <deque>
+#include <vector>
+
+/**
+*   @brief A water drop, laid out like the float4 the OpenCL kernels read.
+*
+*   The drop adds magnitude * (1 - d / (2 * radius)) to every cell within the distance
+*   d <= radius of its center, so radius 1 gives the cross pattern of CPUWaves::disturb.
+*/
+struct Drop
+{
+    float row;
+    float column;
+    float magnitude;
+    float radius;
+};
+
+/**
+*   @brief Collects drops on the host and describes drops generated during the steps.
+*
+*   The solvers apply the queued drops as a source term to the new heights of their next
+*   time step, inside the height update and without launches of their own. Rain adds
+*   rainPerStep() drops to every step. Rain drops are numbered and computed from their number
+*   with a counter based hash, so the OpenCL kernels generate the same drops as rainDrop().
+*/
+class DisturbanceQueue
+{
+public:
+    DisturbanceQueue();
+
+    void push(unsigned int i, unsigned int j, float magnitude, float radius = 1.0f);
+
+    unsigned int size() const;
+    bool empty() const;
+    void clear();
+
+    // moves at most maxDrops queued drops to the end of drops, oldest first, and returns their number
+    unsigned int take(std::vector<Drop>& drops, unsigned int maxDrops);
+
+    // 0 drops per step disables the rain
+    void setRain(unsigned int dropsPerStep, float minMagnitude = 1.0f, float maxMagnitude = 2.0f, float radius = 1.0f);
+    unsigned int rainPerStep() const;
+    float rainMinMagnitude() const;
+    float rainMaxMagnitude() const;
+    float rainRadius() const;
+
+    void setRainSeed(unsigned int seed);
+    unsigned int rainSeed() const;
+
+    // returns the number of the first rain drop of the next step and skips the drops of steps steps
+    unsigned int advanceRain(unsigned int steps);
+
+    // the rain drop with number n on a rows x cols grid, same as rain_drop in WaveSimulation.cl
+    Drop rainDrop(unsigned int n, unsigned int rows, unsigned int cols) const;
+
+    // height a drop adds to the cell in row i and column j
+    static float dropHeight(const Drop& drop, unsigned int i, unsigned int j);
+
+    static unsigned int hash(unsigned int x);
+
+private:
+    std::deque<Drop> m_drops;
+
+    unsigned int m_rainPerStep;
+    float m_rainMinMagnitude;
+    float m_rainMaxMagnitude;
+    float m_rainRadius;
+    unsigned int m_rainSeed;
+    unsigned int m_rainCounter;
+};
+
+#endif // DISTURBANCE_QUEUE_H
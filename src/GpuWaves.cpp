@@ -23,6 +23,10 @@
 
 #include "GpuWaves.h"
 
+// std
+#include <algorithm>
+#include <sstream>
+
 GPUWaves::GPUWaves()
     : m_nRows(0),
     m_nCols(0),
@@ -33,15 +37,13 @@ GPUWaves::GPUWaves()
     m_k3(0.0f),
     m_timeStep(0.0f),
     m_spatialStep(0.0f),
-    m_vertices(0),
-    m_indices(0)
+    m_heights(0)
 {
 }
 
 GPUWaves::~GPUWaves()
 {
-    delete[] m_vertices;
-    delete[] m_indices;
+    delete[] m_heights;
 }
 
 unsigned int GPUWaves::rowCount() const
@@ -112,57 +114,77 @@ void GPUWaves::init(unsigned int m, unsigned int n, float dx, float dt, float sp
     m_k2     = (4.0f-8.0f*e) / d;
     m_k3     = (2.0f*e) / d;
 
-    delete[] m_vertices;
+    delete[] m_heights;
 
-    m_vertices  = new glm::vec4[m*n];
+    m_heights = new float[m*n];
+    std::fill(m_heights, m_heights + m*n, 0.0f);
+}
 
-    float halfWidth = (n-1)*dx*0.5f;
-    float halfDepth = (m-1)*dx*0.5f;
+float* GPUWaves::getHeights() const
+{
+    return m_heights;
+}
 
-    for(unsigned int i = 0; i < m; ++i)
-    {
-        float z = halfDepth - i*dx;
-        for(unsigned int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j * dx;
+size_t GPUWaves::localTileSize(const size_t local[2])
+{
+    return (local[0]+2) * (local[1]+2) * sizeof(float);
+}
 
-            m_vertices[i*n+j]  = glm::vec4(x, 0.0f, z, 1.0f);
-        }
+bool GPUWaves::useLocalMemoryTiling(cl_device_id device, const size_t local[2])
+{
+    cl_device_local_mem_type memType = CL_GLOBAL;
+    cl_ulong memSize = 0;
+    size_t maxWorkGroupSize = 0;
+    if(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(memType), &memType, NULL) != CL_SUCCESS ||
+       clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(memSize), &memSize, NULL) != CL_SUCCESS ||
+       clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL) != CL_SUCCESS)
+    {
+        return false;
     }
 
-    createIndices();
+    return memType == CL_LOCAL &&
+           local[0] * local[1] <= maxWorkGroupSize &&
+           localTileSize(local) + groupDropListSize() <= memSize;
 }
 
-void GPUWaves::createIndices()
+std::string GPUWaves::programOptions()
 {
-    delete[] m_indices;
-    m_indices = new unsigned int[3 * m_nTriangles];
-    unsigned int m = m_nRows;
-    unsigned int n = m_nCols;
-    unsigned int k = 0;
-    for(unsigned int i = 0; i < m-1; ++i)
-    {
-        for(unsigned int j = 0; j < n-1; ++j)
-        {
-            m_indices[k]   = i*n+j;
-            m_indices[k+1] = i*n+j+1;
-            m_indices[k+2] = (i+1)*n+j;
-
-            m_indices[k+3] = (i+1)*n+j;
-            m_indices[k+4] = i*n+j+1;
-            m_indices[k+5] = (i+1)*n+j+1;
+    std::stringstream options;
+    options << "-D GROUP_DROP_CAPACITY=" << GROUP_DROP_CAPACITY << " -D GROUP_DROP_CHUNK=" << GROUP_DROP_CHUNK;
+    return options.str();
+}
 
-            k += 6; // next quad
-        }
-    }
+size_t GPUWaves::groupDropListSize()
+{
+    return (GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK) * 4 * sizeof(float) + sizeof(int);
 }
 
-const unsigned int* GPUWaves::getIndices() const
+size_t GPUWaves::multiStepTileSize(const size_t local[2], unsigned int steps)
 {
-    return m_indices;
+    return (local[0] + 2*steps) * (local[1] + 2*steps) * sizeof(float);
 }
 
-glm::vec4* GPUWaves::getVertices() const
+unsigned int GPUWaves::multiStepCount(cl_device_id device, const size_t local[2])
 {
-    return m_vertices;
-}
\ No newline at end of file
+    if(!useLocalMemoryTiling(device, local))
+    {
+        return 1;
+    }
+
+    cl_ulong memSize = 0;
+    clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(memSize), &memSize, NULL);
+
+    const size_t coreCells = local[0] * local[1];
+    unsigned int steps = 1;
+    while(true)
+    {
+        unsigned int next = steps + 1;
+        size_t tileCells = (local[0] + 2*next) * (local[1] + 2*next);
+        if(tileCells > 2*coreCells || 2*multiStepTileSize(local, next) + groupDropListSize() > memSize)
+        {
+            break;
+        }
+        steps = next;
+    }
+    return steps;
+}
@@ -24,6 +24,9 @@
 #ifndef GPU_WAVES_H
 #define GPU_WAVES_H
 
+// std
+#include <string>
+
 // ocl
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
@@ -39,8 +42,9 @@ public:
     GPUWaves();
     ~GPUWaves();
 
-    const unsigned int* getIndices() const;
-    glm::vec4* getVertices() const;
+    // initial height of every grid vertex. The x and z coordinates are implied by
+    // the vertex index and reconstructed by the kernels, see grid_position.
+    float* getHeights() const;
 
     unsigned int rowCount() const;
     unsigned int columnCount() const;
@@ -55,8 +59,32 @@ public:
 
     void init(unsigned int m, unsigned int n, float dx, float dt, float speed, float damping);
 
-protected:
-    void createIndices();
+    // bytes of __local memory compute_vertex_displacement_local needs for a work group
+    static size_t localTileSize(const size_t local[2]);
+
+    // true if compute_vertex_displacement_local should be used on the device, i.e. it
+    // has dedicated local memory and fits the work group and its tile. CPU runtimes
+    // emulate local memory in global memory and are better off with the plain kernel.
+    static bool useLocalMemoryTiling(cl_device_id device, const size_t local[2]);
+
+    // drops the step kernels keep per work group and drops they stage per pass while culling,
+    // WaveSimulation.cl gets them from programOptions()
+    static const unsigned int GROUP_DROP_CAPACITY = 128;
+    static const unsigned int GROUP_DROP_CHUNK = 64;
+
+    // build options every program of WaveSimulation.cl needs
+    static std::string programOptions();
+
+    // bytes of __local memory the step kernels keep for the drops of a work group
+    static size_t groupDropListSize();
+
+    // bytes of __local memory compute_multi_step needs for each of its two tiles
+    static size_t multiStepTileSize(const size_t local[2], unsigned int steps);
+
+    // time steps per launch of compute_multi_step on the device. The halo grows with
+    // the steps, so at most as many are picked as keep the redundant work below the
+    // work of the core. 1 on devices without dedicated local memory.
+    static unsigned int multiStepCount(cl_device_id device, const size_t local[2]);
 
 private:
     unsigned int m_nRows;
@@ -73,8 +101,7 @@ private:
     float m_timeStep;
     float m_spatialStep;
 
-    glm::vec4* m_vertices;
-    unsigned int* m_indices;
+    float* m_heights;
 };
 
 #endif // GPU_WAVES_H
\ No newline at end of file
@@ -0,0 +1,332 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "GridMesh.h"
+
+// std
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+// vertices per row of a column block. The strip of the next row finds the shared vertices
+// in a FIFO cache only while two rows of the block take less than its CACHE_SIZE entries,
+// with 16 columns every vertex misses again. 12 leaves room for smaller caches.
+static const unsigned int BLOCK_COLUMNS = 12;
+static const unsigned int CACHE_SIZE = 32;
+
+static const GLuint RESTART_INDEX_32 = 0xffffffff;
+static const GLushort RESTART_INDEX_16 = 0xffff;
+
+GridMesh::GridMesh()
+    : m_nRows(0),
+      m_nCols(0),
+      m_layout(TRIANGLE_LIST),
+      m_ibo(0),
+      m_indexBytes(0),
+      m_cacheMissRatio(0.0),
+      m_queryFrame(0),
+      m_drawSeconds(0.0),
+      m_timedDraws(0)
+{
+    m_timerQueries[0] = 0;
+    m_timerQueries[1] = 0;
+}
+
+void GridMesh::build(unsigned int rows, unsigned int columns, Layout layout)
+{
+    m_nRows = rows;
+    m_nCols = columns;
+    m_layout = layout;
+    m_counts.clear();
+    m_offsets.clear();
+    m_baseVertices.clear();
+
+    if(m_ibo == 0)
+    {
+        glGenBuffers(1, &m_ibo);
+        glGenQueries(2, m_timerQueries);
+    }
+    m_queryFrame = 0;
+    m_drawSeconds = 0.0;
+    m_timedDraws = 0;
+
+    if(rows < 2 || columns < 2)
+    {
+        upload(std::vector<GLuint>(), RESTART_INDEX_32);
+        return;
+    }
+
+    // a band needs at least two rows below the restart index
+    if(m_layout == TILED_STRIPS && 2*columns > RESTART_INDEX_16)
+    {
+        std::cerr << "Grid rows of " << columns << " vertices exceed 16 bit indices, using 32 bit strips\n";
+        m_layout = TRIANGLE_STRIPS;
+    }
+
+    if(m_layout == TRIANGLE_LIST)
+    {
+        std::vector<GLuint> indices;
+        indices.reserve(6 * (rows-1) * (columns-1));
+        for(unsigned int i = 0; i < rows-1; ++i)
+        {
+            for(unsigned int j = 0; j < columns-1; ++j)
+            {
+                indices.push_back(i*columns+j);
+                indices.push_back(i*columns+j+1);
+                indices.push_back((i+1)*columns+j);
+
+                indices.push_back((i+1)*columns+j);
+                indices.push_back(i*columns+j+1);
+                indices.push_back((i+1)*columns+j+1);
+            }
+        }
+        m_counts.push_back(static_cast<GLsizei>(indices.size()));
+        m_offsets.push_back(NULL);
+        m_baseVertices.push_back(0);
+        upload(indices, RESTART_INDEX_32);
+    }
+    else if(m_layout == TRIANGLE_STRIPS)
+    {
+        std::vector<GLuint> indices;
+        appendStrips(indices, rows, columns, RESTART_INDEX_32);
+        m_counts.push_back(static_cast<GLsizei>(indices.size()));
+        m_offsets.push_back(NULL);
+        m_baseVertices.push_back(0);
+        upload(indices, RESTART_INDEX_32);
+    }
+    else
+    {
+        // rows of quads per band, the band vertices stay below the restart index
+        unsigned int bandQuads = std::min(RESTART_INDEX_16 / columns - 1, rows - 1);
+        unsigned int fullBands = (rows - 1) / bandQuads;
+        unsigned int lastQuads = (rows - 1) % bandQuads;
+
+        std::vector<GLushort> indices;
+        appendStrips(indices, bandQuads + 1, columns, RESTART_INDEX_16);
+        size_t bandCount = indices.size();
+        for(unsigned int b = 0; b < fullBands; ++b)
+        {
+            m_counts.push_back(static_cast<GLsizei>(bandCount));
+            m_offsets.push_back(NULL);
+            m_baseVertices.push_back(static_cast<GLint>(b * bandQuads * columns));
+        }
+
+        if(lastQuads > 0)
+        {
+            appendStrips(indices, lastQuads + 1, columns, RESTART_INDEX_16);
+            m_counts.push_back(static_cast<GLsizei>(indices.size() - bandCount));
+            m_offsets.push_back(reinterpret_cast<const GLvoid*>(bandCount * sizeof(GLushort)));
+            m_baseVertices.push_back(static_cast<GLint>(fullBands * bandQuads * columns));
+        }
+        upload(indices, RESTART_INDEX_16);
+    }
+}
+
+template<typename Index>
+void GridMesh::appendStrips(std::vector<Index>& indices, unsigned int rows, unsigned int columns, Index restartIndex)
+{
+    for(unsigned int c0 = 0; c0 + 1 < columns; c0 += BLOCK_COLUMNS - 1)
+    {
+        unsigned int c1 = std::min(c0 + BLOCK_COLUMNS - 1, columns - 1);
+        for(unsigned int i = 0; i + 1 < rows; ++i)
+        {
+            // starting with the lower row keeps the winding of the triangle list
+            for(unsigned int j = c0; j <= c1; ++j)
+            {
+                indices.push_back(static_cast<Index>((i+1)*columns + j));
+                indices.push_back(static_cast<Index>(i*columns + j));
+            }
+            indices.push_back(restartIndex);
+        }
+    }
+}
+
+template<typename Index>
+void GridMesh::upload(const std::vector<Index>& indices, Index restartIndex)
+{
+    // replays the draws through a FIFO cache. A vertex hits as long as fewer than
+    // CACHE_SIZE misses happened since it was inserted.
+    std::vector<unsigned int> insertedAt(m_nRows * m_nCols, 0);
+    unsigned int misses = 0;
+    unsigned int triangles = 0;
+    for(size_t d = 0; d < m_counts.size(); ++d)
+    {
+        size_t first = reinterpret_cast<size_t>(m_offsets[d]) / sizeof(Index);
+        unsigned int primitiveLength = 0;
+        for(size_t k = first; k < first + m_counts[d]; ++k)
+        {
+            if(indices[k] == restartIndex && m_layout != TRIANGLE_LIST)
+            {
+                primitiveLength = 0;
+                continue;
+            }
+
+            unsigned int vertex = indices[k] + m_baseVertices[d];
+            if(insertedAt[vertex] == 0 || misses - insertedAt[vertex] >= CACHE_SIZE)
+            {
+                ++misses;
+                insertedAt[vertex] = misses;
+            }
+
+            ++primitiveLength;
+            if(m_layout == TRIANGLE_LIST ? primitiveLength % 3 == 0 : primitiveLength >= 3)
+            {
+                ++triangles;
+            }
+        }
+    }
+    m_cacheMissRatio = triangles > 0 ? static_cast<double>(misses) / triangles : 0.0;
+
+    // the copy target leaves the element array binding of the current vertex array alone
+    m_indexBytes = indices.size() * sizeof(Index);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_ibo);
+    glBufferData(GL_COPY_WRITE_BUFFER, m_indexBytes, indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GridMesh::release()
+{
+    if(m_ibo != 0)
+    {
+        glDeleteBuffers(1, &m_ibo);
+        glDeleteQueries(2, m_timerQueries);
+        m_ibo = 0;
+        m_timerQueries[0] = 0;
+        m_timerQueries[1] = 0;
+    }
+    m_counts.clear();
+    m_offsets.clear();
+    m_baseVertices.clear();
+    m_indexBytes = 0;
+}
+
+GLuint GridMesh::indexBuffer() const
+{
+    return m_ibo;
+}
+
+void GridMesh::draw()
+{
+    if(m_counts.empty())
+    {
+        return;
+    }
+
+    GLuint query = m_timerQueries[m_queryFrame % 2];
+    if(m_queryFrame >= 2)
+    {
+        collectDrawTime(query);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+
+    if(m_layout == TRIANGLE_LIST)
+    {
+        glDrawElements(GL_TRIANGLES, m_counts[0], GL_UNSIGNED_INT, m_offsets[0]);
+    }
+    else if(m_layout == TRIANGLE_STRIPS)
+    {
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(RESTART_INDEX_32);
+        glDrawElements(GL_TRIANGLE_STRIP, m_counts[0], GL_UNSIGNED_INT, m_offsets[0]);
+        glDisable(GL_PRIMITIVE_RESTART);
+    }
+    else
+    {
+        // the restart index is compared before the base vertex is added
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(RESTART_INDEX_16);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, &m_counts[0], GL_UNSIGNED_SHORT, &m_offsets[0],
+                                      static_cast<GLsizei>(m_counts.size()), &m_baseVertices[0]);
+        glDisable(GL_PRIMITIVE_RESTART);
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    ++m_queryFrame;
+}
+
+void GridMesh::collectDrawTime(GLuint query)
+{
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    m_drawSeconds += 1e-9 * nanoseconds;
+    ++m_timedDraws;
+}
+
+GridMesh::Layout GridMesh::layout() const
+{
+    return m_layout;
+}
+
+const char* GridMesh::layoutName(Layout layout)
+{
+    switch(layout)
+    {
+    case TRIANGLE_LIST:
+        return "triangle list";
+    case TRIANGLE_STRIPS:
+        return "triangle strips";
+    case TILED_STRIPS:
+        return "tiled 16 bit strips";
+    default:
+        return "unknown";
+    }
+}
+
+size_t GridMesh::indexBytes() const
+{
+    return m_indexBytes;
+}
+
+unsigned int GridMesh::drawCount() const
+{
+    return static_cast<unsigned int>(m_counts.size());
+}
+
+double GridMesh::cacheMissRatio() const
+{
+    return m_cacheMissRatio;
+}
+
+std::string GridMesh::statistics() const
+{
+    std::stringstream sstream;
+    sstream.setf(std::ios::fixed);
+    sstream.precision(2);
+    sstream << layoutName(m_layout) << " | " << m_indexBytes / 1024.0 << " KB indices | "
+            << drawCount() << " draws | " << m_cacheMissRatio << " cache misses per triangle";
+    return sstream.str();
+}
+
+double GridMesh::drawMilliseconds()
+{
+    if(m_timedDraws == 0)
+    {
+        return -1.0;
+    }
+
+    double milliseconds = 1000.0 * m_drawSeconds / m_timedDraws;
+    m_drawSeconds = 0.0;
+    m_timedDraws = 0;
+    return milliseconds;
+}
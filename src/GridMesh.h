@@ -0,0 +1,119 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GRID_MESH_H
+#define GRID_MESH_H
+
+// ogl
+#include <GL/glew.h>
+
+// std
+#include <vector>
+#include <cstddef>
+#include <string>
+
+/**
+*   @brief Index buffer and draw calls of a regular grid of rows x columns vertices.
+*
+*   Vertex (i, j) is expected at index i*columns + j of the vertex buffers. Besides the
+*   plain triangle list the grid is drawn as triangle strips separated by primitive restart
+*   indices, or as 16 bit strips of row bands. All bands but the last share one index range
+*   and are moved to their rows with a base vertex, so the tiled index buffer does not grow
+*   with the number of rows. The strips run through narrow column blocks, so the vertices
+*   of a strip are still in the post-transform cache when the strip of the next row uses them.
+*/
+class GridMesh
+{
+public:
+    enum Layout
+    {
+        TRIANGLE_LIST,
+        TRIANGLE_STRIPS,
+        TILED_STRIPS,
+        LAYOUT_COUNT
+    };
+
+    GridMesh();
+
+    // generates the indices of the layout and uploads them. The index buffer object is
+    // created once and kept, so vertex arrays it is bound to stay valid. Tiled strips fall
+    // back to 32 bit strips if two rows do not fit 16 bit indices.
+    void build(unsigned int rows, unsigned int columns, Layout layout);
+
+    // deletes the GL objects, the context must still be current
+    void release();
+
+    // bind to GL_ELEMENT_ARRAY_BUFFER of the vertex array the grid is drawn with
+    GLuint indexBuffer() const;
+
+    // draws the grid with its vertex array bound and times the draw with a GL query
+    void draw();
+
+    Layout layout() const;
+    static const char* layoutName(Layout layout);
+
+    size_t indexBytes() const;
+    unsigned int drawCount() const;
+
+    // post-transform cache misses per triangle for a FIFO cache of 32 vertices, measured at build
+    double cacheMissRatio() const;
+
+    // layout, index buffer size, draws and cache misses in one line
+    std::string statistics() const;
+
+    // average GPU time of the draws whose timer queries completed since the last call, -1 if none
+    double drawMilliseconds();
+
+private:
+    GridMesh(const GridMesh&);
+    GridMesh& operator=(const GridMesh&);
+
+    template<typename Index>
+    static void appendStrips(std::vector<Index>& indices, unsigned int rows, unsigned int columns, Index restartIndex);
+
+    template<typename Index>
+    void upload(const std::vector<Index>& indices, Index restartIndex);
+
+    void collectDrawTime(GLuint query);
+
+    unsigned int m_nRows;
+    unsigned int m_nCols;
+    Layout m_layout;
+
+    // one entry per band of TILED_STRIPS, a single entry otherwise
+    std::vector<GLsizei> m_counts;
+    std::vector<const GLvoid*> m_offsets;
+    std::vector<GLint> m_baseVertices;
+
+    GLuint m_ibo;
+    size_t m_indexBytes;
+    double m_cacheMissRatio;
+
+    // two queries alternate, so the result read back is a frame old and rarely stalls
+    GLuint m_timerQueries[2];
+    unsigned int m_queryFrame;
+    double m_drawSeconds;
+    unsigned int m_timedDraws;
+};
+
+#endif // GRID_MESH_H
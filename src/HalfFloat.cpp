@@ -0,0 +1,87 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "HalfFloat.h"
+
+#ifdef HALF_FLOAT_F16C
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#       include <immintrin.h>
+#   else
+#       include <cpuid.h>
+#   endif
+#endif
+
+static void scalarHalfToFloatRow(const uint16_t* src, float* dst, unsigned int n)
+{
+    for(unsigned int j = 0; j < n; ++j)
+    {
+        dst[j] = HalfFloat::toFloat(src[j]);
+    }
+}
+
+static void scalarFloatToHalfRow(const float* src, uint16_t* dst, unsigned int n)
+{
+    for(unsigned int j = 0; j < n; ++j)
+    {
+        dst[j] = HalfFloat::fromFloat(src[j]);
+    }
+}
+
+static const HalfConversionSet s_scalarHalfConversions = {"scalar", scalarHalfToFloatRow, scalarFloatToHalfRow};
+
+#ifdef HALF_FLOAT_F16C
+static bool cpuSupportsF16C()
+{
+    // the conversions use the ymm registers, so the OS has to save them on context switches
+#   if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    return (info[2] & (1 << 29)) != 0 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#   else
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    __builtin_cpu_init();
+    return (ecx & (1u << 29)) != 0 && __builtin_cpu_supports("avx") != 0;
+#   endif
+}
+#endif
+
+const HalfConversionSet& HalfFloat::scalar()
+{
+    return s_scalarHalfConversions;
+}
+
+const HalfConversionSet& HalfFloat::best()
+{
+#ifdef HALF_FLOAT_F16C
+    static const HalfConversionSet* s_best = cpuSupportsF16C() ? &g_f16cHalfConversions : &s_scalarHalfConversions;
+    return *s_best;
+#else
+    return s_scalarHalfConversions;
+#endif
+}
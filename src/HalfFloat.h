@@ -0,0 +1,149 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef HALF_FLOAT_H
+#define HALF_FLOAT_H
+
+// std
+#include <cstdint>
+#include <cstring>
+
+// Conversions between float and IEEE 754 half precision (fp16) values, used by the
+// fp16 height storage of the solvers. Floats are rounded to the nearest even half like
+// the F16C instructions and vstore_half_rte, so all sets produce bit-identical results.
+
+// converts n halves of src into floats in dst
+typedef void (*HalfToFloatRowKernel)(const uint16_t* src, float* dst, unsigned int n);
+
+// converts n floats of src into halves in dst
+typedef void (*FloatToHalfRowKernel)(const float* src, uint16_t* dst, unsigned int n);
+
+struct HalfConversionSet
+{
+    const char* name;
+    HalfToFloatRowKernel toFloatRow;
+    FloatToHalfRowKernel toHalfRow;
+};
+
+class HalfFloat
+{
+public:
+    // portable implementation, always available
+    static const HalfConversionSet& scalar();
+
+    // F16C if the executing CPU supports it, determined by CPUID once
+    static const HalfConversionSet& best();
+
+    static inline uint16_t fromFloat(float value)
+    {
+        uint32_t x;
+        memcpy(&x, &value, sizeof(x));
+        uint32_t sign = (x >> 16) & 0x8000;
+        uint32_t absolute = x & 0x7fffffff;
+
+        // infinity stays infinity, NaNs stay quiet NaNs with the upper mantissa bits
+        if(absolute >= 0x7f800000)
+        {
+            return static_cast<uint16_t>(sign | 0x7c00 | (absolute > 0x7f800000 ? 0x200 | ((absolute >> 13) & 0x3ff) : 0));
+        }
+
+        // from 65520 on everything rounds to infinity
+        if(absolute >= 0x477ff000)
+        {
+            return static_cast<uint16_t>(sign | 0x7c00);
+        }
+
+        // below 2^-25 everything rounds to zero
+        if(absolute < 0x33000000)
+        {
+            return static_cast<uint16_t>(sign);
+        }
+
+        // below 2^-14 the result is subnormal, the implicit bit moves into the mantissa
+        uint32_t result, remainder, halfway;
+        if(absolute < 0x38800000)
+        {
+            uint32_t shift = 126 - (absolute >> 23);
+            uint32_t mantissa = (absolute & 0x7fffff) | 0x800000;
+            result = mantissa >> shift;
+            remainder = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        }
+        else
+        {
+            // rebias the exponent from 127 to 15, the rounding may carry into the exponent
+            result = (absolute - 0x38000000) >> 13;
+            remainder = absolute & 0x1fff;
+            halfway = 0x1000;
+        }
+
+        if(remainder > halfway || (remainder == halfway && (result & 1)))
+        {
+            ++result;
+        }
+        return static_cast<uint16_t>(sign | result);
+    }
+
+    static inline float toFloat(uint16_t value)
+    {
+        uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+
+        uint32_t x;
+        if(exponent == 0x1f)
+        {
+            x = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);
+        }
+        else if(exponent != 0)
+        {
+            x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        else if(mantissa == 0)
+        {
+            x = sign;
+        }
+        else
+        {
+            // subnormal halves are normal floats
+            exponent = 113;
+            while((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                --exponent;
+            }
+            x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+
+        float result;
+        memcpy(&result, &x, sizeof(result));
+        return result;
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define HALF_FLOAT_F16C
+extern const HalfConversionSet g_f16cHalfConversions;
+#endif
+
+#endif // HALF_FLOAT_H
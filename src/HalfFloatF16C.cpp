@@ -0,0 +1,58 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "HalfFloat.h"
+
+#ifdef HALF_FLOAT_F16C
+
+#include <immintrin.h>
+
+static void f16cHalfToFloatRow(const uint16_t* src, float* dst, unsigned int n)
+{
+    unsigned int j = 0;
+    for(; j + 8 <= n; j += 8)
+    {
+        _mm256_storeu_ps(dst + j, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j))));
+    }
+    for(; j < n; ++j)
+    {
+        dst[j] = HalfFloat::toFloat(src[j]);
+    }
+}
+
+static void f16cFloatToHalfRow(const float* src, uint16_t* dst, unsigned int n)
+{
+    unsigned int j = 0;
+    for(; j + 8 <= n; j += 8)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), _mm256_cvtps_ph(_mm256_loadu_ps(src + j), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for(; j < n; ++j)
+    {
+        dst[j] = HalfFloat::fromFloat(src[j]);
+    }
+}
+
+const HalfConversionSet g_f16cHalfConversions = {"f16c", f16cHalfToFloatRow, f16cFloatToHalfRow};
+
+#endif // HALF_FLOAT_F16C
@@ -0,0 +1,478 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "MultiDeviceWaveSolver.h"
+#include "OpenCLDeviceSelector.h"
+#include "ProgramCache.h"
+
+// std
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// a slab needs distinct rows next to its upper and lower halo and at least one interior row
+static const unsigned int MIN_SLAB_ROWS = 3;
+
+static void releaseEvent(cl_event event)
+{
+    if(event != 0)
+    {
+        clReleaseEvent(event);
+    }
+}
+
+MultiDeviceWaveSolver::MultiDeviceWaveSolver()
+    : m_rows(0),
+      m_cols(0),
+      m_k1(0.0f),
+      m_k2(0.0f),
+      m_k3(0.0f),
+      m_parity(0)
+{
+}
+
+MultiDeviceWaveSolver::~MultiDeviceWaveSolver()
+{
+    release();
+}
+
+bool MultiDeviceWaveSolver::init(const std::vector<cl_device_id>& devices, const GPUWaves& waves, const std::string& programSource,
+                                 const std::vector<double>& weights)
+{
+    release();
+    if(devices.empty())
+    {
+        std::cerr << "No OpenCL devices to distribute the grid over\n";
+        return false;
+    }
+
+    m_rows = waves.rowCount();
+    m_cols = waves.columnCount();
+    m_k1 = *waves.k1();
+    m_k2 = *waves.k2();
+    m_k3 = *waves.k3();
+
+    // slab sizes follow the throughput of the devices
+    std::vector<double> throughput(weights);
+    if(throughput.size() != devices.size())
+    {
+        throughput.resize(devices.size());
+        for(unsigned int d = 0; d < devices.size(); ++d)
+        {
+            throughput[d] = OpenCLDeviceSelector::calibrate(devices[d], programSource);
+            if(throughput[d] <= 0.0)
+            {
+                std::cerr << "Calibration failed on " << OpenCLDeviceSelector::deviceName(devices[d]) << "\n";
+                return false;
+            }
+        }
+    }
+
+    double total = 0.0;
+    for(unsigned int d = 0; d < throughput.size(); ++d)
+    {
+        total += throughput[d];
+    }
+
+    m_slabs.resize(devices.size());
+    double share = 0.0;
+    for(unsigned int d = 0; d < devices.size(); ++d)
+    {
+        Slab& slab = m_slabs[d];
+        slab.device = devices[d];
+        slab.rowBegin = (d == 0) ? 0 : m_slabs[d-1].rowEnd;
+        share += throughput[d];
+        slab.rowEnd = (d+1 == devices.size()) ? m_rows : static_cast<unsigned int>(floor(m_rows * share / total + 0.5));
+        if(slab.rowEnd < slab.rowBegin + MIN_SLAB_ROWS)
+        {
+            std::cerr << "A " << m_rows << " row grid is too small for " << devices.size() << " slabs\n";
+            m_slabs.clear();
+            return false;
+        }
+
+        std::cout << "Slab " << d << ": rows " << slab.rowBegin << " to " << slab.rowEnd << " on "
+                  << OpenCLDeviceSelector::deviceName(slab.device) << " (" << 100.0 * throughput[d] / total << "%)\n";
+    }
+
+    for(unsigned int d = 0; d < m_slabs.size(); ++d)
+    {
+        if(!initSlab(m_slabs[d], waves, programSource))
+        {
+            release();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MultiDeviceWaveSolver::initSlab(Slab& slab, const GPUWaves& waves, const std::string& programSource)
+{
+    slab.context = 0;
+    slab.boundaryQueue = 0;
+    slab.interiorQueue = 0;
+    slab.program = 0;
+    slab.stepKernel = 0;
+    slab.disturbKernel = 0;
+    slab.prev = 0;
+    slab.curr = 0;
+    slab.interiorDone = 0;
+    slab.boundaryDone = 0;
+    slab.haloBegin = (slab.rowBegin > 0) ? slab.rowBegin-1 : 0;
+    slab.haloEnd = (slab.rowEnd < m_rows) ? slab.rowEnd+1 : m_rows;
+    for(int i = 0; i < 2; ++i)
+    {
+        slab.sendTop[i].assign(m_cols, 0.0f);
+        slab.sendBottom[i].assign(m_cols, 0.0f);
+    }
+
+    cl_platform_id platform = 0;
+    clGetDeviceInfo(slab.device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+    cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0};
+
+    cl_int err = CL_SUCCESS;
+    slab.context = clCreateContext(properties, 1, &slab.device, NULL, NULL, &err);
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create OpenCL context!" << std::endl;
+        return false;
+    }
+
+    // the rows next to the halos and their transfers don't queue up behind the interior rows
+    slab.boundaryQueue = clCreateCommandQueue(slab.context, slab.device, 0, &err);
+    slab.interiorQueue = clCreateCommandQueue(slab.context, slab.device, 0, &err);
+    if(slab.boundaryQueue == 0 || slab.interiorQueue == 0)
+    {
+        std::cerr << "Error: Failed to create OpenCL command queue!" << std::endl;
+        return false;
+    }
+
+    ProgramCache programCache;
+    slab.program = programCache.build(slab.context, slab.device, programSource, GPUWaves::programOptions());
+    if(slab.program == 0)
+    {
+        return false;
+    }
+
+    slab.stepKernel = clCreateKernel(slab.program, "compute_slab_rows", &err);
+    if(!slab.stepKernel || err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create compute kernel: compute_slab_rows!" << std::endl;
+        return false;
+    }
+
+    slab.disturbKernel = clCreateKernel(slab.program, "disturb_slab", &err);
+    if(!slab.disturbKernel || err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create compute kernel: disturb_slab!" << std::endl;
+        return false;
+    }
+
+    const size_t slabSize = (slab.haloEnd - slab.haloBegin) * m_cols * sizeof(float);
+    float* heights = waves.getHeights() + slab.haloBegin * m_cols;
+    slab.prev = clCreateBuffer(slab.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, slabSize, heights, &err);
+    slab.curr = clCreateBuffer(slab.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, slabSize, heights, &err);
+    if(slab.prev == 0 || slab.curr == 0)
+    {
+        std::cerr << "Failed creating cl_mem read write buffer\n";
+        return false;
+    }
+    return true;
+}
+
+void MultiDeviceWaveSolver::disturb(unsigned int i, unsigned int j, float magnitude)
+{
+    for(unsigned int d = 0; d < m_slabs.size(); ++d)
+    {
+        // halo copies of the drop's rows have to change as well
+        Slab& slab = m_slabs[d];
+        if(i+1 < slab.haloBegin || i > slab.haloEnd)
+        {
+            continue;
+        }
+
+        int row = static_cast<int>(i);
+        int column = static_cast<int>(j);
+        int width = static_cast<int>(m_cols);
+        int rowBegin = static_cast<int>(slab.haloBegin);
+        int rowCount = static_cast<int>(slab.haloEnd - slab.haloBegin);
+        clSetKernelArg(slab.disturbKernel, 0, sizeof(cl_mem), (void*)&slab.curr);
+        clSetKernelArg(slab.disturbKernel, 1, sizeof(int), &row);
+        clSetKernelArg(slab.disturbKernel, 2, sizeof(int), &column);
+        clSetKernelArg(slab.disturbKernel, 3, sizeof(int), &width);
+        clSetKernelArg(slab.disturbKernel, 4, sizeof(int), &rowBegin);
+        clSetKernelArg(slab.disturbKernel, 5, sizeof(int), &rowCount);
+        clSetKernelArg(slab.disturbKernel, 6, sizeof(float), &magnitude);
+
+        // the interior rows of the next step wait for the boundary queue
+        size_t global[] = {1, 1};
+        cl_event waitFor = slab.interiorDone;
+        cl_event done = 0;
+        if(clEnqueueNDRangeKernel(slab.boundaryQueue, slab.disturbKernel, 2, NULL, global, NULL,
+                                  waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+        {
+            std::cerr << "Disturb Slab Kernel Execution failed\n";
+        }
+        releaseEvent(waitFor);
+        releaseEvent(slab.boundaryDone);
+        slab.interiorDone = 0;
+        slab.boundaryDone = done;
+    }
+}
+
+cl_event MultiDeviceWaveSolver::enqueueRows(Slab& slab, cl_command_queue queue, unsigned int rowBegin, unsigned int rowEnd, cl_event waitFor)
+{
+    int width = static_cast<int>(m_cols);
+    int localRow = static_cast<int>(rowBegin - slab.haloBegin);
+    clSetKernelArg(slab.stepKernel, 0, sizeof(cl_mem), (void*)&slab.prev);
+    clSetKernelArg(slab.stepKernel, 1, sizeof(cl_mem), (void*)&slab.curr);
+    clSetKernelArg(slab.stepKernel, 2, sizeof(int), &width);
+    clSetKernelArg(slab.stepKernel, 3, sizeof(int), &localRow);
+    clSetKernelArg(slab.stepKernel, 4, sizeof(float), &m_k1);
+    clSetKernelArg(slab.stepKernel, 5, sizeof(float), &m_k2);
+    clSetKernelArg(slab.stepKernel, 6, sizeof(float), &m_k3);
+
+    size_t global[] = {m_cols, rowEnd - rowBegin};
+    cl_event done = 0;
+    if(clEnqueueNDRangeKernel(queue, slab.stepKernel, 2, NULL, global, NULL,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Slab Rows Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+    return done;
+}
+
+bool MultiDeviceWaveSolver::step(unsigned int steps)
+{
+    const size_t rowSize = m_cols * sizeof(float);
+    bool ok = true;
+    for(unsigned int n = 0; n < steps; ++n)
+    {
+        // rows next to the halos first, so their transfer overlaps with the interior rows
+        std::vector<cl_event> sent(m_slabs.size(), (cl_event)0);
+        for(unsigned int d = 0; d < m_slabs.size(); ++d)
+        {
+            Slab& slab = m_slabs[d];
+            const bool hasTop = slab.rowBegin > 0;
+            const bool hasBottom = slab.rowEnd < m_rows;
+            const unsigned int updateBegin = std::max(slab.rowBegin, 1u);
+            const unsigned int updateEnd = std::min(slab.rowEnd, m_rows-1);
+
+            // the boundary rows overwrite cells the last interior launch was reading
+            cl_event haloWritten = slab.boundaryDone;
+            cl_event event = slab.interiorDone;
+            slab.boundaryDone = 0;
+            slab.interiorDone = 0;
+            if(hasTop)
+            {
+                event = enqueueRows(slab, slab.boundaryQueue, updateBegin, updateBegin+1, event);
+                ok = ok && clEnqueueReadBuffer(slab.boundaryQueue, slab.prev, CL_FALSE, (slab.rowBegin - slab.haloBegin) * rowSize,
+                                               rowSize, &slab.sendTop[m_parity][0], 0, NULL, hasBottom ? NULL : &sent[d]) == CL_SUCCESS;
+            }
+            if(hasBottom)
+            {
+                event = enqueueRows(slab, slab.boundaryQueue, updateEnd-1, updateEnd, event);
+                ok = ok && clEnqueueReadBuffer(slab.boundaryQueue, slab.prev, CL_FALSE, (slab.rowEnd-1 - slab.haloBegin) * rowSize,
+                                               rowSize, &slab.sendBottom[m_parity][0], 0, NULL, &sent[d]) == CL_SUCCESS;
+            }
+            releaseEvent(event);
+
+            // the interior rows read the halos written after the last step
+            const unsigned int interiorBegin = hasTop ? updateBegin+1 : updateBegin;
+            const unsigned int interiorEnd = hasBottom ? updateEnd-1 : updateEnd;
+            if(interiorBegin < interiorEnd)
+            {
+                slab.interiorDone = enqueueRows(slab, slab.interiorQueue, interiorBegin, interiorEnd, haloWritten);
+                ok = ok && slab.interiorDone != 0;
+            }
+            else
+            {
+                releaseEvent(haloWritten);
+            }
+
+            clFlush(slab.boundaryQueue);
+            clFlush(slab.interiorQueue);
+        }
+
+        // the devices may not share a context, so the host waits for the rows and forwards them
+        for(unsigned int d = 0; d < m_slabs.size(); ++d)
+        {
+            if(sent[d] != 0)
+            {
+                ok = ok && clWaitForEvents(1, &sent[d]) == CL_SUCCESS;
+                releaseEvent(sent[d]);
+            }
+        }
+
+        for(unsigned int d = 0; d < m_slabs.size(); ++d)
+        {
+            Slab& slab = m_slabs[d];
+            const bool hasBottom = d+1 < m_slabs.size();
+            if(d > 0)
+            {
+                ok = ok && clEnqueueWriteBuffer(slab.boundaryQueue, slab.prev, CL_FALSE, 0, rowSize, &m_slabs[d-1].sendBottom[m_parity][0],
+                                                0, NULL, hasBottom ? NULL : &slab.boundaryDone) == CL_SUCCESS;
+            }
+            if(hasBottom)
+            {
+                ok = ok && clEnqueueWriteBuffer(slab.boundaryQueue, slab.prev, CL_FALSE, (slab.haloEnd-1 - slab.haloBegin) * rowSize, rowSize,
+                                                &m_slabs[d+1].sendTop[m_parity][0], 0, NULL, &slab.boundaryDone) == CL_SUCCESS;
+            }
+            clFlush(slab.boundaryQueue);
+
+            // the new time level becomes the current one
+            std::swap(slab.prev, slab.curr);
+        }
+
+        // the writes may still read the rows sent in this step while the next step reads back new ones
+        m_parity = 1 - m_parity;
+    }
+    return ok;
+}
+
+void MultiDeviceWaveSolver::finish()
+{
+    for(unsigned int d = 0; d < m_slabs.size(); ++d)
+    {
+        clFinish(m_slabs[d].boundaryQueue);
+        clFinish(m_slabs[d].interiorQueue);
+    }
+}
+
+bool MultiDeviceWaveSolver::readHeights(float* heights)
+{
+    finish();
+    bool ok = true;
+    for(unsigned int d = 0; d < m_slabs.size(); ++d)
+    {
+        const Slab& slab = m_slabs[d];
+        ok = ok && clEnqueueReadBuffer(slab.boundaryQueue, slab.curr, CL_TRUE, (slab.rowBegin - slab.haloBegin) * m_cols * sizeof(float),
+                                       (slab.rowEnd - slab.rowBegin) * m_cols * sizeof(float), heights + slab.rowBegin * m_cols,
+                                       0, NULL, NULL) == CL_SUCCESS;
+    }
+    return ok;
+}
+
+unsigned int MultiDeviceWaveSolver::deviceCount() const
+{
+    return m_slabs.size();
+}
+
+unsigned int MultiDeviceWaveSolver::slabBegin(unsigned int device) const
+{
+    return m_slabs[device].rowBegin;
+}
+
+unsigned int MultiDeviceWaveSolver::slabRows(unsigned int device) const
+{
+    return m_slabs[device].rowEnd - m_slabs[device].rowBegin;
+}
+
+void MultiDeviceWaveSolver::release()
+{
+    finish();
+    for(unsigned int d = 0; d < m_slabs.size(); ++d)
+    {
+        releaseSlab(m_slabs[d]);
+    }
+    m_slabs.clear();
+    m_parity = 0;
+}
+
+void MultiDeviceWaveSolver::releaseSlab(Slab& slab)
+{
+    releaseEvent(slab.interiorDone);
+    releaseEvent(slab.boundaryDone);
+
+    if(slab.prev != 0)
+    {
+        clReleaseMemObject(slab.prev);
+    }
+
+    if(slab.curr != 0)
+    {
+        clReleaseMemObject(slab.curr);
+    }
+
+    if(slab.stepKernel != 0)
+    {
+        clReleaseKernel(slab.stepKernel);
+    }
+
+    if(slab.disturbKernel != 0)
+    {
+        clReleaseKernel(slab.disturbKernel);
+    }
+
+    if(slab.program != 0)
+    {
+        clReleaseProgram(slab.program);
+    }
+
+    if(slab.boundaryQueue != 0)
+    {
+        clReleaseCommandQueue(slab.boundaryQueue);
+    }
+
+    if(slab.interiorQueue != 0)
+    {
+        clReleaseCommandQueue(slab.interiorQueue);
+    }
+
+    if(slab.context != 0)
+    {
+        clReleaseContext(slab.context);
+    }
+}
+
+std::vector<cl_device_id> MultiDeviceWaveSolver::createSubDevices(cl_device_id device, unsigned int count)
+{
+    std::vector<cl_device_id> subDevices;
+    cl_uint computeUnits = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+    if(count == 0 || computeUnits / count == 0)
+    {
+        std::cerr << OpenCLDeviceSelector::deviceName(device) << " has too few compute units for " << count << " sub-devices\n";
+        return subDevices;
+    }
+
+    cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(computeUnits / count), 0};
+    cl_uint available = 0;
+    if(clCreateSubDevices(device, properties, 0, NULL, &available) != CL_SUCCESS || available < count)
+    {
+        std::cerr << OpenCLDeviceSelector::deviceName(device) << " can't be partitioned into " << count << " sub-devices\n";
+        return subDevices;
+    }
+
+    subDevices.resize(available);
+    clCreateSubDevices(device, properties, available, &subDevices[0], NULL);
+
+    // partitioning equally may leave more sub-devices than asked for
+    for(unsigned int i = count; i < available; ++i)
+    {
+        clReleaseDevice(subDevices[i]);
+    }
+    subDevices.resize(count);
+    return subDevices;
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MULTI_DEVICE_WAVE_SOLVER_H
+#define MULTI_DEVICE_WAVE_SOLVER_H
+
+// own
+#include "GpuWaves.h"
+
+// std
+#include <string>
+#include <vector>
+
+// ocl
+#include <CL/cl.h>
+
+/**
+*   @brief Advances the wave heights on several OpenCL devices at once.
+*
+*   The grid is split into horizontal slabs, one per device, whose sizes follow the
+*   measured throughput of the devices. Every device keeps its rows plus a halo row
+*   towards each neighbour. A step first advances the rows next to the halos, reads
+*   them back while the interior rows are computed on a second queue and writes them
+*   into the halos of the neighbours. Devices may belong to different platforms, so
+*   the exchange goes through host memory.
+*/
+class MultiDeviceWaveSolver
+{
+public:
+    MultiDeviceWaveSolver();
+    ~MultiDeviceWaveSolver();
+
+    /**
+    *   @brief Distributes the grid of waves over the devices.
+    *
+    *   weights are the relative throughputs of the devices, if empty every device runs
+    *   a short calibration. Returns false on failure, the reason is printed to std::cerr.
+    */
+    bool init(const std::vector<cl_device_id>& devices, const GPUWaves& waves, const std::string& programSource,
+              const std::vector<double>& weights = std::vector<double>());
+
+    void disturb(unsigned int i, unsigned int j, float magnitude);
+
+    // enqueues the time steps, the exchange of a step waits on the host for the rows next to the halos
+    bool step(unsigned int steps = 1);
+
+    // waits for all devices
+    void finish();
+
+    // blocking copy of the current heights into rows*cols floats
+    bool readHeights(float* heights);
+
+    unsigned int deviceCount() const;
+
+    // first grid row and row count of a device's slab
+    unsigned int slabBegin(unsigned int device) const;
+    unsigned int slabRows(unsigned int device) const;
+
+    void release();
+
+    /**
+    *   @brief Partitions a device into count equal sub-devices with clCreateSubDevices.
+    *   Returns no devices if the partition fails, the sub-devices are released with clReleaseDevice.
+    */
+    static std::vector<cl_device_id> createSubDevices(cl_device_id device, unsigned int count);
+
+private:
+    MultiDeviceWaveSolver(const MultiDeviceWaveSolver&);
+    MultiDeviceWaveSolver& operator=(const MultiDeviceWaveSolver&);
+
+    struct Slab
+    {
+        cl_device_id device;
+        cl_context context;
+        cl_command_queue boundaryQueue;
+        cl_command_queue interiorQueue;
+        cl_program program;
+        cl_kernel stepKernel;
+        cl_kernel disturbKernel;
+
+        // the new time level is written into prev
+        cl_mem prev;
+        cl_mem curr;
+
+        // owned grid rows [rowBegin, rowEnd), the buffers hold [haloBegin, haloEnd)
+        unsigned int rowBegin;
+        unsigned int rowEnd;
+        unsigned int haloBegin;
+        unsigned int haloEnd;
+
+        // first and last owned row of the new time level sent to the neighbours,
+        // alternating between two rows per step
+        std::vector<float> sendTop[2];
+        std::vector<float> sendBottom[2];
+
+        // last interior launch and last command of the boundary queue
+        cl_event interiorDone;
+        cl_event boundaryDone;
+    };
+
+    bool initSlab(Slab& slab, const GPUWaves& waves, const std::string& programSource);
+    cl_event enqueueRows(Slab& slab, cl_command_queue queue, unsigned int rowBegin, unsigned int rowEnd, cl_event waitFor);
+    void releaseSlab(Slab& slab);
+
+    std::vector<Slab> m_slabs;
+    unsigned int m_rows;
+    unsigned int m_cols;
+    float m_k1;
+    float m_k2;
+    float m_k3;
+    int m_parity;
+};
+
+#endif // MULTI_DEVICE_WAVE_SOLVER_H
@@ -0,0 +1,460 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "OpenCLDeviceSelector.h"
+#include "OpenCLWaveSolver.h"
+#include "GpuWaves.h"
+
+// std
+#include <iostream>
+#include <cstdlib>
+#include <cctype>
+#include <chrono>
+#include <algorithm>
+
+// grid and time steps of a calibration run
+static const unsigned int CALIBRATION_SIZE = 512;
+static const unsigned int CALIBRATION_STEPS = 20;
+
+static std::string lowerCase(std::string text)
+{
+    for(std::string::size_type i = 0; i < text.size(); ++i)
+    {
+        text[i] = static_cast<char>(tolower(static_cast<unsigned char>(text[i])));
+    }
+    return text;
+}
+
+static bool isIndex(const std::string& text)
+{
+    if(text.empty())
+    {
+        return false;
+    }
+    for(std::string::size_type i = 0; i < text.size(); ++i)
+    {
+        if(!isdigit(static_cast<unsigned char>(text[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// an empty pattern matches everything, an index matches by position, anything else a part of the name
+static bool matches(const std::string& pattern, unsigned int index, const std::string& name)
+{
+    if(pattern.empty())
+    {
+        return true;
+    }
+    if(isIndex(pattern))
+    {
+        return static_cast<unsigned int>(atoi(pattern.c_str())) == index;
+    }
+    return lowerCase(name).find(lowerCase(pattern)) != std::string::npos;
+}
+
+static std::string platformString(cl_platform_id platform, cl_platform_info param)
+{
+    size_t size = 0;
+    clGetPlatformInfo(platform, param, 0, NULL, &size);
+    std::string value(size, '\0');
+    if(size > 0)
+    {
+        clGetPlatformInfo(platform, param, size, &value[0], NULL);
+    }
+    return value.c_str();
+}
+
+static std::string deviceString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, NULL, &size);
+    std::string value(size, '\0');
+    if(size > 0)
+    {
+        clGetDeviceInfo(device, param, size, &value[0], NULL);
+    }
+    return value.c_str();
+}
+
+static std::vector<cl_platform_id> platformIDs()
+{
+    cl_uint numPlatforms = 0;
+    clGetPlatformIDs(0, NULL, &numPlatforms);
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    if(numPlatforms > 0)
+    {
+        clGetPlatformIDs(numPlatforms, &platforms[0], NULL);
+    }
+    return platforms;
+}
+
+static std::vector<cl_device_id> deviceIDs(cl_platform_id platform, cl_device_type type)
+{
+    cl_uint numDevices = 0;
+    std::vector<cl_device_id> devices;
+    if(clGetDeviceIDs(platform, type, 0, NULL, &numDevices) == CL_SUCCESS && numDevices > 0)
+    {
+        devices.resize(numDevices);
+        clGetDeviceIDs(platform, type, numDevices, &devices[0], NULL);
+    }
+    return devices;
+}
+
+static bool canShareGL(cl_device_id device)
+{
+    std::string extensions = deviceString(device, CL_DEVICE_EXTENSIONS);
+    return extensions.find("cl_khr_gl_sharing") != std::string::npos || extensions.find("cl_APPLE_gl_sharing") != std::string::npos;
+}
+
+// asks the platform which of its devices can share the GL context, false if the platform can't tell
+static bool glContextDevices(cl_platform_id platform, const std::vector<cl_context_properties>& glProperties, std::vector<cl_device_id>& devices)
+{
+    clGetGLContextInfoKHR_fn getGLContextInfo = reinterpret_cast<clGetGLContextInfoKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clGetGLContextInfoKHR"));
+    if(getGLContextInfo == NULL)
+    {
+        return false;
+    }
+
+    std::vector<cl_context_properties> props;
+    props.push_back(CL_CONTEXT_PLATFORM);
+    props.push_back((cl_context_properties)platform);
+    props.insert(props.end(), glProperties.begin(), glProperties.end());
+
+    size_t size = 0;
+    devices.clear();
+    if(getGLContextInfo(&props[0], CL_DEVICES_FOR_GL_CONTEXT_KHR, 0, NULL, &size) == CL_SUCCESS && size > 0)
+    {
+        devices.resize(size / sizeof(cl_device_id));
+        if(getGLContextInfo(&props[0], CL_DEVICES_FOR_GL_CONTEXT_KHR, size, &devices[0], NULL) != CL_SUCCESS)
+        {
+            devices.clear();
+        }
+    }
+    return true;
+}
+
+static const char* deviceTypeName(cl_device_type type)
+{
+    if(type & CL_DEVICE_TYPE_GPU)
+    {
+        return "GPU";
+    }
+    if(type & CL_DEVICE_TYPE_CPU)
+    {
+        return "CPU";
+    }
+    if(type & CL_DEVICE_TYPE_ACCELERATOR)
+    {
+        return "accelerator";
+    }
+    return "other";
+}
+
+OpenCLDeviceSelector::OpenCLDeviceSelector()
+    : m_deviceType(CL_DEVICE_TYPE_ALL),
+      m_pickFastest(false)
+{
+}
+
+void OpenCLDeviceSelector::setPlatform(const std::string& platform)
+{
+    m_platform = platform;
+}
+
+void OpenCLDeviceSelector::setDevice(const std::string& device)
+{
+    m_device = device;
+}
+
+bool OpenCLDeviceSelector::setDeviceType(const std::string& type)
+{
+    std::string name = lowerCase(type);
+    if(name == "gpu")
+    {
+        m_deviceType = CL_DEVICE_TYPE_GPU;
+    }
+    else if(name == "cpu")
+    {
+        m_deviceType = CL_DEVICE_TYPE_CPU;
+    }
+    else if(name == "accelerator")
+    {
+        m_deviceType = CL_DEVICE_TYPE_ACCELERATOR;
+    }
+    else if(name == "all")
+    {
+        m_deviceType = CL_DEVICE_TYPE_ALL;
+    }
+    else
+    {
+        std::cerr << "Unknown OpenCL device type " << type << "\n";
+        return false;
+    }
+    return true;
+}
+
+void OpenCLDeviceSelector::setPickFastest(bool fastest)
+{
+    m_pickFastest = fastest;
+}
+
+bool OpenCLDeviceSelector::pickFastest() const
+{
+    return m_pickFastest;
+}
+
+void OpenCLDeviceSelector::setGLSharing(const cl_context_properties* glProperties)
+{
+    m_glProperties.clear();
+    if(glProperties == NULL)
+    {
+        return;
+    }
+    for(; *glProperties != 0; ++glProperties)
+    {
+        m_glProperties.push_back(*glProperties);
+    }
+    m_glProperties.push_back(0);
+}
+
+bool OpenCLDeviceSelector::parseArguments(int argc, char** argv)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--fastest")
+        {
+            m_pickFastest = true;
+            continue;
+        }
+        if(arg != "--platform" && arg != "--device" && arg != "--device-type")
+        {
+            continue;
+        }
+
+        if(i+1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+        if(arg == "--platform")
+        {
+            m_platform = value;
+        }
+        else if(arg == "--device")
+        {
+            m_device = value;
+        }
+        else if(!setDeviceType(value))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<cl_device_id> OpenCLDeviceSelector::matchingDevices() const
+{
+    std::vector<cl_platform_id> platforms = platformIDs();
+    std::vector<cl_device_id> result;
+    unsigned int deviceIndex = 0;
+    for(unsigned int p = 0; p < platforms.size(); ++p)
+    {
+        if(!matches(m_platform, p, platformString(platforms[p], CL_PLATFORM_NAME)))
+        {
+            continue;
+        }
+
+        // the GL filter comes last so that device indices stay those of listDevices
+        std::vector<cl_device_id> glDevices;
+        bool glDevicesKnown = !m_glProperties.empty() && glContextDevices(platforms[p], m_glProperties, glDevices);
+
+        std::vector<cl_device_id> devices = deviceIDs(platforms[p], m_deviceType);
+        for(unsigned int d = 0; d < devices.size(); ++d, ++deviceIndex)
+        {
+            if(!matches(m_device, deviceIndex, deviceName(devices[d])))
+            {
+                continue;
+            }
+            if(!m_glProperties.empty() && (!canShareGL(devices[d])
+                || (glDevicesKnown && std::find(glDevices.begin(), glDevices.end(), devices[d]) == glDevices.end())))
+            {
+                continue;
+            }
+            result.push_back(devices[d]);
+        }
+    }
+    return result;
+}
+
+cl_device_id OpenCLDeviceSelector::select(const std::string& programSource) const
+{
+    std::vector<cl_device_id> devices = matchingDevices();
+    if(devices.empty())
+    {
+        std::cerr << "No OpenCL device matches";
+        if(!m_platform.empty())
+        {
+            std::cerr << " platform '" << m_platform << "'";
+        }
+        if(!m_device.empty())
+        {
+            std::cerr << " device '" << m_device << "'";
+        }
+        if(!m_glProperties.empty())
+        {
+            std::cerr << " sharing the current GL context (cl_khr_gl_sharing)";
+        }
+        std::cerr << ", see --list-devices\n";
+        return 0;
+    }
+
+    if(m_pickFastest && devices.size() > 1)
+    {
+        cl_device_id fastest = 0;
+        double fastestCellsPerSecond = 0.0;
+        for(unsigned int i = 0; i < devices.size(); ++i)
+        {
+            double cellsPerSecond = calibrate(devices[i], programSource);
+            std::cout << "Calibration on " << deviceName(devices[i]) << ": " << cellsPerSecond * 1.0e-6 << " Mcells/s\n";
+            if(cellsPerSecond > fastestCellsPerSecond)
+            {
+                fastest = devices[i];
+                fastestCellsPerSecond = cellsPerSecond;
+            }
+        }
+
+        if(fastest == 0)
+        {
+            std::cerr << "Calibration failed on every OpenCL device\n";
+        }
+        return fastest;
+    }
+
+    if(m_device.empty())
+    {
+        for(unsigned int i = 0; i < devices.size(); ++i)
+        {
+            cl_device_type type = 0;
+            clGetDeviceInfo(devices[i], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+            if(type & CL_DEVICE_TYPE_GPU)
+            {
+                return devices[i];
+            }
+        }
+    }
+    return devices[0];
+}
+
+double OpenCLDeviceSelector::calibrate(cl_device_id device, const std::string& programSource)
+{
+    GPUWaves waves;
+    waves.init(CALIBRATION_SIZE, CALIBRATION_SIZE, 1.0f, 0.03f, 3.25f, 0.4f);
+
+    OpenCLWaveSolver solver;
+    if(!solver.init(device, waves, programSource))
+    {
+        return 0.0;
+    }
+
+    // the first step includes one-time driver work and is not timed
+    cl_event event = solver.enqueueDisturbGrid(CALIBRATION_SIZE / 2, CALIBRATION_SIZE / 2, 1.5f, 0);
+    event = solver.enqueueSteps(1, event);
+    if(event == 0)
+    {
+        return 0.0;
+    }
+    OpenCLWaveSolver::releaseEvent(event);
+    clFinish(solver.queue());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(unsigned int i = 0; i < CALIBRATION_STEPS; ++i)
+    {
+        event = solver.enqueueSteps(1, 0);
+        if(event == 0)
+        {
+            return 0.0;
+        }
+        OpenCLWaveSolver::releaseEvent(event);
+    }
+    clFinish(solver.queue());
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(CALIBRATION_SIZE) * CALIBRATION_SIZE * CALIBRATION_STEPS / seconds;
+}
+
+void OpenCLDeviceSelector::listDevices(std::ostream& out)
+{
+    std::vector<cl_platform_id> platforms = platformIDs();
+    if(platforms.empty())
+    {
+        out << "No OpenCL platform found\n";
+        return;
+    }
+
+    unsigned int deviceIndex = 0;
+    for(unsigned int p = 0; p < platforms.size(); ++p)
+    {
+        out << "Platform " << p << ": " << platformString(platforms[p], CL_PLATFORM_NAME)
+            << " (" << platformString(platforms[p], CL_PLATFORM_VENDOR) << ", "
+            << platformString(platforms[p], CL_PLATFORM_VERSION) << ")\n";
+
+        std::vector<cl_device_id> devices = deviceIDs(platforms[p], CL_DEVICE_TYPE_ALL);
+        for(unsigned int d = 0; d < devices.size(); ++d, ++deviceIndex)
+        {
+            cl_device_type type = 0;
+            cl_uint computeUnits = 0;
+            cl_ulong globalMemory = 0;
+            cl_ulong localMemory = 0;
+            cl_device_local_mem_type localMemoryType = CL_GLOBAL;
+            size_t maxWorkGroupSize = 0;
+            clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemory), &globalMemory, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemory), &localMemory, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_LOCAL_MEM_TYPE, sizeof(localMemoryType), &localMemoryType, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL);
+
+            out << "  Device " << deviceIndex << ": " << deviceName(devices[d]) << " (" << deviceTypeName(type) << ")\n"
+                << "    Driver          | " << deviceString(devices[d], CL_DRIVER_VERSION) << "\n"
+                << "    Compute units   | " << computeUnits << "\n"
+                << "    Global memory   | " << globalMemory / (1024 * 1024) << " MB\n"
+                << "    Local memory    | " << localMemory / 1024 << " KB"
+                << (localMemoryType == CL_LOCAL ? "" : " (emulated in global memory)") << "\n"
+                << "    Max work group  | " << maxWorkGroupSize << "\n"
+                << "    Extensions      | " << deviceString(devices[d], CL_DEVICE_EXTENSIONS) << "\n";
+        }
+    }
+}
+
+std::string OpenCLDeviceSelector::deviceName(cl_device_id device)
+{
+    return deviceString(device, CL_DEVICE_NAME);
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef OPENCL_DEVICE_SELECTOR_H
+#define OPENCL_DEVICE_SELECTOR_H
+
+// std
+#include <string>
+#include <vector>
+#include <ostream>
+
+// ocl
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+
+/**
+*   @brief Chooses the OpenCL device from command line options.
+*
+*   Platforms and devices are given by index or by a case insensitive part of their name.
+*   A device index counts the devices left by the platform and device type filters, so
+*   without filters it is the index printed by listDevices. Apps rendering with OpenGL
+*   restrict the candidates to devices sharing their GL context. The fastest device can also
+*   be picked by a short calibration run of the wave solver on every candidate.
+*/
+class OpenCLDeviceSelector
+{
+public:
+    OpenCLDeviceSelector();
+
+    void setPlatform(const std::string& platform);
+    void setDevice(const std::string& device);
+
+    // gpu, cpu, accelerator or all, returns false for anything else
+    bool setDeviceType(const std::string& type);
+    void setPickFastest(bool fastest);
+    bool pickFastest() const;
+
+    /**
+    *   @brief Keeps only devices that can share the GL context described by glProperties, 0 turns the filter off.
+    *
+    *   glProperties are the GL context properties without CL_CONTEXT_PLATFORM, terminated by 0.
+    *   Devices need cl_khr_gl_sharing and, where the platform has clGetGLContextInfoKHR,
+    *   must be reported by CL_DEVICES_FOR_GL_CONTEXT_KHR for the context.
+    */
+    void setGLSharing(const cl_context_properties* glProperties);
+
+    /**
+    *   @brief Reads --platform, --device, --device-type and --fastest, other arguments are skipped.
+    *   Returns false if a value is missing or invalid.
+    */
+    bool parseArguments(int argc, char** argv);
+
+    // devices passing the platform, device type, device and GL sharing filters in platform order
+    std::vector<cl_device_id> matchingDevices() const;
+
+    /**
+    *   @brief Returns the selected device or 0 if no device matches, the reason is printed to std::cerr.
+    *
+    *   The first matching GPU is preferred over the other matches unless a device was named.
+    *   With setPickFastest every match is calibrated with programSource and the fastest one wins.
+    */
+    cl_device_id select(const std::string& programSource) const;
+
+    // cells per second of a short solver run on the device, 0 on failure
+    static double calibrate(cl_device_id device, const std::string& programSource);
+
+    // prints every platform and device with its compute units, memory, work group limit and extensions
+    static void listDevices(std::ostream& out);
+
+    static std::string deviceName(cl_device_id device);
+
+private:
+    std::string m_platform;
+    std::string m_device;
+    cl_device_type m_deviceType;
+    bool m_pickFastest;
+    std::vector<cl_context_properties> m_glProperties;
+};
+
+#endif // OPENCL_DEVICE_SELECTOR_H
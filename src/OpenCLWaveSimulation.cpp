@@ -25,6 +25,7 @@
 #include "OpenCLWaveSimulation.h"
 #include "MathUtils.h"
 #include "CallbackHandler.h"
+#include "OpenCLDeviceSelector.h"
 
 // std
 #include <iostream>
@@ -38,17 +39,27 @@ OpenCLWaveSimulation::OpenCLWaveSimulation(int argc, char** argv, const std::str
       m_gridHeight(gridHeight),
       m_mouseBitMask(0),
       m_glslProgram(new GLSLProgram),
+      m_heightProgram(new GLSLProgram),
+      m_heightVBO(0),
+      m_heightTexture(0),
+      m_heightRendering(false),
       m_theta(1.5f * MathUtils::Pi),
       m_phi(0.1f),
       m_radius(600.0f),
       m_prevX(0),
       m_prevY(0),
-      m_pingpong(true),
 	  m_device(0),
-	  m_platform(0)
+	  m_platform(0),
+      m_substeps(1),
+      m_clCreateEventFromGLsync(0),
+      m_asyncPipeline(true),
+      m_frameSeconds(0.0),
+      m_frameCount(0)
 {
-    m_global[0] = gridWidth;
-    m_global[1] = gridHeight;
+    for(int i = 0; i < 3; ++i)
+    {
+        m_heightImageTextures[i] = 0;
+    }
 }
 
 OpenCLWaveSimulation::~OpenCLWaveSimulation()
@@ -82,42 +93,15 @@ bool OpenCLWaveSimulation::init()
     initOCL();
     m_waveTrigger.start();
     m_fpsChronometer.start();
+    m_frameReportStart = std::chrono::steady_clock::now();
 
     return true;
 }
 
 void OpenCLWaveSimulation::initScene()
 {
-    if(!m_glslProgram->compileShaderFromFile("render_waves.vert", GLSLShader::VERTEX))
-    {
-        std::cerr << "Vertex shader failed to compile\n";
-        std::cerr << "Build Log: " << m_glslProgram->log() << std::endl;
-        exit(1);
-    }
-
-    if(!m_glslProgram->compileShaderFromFile("render_waves.frag", GLSLShader::FRAGMENT))
-    {
-        std::cerr << "Fragment shader failed to compile\n";
-        std::cerr << "Build Log: " << m_glslProgram->log() << std::endl;
-        exit(1);
-    }
-
-    // bindAttribLocation or bindFragDataLocation here
-    m_glslProgram->bindAttribLocation(0, "vPos");
-    m_glslProgram->bindAttribLocation(1, "vNormal");
-    m_glslProgram->bindAttribLocation(2, "vTangent");
-    m_glslProgram->bindFragDataLocation(0, "FragColor");
-
-    if(!m_glslProgram->link())
-    {
-        std::cerr << "Shader program failed to link\n";
-        std::cerr << "Link Log: " << m_glslProgram->log() << std::endl;
-    }
-
-    m_glslProgram->use();
-    m_glslProgram->printActiveAttribs();
-    m_glslProgram->printActiveUniforms();
-    std::cout << std::endl;
+    buildProgram(m_heightProgram, "render_waves_heights.vert");
+    buildProgram(m_glslProgram, "render_waves.vert");
 
     // init uniforms
     m_modelM = glm::mat4(1.0f);
@@ -135,15 +119,63 @@ void OpenCLWaveSimulation::initScene()
     m_lightDiffuse  = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
     m_lightSpecular = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
 
-    m_glslProgram->setUniform("materialAmbient", m_materialAmbient);
-    m_glslProgram->setUniform("materialDiffuse", m_materialDiffuse);
-    m_glslProgram->setUniform("materialSpecular", m_materialSpecular);
-    m_glslProgram->setUniform("lightDir", m_lightDir);
-    m_glslProgram->setUniform("lightAmbient", m_lightAmbient);
-    m_glslProgram->setUniform("lightDiffuse", m_lightDiffuse);
-    m_glslProgram->setUniform("lightSpecular", m_lightSpecular);
-
     buildWaveGrid();
+
+    setSceneUniforms(m_heightProgram);
+    setSceneUniforms(m_glslProgram);
+}
+
+void OpenCLWaveSimulation::buildProgram(GLSLProgram* program, const char* vertexShader)
+{
+    if(!program->compileShaderFromFile(vertexShader, GLSLShader::VERTEX))
+    {
+        std::cerr << "Vertex shader " << vertexShader << " failed to compile\n";
+        std::cerr << "Build Log: " << program->log() << std::endl;
+        exit(1);
+    }
+
+    if(!program->compileShaderFromFile("render_waves.frag", GLSLShader::FRAGMENT))
+    {
+        std::cerr << "Fragment shader failed to compile\n";
+        std::cerr << "Build Log: " << program->log() << std::endl;
+        exit(1);
+    }
+
+    // bindAttribLocation or bindFragDataLocation here
+    program->bindAttribLocation(0, "vPos");
+    program->bindAttribLocation(1, "vNormal");
+    program->bindAttribLocation(2, "vTangent");
+    program->bindFragDataLocation(0, "FragColor");
+
+    if(!program->link())
+    {
+        std::cerr << "Shader program failed to link\n";
+        std::cerr << "Link Log: " << program->log() << std::endl;
+    }
+
+    program->use();
+    program->printActiveAttribs();
+    program->printActiveUniforms();
+    std::cout << std::endl;
+}
+
+void OpenCLWaveSimulation::setSceneUniforms(GLSLProgram* program)
+{
+    // uniforms are set on the program in use
+    program->use();
+    program->setUniform("materialAmbient", m_materialAmbient);
+    program->setUniform("materialDiffuse", m_materialDiffuse);
+    program->setUniform("materialSpecular", m_materialSpecular);
+    program->setUniform("lightDir", m_lightDir);
+    program->setUniform("lightAmbient", m_lightAmbient);
+    program->setUniform("lightDiffuse", m_lightDiffuse);
+    program->setUniform("lightSpecular", m_lightSpecular);
+
+    program->setUniform("heights", 0);
+    program->setUniform("heightImage", 1);
+    program->setUniform("gridWidth", static_cast<int>(m_waves.columnCount()));
+    program->setUniform("gridHeight", static_cast<int>(m_waves.rowCount()));
+    program->setUniform("spatialStep", *m_waves.spatialStep());
 }
 
 void OpenCLWaveSimulation::buildWaveGrid()
@@ -157,12 +189,11 @@ void OpenCLWaveSimulation::buildWaveGrid()
               << "Triangles | " << m_waves.triangleCount() << "\n"
               << "Grid Size | " << m_gridWidth << "x" << m_gridHeight << "\n\n";
 
-    GLuint vboHandles[4];
-    glGenBuffers(4, vboHandles);
+    GLuint vboHandles[3];
+    glGenBuffers(3, vboHandles);
     m_positionVBO = vboHandles[0];
     m_normalVBO = vboHandles[1];
     m_tangentVBO = vboHandles[2];
-    m_ibo = vboHandles[3];
 
     // create vertex buffers
     glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
@@ -174,8 +205,8 @@ void OpenCLWaveSimulation::buildWaveGrid()
     glBindBuffer(GL_ARRAY_BUFFER, m_tangentVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(float) * VERTEX_SIZE * m_gridWidth*m_gridHeight, 0, GL_STREAM_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 3 * m_waves.triangleCount(), m_waves.getIndices(), GL_STATIC_DRAW);
+    m_gridMesh.build(m_waves.rowCount(), m_waves.columnCount(), GridMesh::TILED_STRIPS);
+    std::cout << "Grid mesh: " << m_gridMesh.statistics() << " (press 'm' to change)\n";
 
     glGenVertexArrays(1, &m_vaoWaves);
 
@@ -189,37 +220,43 @@ void OpenCLWaveSimulation::buildWaveGrid()
     glVertexAttribPointer(1, VERTEX_SIZE, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
     glBindBuffer(GL_ARRAY_BUFFER, m_tangentVBO);
     glVertexAttribPointer(2, VERTEX_SIZE, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridMesh.indexBuffer());
+    glBindVertexArray(0);
+
+    // the height render mode has no vertex attributes, its vertex array only holds the indices
+    glGenBuffers(1, &m_heightVBO);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_heightVBO);
+    glBufferData(GL_TEXTURE_BUFFER, (m_solver.halfHeights() ? 2 : 4) * m_gridWidth*m_gridHeight, 0, GL_STREAM_DRAW);
+    glGenTextures(1, &m_heightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_heightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, m_solver.halfHeights() ? GL_R16F : GL_R32F, m_heightVBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // the rotating height images of the image storage, shared with the solver if the device has such images
+    glGenTextures(3, m_heightImageTextures);
+    for(int i = 0; i < 3; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_heightImageTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, m_solver.halfHeights() ? GL_R16F : GL_R32F, m_gridWidth, m_gridHeight, 0,
+                     GL_RED, m_solver.halfHeights() ? GL_HALF_FLOAT : GL_FLOAT, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenVertexArrays(1, &m_vaoHeights);
+    glBindVertexArray(m_vaoHeights);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridMesh.indexBuffer());
     glBindVertexArray(0);
 }
 
 void OpenCLWaveSimulation::initOCL()
 {
-    const unsigned int vboSize = m_gridWidth * m_gridHeight * VERTEX_SIZE * sizeof(float);
-
-	// first get number of available platt forms
-	cl_uint numPlattforms = 0;
-	clGetPlatformIDs(0, NULL, &numPlattforms);
-
-	// then allocate enough memory for all IDs
-	cl_platform_id* plattforms = new cl_platform_id[numPlattforms];
-    clGetPlatformIDs(numPlattforms, plattforms, NULL);
-
-	cl_device_type deviceType = (m_argc <= 1) ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
-
-	// now try to find the right plattform for given device type
-	for (unsigned int i = 0; i < numPlattforms; ++i) 
-	{
-		clGetDeviceIDs(plattforms[i], deviceType, 1, &m_device, NULL);
-
-		if (m_device)
-		{
-			m_platform = plattforms[i];
-			break;
-		}
-	}
-	delete plattforms;
-   
+    // load source file, the calibration of --fastest runs it on every candidate device
+    std::ifstream file("WaveSimulation.cl");
+    std::string prog(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+    file.close();
 
     // ocl context must be tied to the ogl context
 #   ifdef _WIN32
@@ -228,159 +265,97 @@ void OpenCLWaveSimulation::initOCL()
         GLXContext glCtx = glXGetCurrentContext();
 #   endif
 
-    cl_context_properties props[] = {CL_CONTEXT_PLATFORM,
-        (cl_context_properties)m_platform,
+    cl_context_properties glProps[] = {
 #   ifdef _WIN32
         CL_WGL_HDC_KHR, (intptr_t) wglGetCurrentDC(),
 #   else
-        CL_GLX_DISPLAY_KHR, (intptr_t) glXGetCurrentDisplay();
+        CL_GLX_DISPLAY_KHR, (intptr_t) glXGetCurrentDisplay(),
 #   endif
     CL_GL_CONTEXT_KHR, (intptr_t) glCtx, 0
     };
 
-    // create context and queue
-    m_context = clCreateContext(props, 1, &m_device, NULL, NULL, NULL);
-    m_queue = clCreateCommandQueue(m_context, m_device, 0, NULL);
-
-    // create buffers
-    int errCode;
-    m_clPositionInteropBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, m_positionVBO, &errCode);
-    if(errCode != CL_SUCCESS)
-    {
-        std::cerr << "Failed creating cl_mem position buffer from gl buffer\n";
-    }
-
-    m_clNormalInteropBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, m_normalVBO, &errCode);
-    if(errCode != CL_SUCCESS)
-    {
-        std::cerr << "Failed creating cl_mem normal buffer from gl buffer\n";
-    }
-
-    m_clTangentInteropBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, m_tangentVBO, &errCode);
-    if(errCode != CL_SUCCESS)
-    {
-        std::cerr << "Failed creating cl_mem tangent buffer from gl buffer\n";
-    }
-
-    m_clPing = clCreateBuffer(m_context,
-                              CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                              vboSize,
-                              reinterpret_cast<float*>(m_waves.getVertices()),
-                              &errCode);
-    if(errCode != CL_SUCCESS)
+    // --platform, --device, --device-type and --fastest pick among the devices sharing the GL context, a GPU is preferred otherwise
+    OpenCLDeviceSelector selector;
+    if(!selector.parseArguments(m_argc, m_argv))
     {
-        std::cerr << "Failed creating cl_mem read write buffer\n";
+        exit(1);
     }
+    selector.setGLSharing(glProps);
 
-    m_clPong = clCreateBuffer(m_context,
-                              CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                              vboSize,
-                              reinterpret_cast<float*>(m_waves.getVertices()),
-                              &errCode);
-    if(errCode != CL_SUCCESS)
+    m_device = selector.select(prog);
+    if(m_device == 0)
     {
-        std::cerr << "Failed creating cl_mem read write buffer\n";
+        exit(1);
     }
+    clGetDeviceInfo(m_device, CL_DEVICE_PLATFORM, sizeof(m_platform), &m_platform, NULL);
+    std::cout << "OpenCL device: " << OpenCLDeviceSelector::deviceName(m_device) << "\n";
 
-    // load source file
-    std::ifstream file("WaveSimulation.cl");
-    std::string prog(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
-    file.close();
-
-    const char* source = prog.c_str();
-    const size_t kernelsize = prog.length() + 1;
-    m_program = clCreateProgramWithSource(m_context, 1, (const char**)&source, &kernelsize, NULL);
+    cl_context_properties props[] = {CL_CONTEXT_PLATFORM,
+        (cl_context_properties)m_platform,
+        glProps[0], glProps[1], glProps[2], glProps[3], 0
+    };
 
-    // build program
-    int err = clBuildProgram(m_program, 0, NULL, NULL, NULL, NULL);
-    if(err != CL_SUCCESS)
+    // the solver creates its context with the GL sharing properties and writes the vbos
+    if(!m_solver.init(m_device, m_waves, prog, props))
     {
-        size_t len;
-        char buffer[2048];
-        std::cerr << "Error: Failed to build program executable!" << std::endl;
-        clGetProgramBuildInfo(m_program, m_device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-        std::cerr << buffer << std::endl;
         exit(1);
     }
 
-    // create the compute kernels in the program
-    m_vertexDisplacementKernel = clCreateKernel(m_program, "compute_vertex_displacement", &err);
-    if(!m_vertexDisplacementKernel || err != CL_SUCCESS)
+    if(!m_solver.attachGLBuffers(m_positionVBO, m_normalVBO, m_tangentVBO) || !m_solver.attachGLHeightBuffer(m_heightVBO))
     {
-        std::cerr << "Error: Failed to create compute kernel: compute_vertex_displacement!" << std::endl;
         exit(1);
     }
 
-    m_finiteDifferenceSchemeKernel = clCreateKernel(m_program, "compute_finite_difference_scheme", &err);
-    if(!m_finiteDifferenceSchemeKernel || err != CL_SUCCESS)
+    // without the textures the height render mode reads the copied heights also with the image storage
+    if(m_solver.imageStorageSupported() && !m_solver.attachGLHeightTextures(m_heightImageTextures))
     {
-        std::cerr << "Error: Failed to create compute kernel: compute_finite_difference_scheme!" << std::endl;
-        exit(1);
+        std::cerr << "The height render mode copies the heights out of the images\n";
     }
 
-    m_disturbKernel = clCreateKernel(m_program, "disturb_grid", &err);
-    if(!m_disturbKernel || err != CL_SUCCESS)
+    // cl_khr_gl_event lets the queue wait for GL fences instead of a glFinish on the host
+    size_t extensionsSize = 0;
+    clGetDeviceInfo(m_device, CL_DEVICE_EXTENSIONS, 0, NULL, &extensionsSize);
+    std::string extensions(extensionsSize, '\0');
+    clGetDeviceInfo(m_device, CL_DEVICE_EXTENSIONS, extensionsSize, &extensions[0], NULL);
+    if(extensions.find("cl_khr_gl_event") != std::string::npos)
     {
-        std::cerr << "Error: Failed to create compute kernel: disturb_grid!" << std::endl;
-        exit(1);
+        m_clCreateEventFromGLsync = reinterpret_cast<CreateEventFromGLsyncFunc>(
+            clGetExtensionFunctionAddressForPlatform(m_platform, "clCreateEventFromGLsyncKHR"));
     }
+    std::cout << "GL/CL synchronization uses " << (m_clCreateEventFromGLsync ? "sync objects (cl_khr_gl_event)" : "glFinish/clWaitForEvents")
+              << ", async pipeline " << (m_asyncPipeline ? "on" : "off") << " (press 'p' to toggle)\n";
 
-    m_glGridInitKernel = clCreateKernel(m_program, "initialize_gl_grid", &err);
-    if(!m_glGridInitKernel || err != CL_SUCCESS)
+    std::cout << "Substeps are advanced " << m_solver.stepsPerLaunch() << " per launch (press '[' and ']' to change), "
+              << m_substeps << " substeps per frame (press '+' and '-' to change)\n";
+    std::cout << "Vertex displacement uses " << (m_solver.localTiling() ? "local memory tiles" : "global memory loads")
+              << " (press 'l' to toggle)\n"
+              << "Normals are computed " << (m_solver.fusedKernel() ? "in the fused kernel" : "in a separate kernel")
+              << " (press 'f' to toggle)\n";
+    if(m_solver.imageStorageSupported())
     {
-        std::cerr << "Error: Failed to create compute kernel: initialize_gl_grid!" << std::endl;
-        exit(1);
+        std::cout << "Heights are stored in buffers (press 'i' to toggle images)\n";
     }
+    std::cout << "The vertex buffers are written by the solver (press 'n' to render from the heights only)\n";
+
     initGLBuffer();
 }
 
 void OpenCLWaveSimulation::initGLBuffer()
 {
-    clFinish(m_queue);
+    clFinish(m_solver.queue());
     glFinish();
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clPositionInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to acquire gl position buffer\n";
-    }
-
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clNormalInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to acquire gl normal buffer\n";
-    }
 
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clTangentInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to acquire gl tangent buffer\n";
-    }
-
-    clSetKernelArg(m_glGridInitKernel, 0, sizeof(cl_mem), (void*)&m_clPositionInteropBuffer);
-    clSetKernelArg(m_glGridInitKernel, 1, sizeof(cl_mem), (void*)&m_clNormalInteropBuffer);
-    clSetKernelArg(m_glGridInitKernel, 2, sizeof(cl_mem), (void*)&m_clTangentInteropBuffer);
-    clSetKernelArg(m_glGridInitKernel, 3, sizeof(cl_mem), (void*)&m_clPing);
-    clSetKernelArg(m_glGridInitKernel, 4, sizeof(int), &m_gridWidth);
-
-    
-    if(clEnqueueNDRangeKernel(m_queue, m_glGridInitKernel, 2, NULL, m_global, NULL, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "OpenGL Grid Init Kernel Execution failed\n";
-    }
-
-
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clPositionInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to release gl position buffers\n";
-    }
-
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clNormalInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to release gl normal buffers\n";
-    }
-
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clTangentInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to release gl tangent buffers\n";
-    }
-    clFinish(m_queue);
+    cl_event event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueInitializeOutputs(event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+
+    // the height output is written while it is acquired
+    m_solver.setHeightOutput(true);
+    event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueHeightOutput(event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+    m_solver.setHeightOutput(m_heightRendering);
+    clFinish(m_solver.queue());
 }
 
 void OpenCLWaveSimulation::onResize(int w, int h)
@@ -397,15 +372,54 @@ void OpenCLWaveSimulation::render()
 {
     checkGLError(__FILE__,__LINE__);
 
+    std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
     measurePerformance();
     updateScene(m_fpsChronometer.getPassedTimeSinceStart());
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glBindVertexArray(m_vaoWaves);
-    glDrawElements(GL_TRIANGLES, 3 * m_waves.triangleCount(), GL_UNSIGNED_INT, ((GLubyte*)NULL + (0)));
+    if(m_heightRendering)
+    {
+        // the solver leaves the texture buffer unwritten while its images are the GL textures
+        bool heightImage = m_solver.heightTexturesCurrent();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, m_heightTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, heightImage ? m_heightImageTextures[m_solver.currentHeightTexture()] : 0);
+        glActiveTexture(GL_TEXTURE0);
+        m_heightProgram->setUniform("useHeightImage", heightImage);
+        glBindVertexArray(m_vaoHeights);
+    }
+    else
+    {
+        glBindVertexArray(m_vaoWaves);
+    }
+    m_gridMesh.draw();
 
     glutSwapBuffers();    
+
+    reportFrameTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
+}
+
+void OpenCLWaveSimulation::reportFrameTime(double seconds)
+{
+    // wall clock time, the fps of the window title are based on processor time
+    // and hide the time the host spends blocked on the device
+    m_frameSeconds += seconds;
+    ++m_frameCount;
+
+    double sinceReport = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_frameReportStart).count();
+    if(sinceReport >= 1.0)
+    {
+        std::cout << (m_asyncPipeline ? "async" : "legacy") << " pipeline | "
+                  << 1000.0 * m_frameSeconds / m_frameCount << " ms/frame | "
+                  << m_gridMesh.drawMilliseconds() << " ms/draw (" << GridMesh::layoutName(m_gridMesh.layout()) << ")\n";
+
+        m_frameSeconds = 0.0;
+        m_frameCount = 0;
+        m_frameReportStart = std::chrono::steady_clock::now();
+    }
 }
 
 void OpenCLWaveSimulation::updateScene(double dt)
@@ -421,15 +435,17 @@ void OpenCLWaveSimulation::updateScene(double dt)
     glm::vec3 up(0.0f, 1.0f, 0.0f);
     m_viewM = glm::lookAt(pos, target, up);
 
-    m_glslProgram->setUniform("eyePosW", pos);
+    GLSLProgram* program = m_heightRendering ? m_heightProgram : m_glslProgram;
+    program->use();
+    program->setUniform("eyePosW", pos);
 
     glm::mat4 mv = m_viewM * m_modelM;
-    m_glslProgram->setUniform("MVP", m_projM * mv);
+    program->setUniform("MVP", m_projM * mv);
     m_worldInvTransposeM = glm::transpose(glm::inverse(glm::mat3(m_modelM)));
-    m_glslProgram->setUniform("WorldMatrix", m_modelM);
-    m_glslProgram->setUniform("WorldInvTranspose", m_worldInvTransposeM);
-    glFinish();
+    program->setUniform("WorldMatrix", m_modelM);
+    program->setUniform("WorldInvTranspose", m_worldInvTransposeM);
 
+    // the drops are added by the kernels of the next step
     if(m_waveTrigger.getPassedTimeSinceStart() >= 0.05) // 50ms
     {
         disturbGrid();
@@ -437,121 +453,118 @@ void OpenCLWaveSimulation::updateScene(double dt)
         m_waveTrigger.start();
     }
 
-    computeVertexDisplacement();
-    computeFiniteDifferenceScheme();
-}
-
-void OpenCLWaveSimulation::computeVertexDisplacement()
-{
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clPositionInteropBuffer, 0, 0, 0) != CL_SUCCESS)
+    if(m_asyncPipeline)
     {
-        std::cerr << "Failed to acquire gl position buffer\n";
+        simulateFrame();
+        return;
     }
 
-    if(m_pingpong)
-    {
-        clSetKernelArg(m_vertexDisplacementKernel, 0, sizeof(cl_mem), (void*)&m_clPing);
-        clSetKernelArg(m_vertexDisplacementKernel, 1, sizeof(cl_mem), (void*)&m_clPong);
-    }
-    else
+    // legacy pipeline, every kernel acquires its buffers and waits for completion
+    glFinish();
+    advanceSubsteps();
+
+    if(m_heightRendering)
     {
-        clSetKernelArg(m_vertexDisplacementKernel, 0, sizeof(cl_mem), (void*)&m_clPong);
-        clSetKernelArg(m_vertexDisplacementKernel, 1, sizeof(cl_mem), (void*)&m_clPing);
+        computeHeightOutput();
     }
-
-    clSetKernelArg(m_vertexDisplacementKernel, 2, sizeof(cl_mem), (void*)&m_clPositionInteropBuffer);
-    clSetKernelArg(m_vertexDisplacementKernel, 3, sizeof(int), &m_gridWidth);
-    clSetKernelArg(m_vertexDisplacementKernel, 4, sizeof(float), m_waves.k1());
-    clSetKernelArg(m_vertexDisplacementKernel, 5, sizeof(float), m_waves.k2());
-    clSetKernelArg(m_vertexDisplacementKernel, 6, sizeof(float), m_waves.k3());
-
-    size_t local[] = {32, 32};
-    if(clEnqueueNDRangeKernel(m_queue, m_vertexDisplacementKernel, 2, NULL, m_global, local, 0, 0, 0) != CL_SUCCESS)
+    else if(m_solver.fusedKernel())
     {
-        std::cerr << "Vertex Displacement Kernel Execution failed\n";
+        computeFusedStep();
     }
-
-
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clPositionInteropBuffer, 0, 0, 0) != CL_SUCCESS)
+    else
     {
-        std::cerr << "Failed to release gl position buffers\n";
+        computeVertexDisplacement();
+        computeFiniteDifferenceScheme();
     }
-    clFinish(m_queue);
-
-    // swap buffers
-    m_pingpong = !m_pingpong;
 }
 
-void OpenCLWaveSimulation::computeFiniteDifferenceScheme()
+void OpenCLWaveSimulation::simulateFrame()
 {
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clNormalInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to acquire gl normal buffer\n";
-    }
-
-    if(clEnqueueAcquireGLObjects(m_queue, 1, &m_clTangentInteropBuffer, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Failed to acquire gl tangent buffer\n";
-    }
-
-    if(m_pingpong)
+    // GL has to be done with the vbos before CL may write them. With cl_khr_gl_event
+    // the acquire waits for a fence on the device, otherwise only glFinish guarantees this.
+    cl_event event = 0;
+    GLsync glFence = 0;
+    if(m_clCreateEventFromGLsync != 0)
     {
-        clSetKernelArg(m_finiteDifferenceSchemeKernel, 0, sizeof(cl_mem), (void*)&m_clPong);
+        glFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        event = m_clCreateEventFromGLsync(m_solver.context(), reinterpret_cast<cl_GLsync>(glFence), NULL);
     }
     else
     {
-        clSetKernelArg(m_finiteDifferenceSchemeKernel, 0, sizeof(cl_mem), (void*)&m_clPing);
+        glFinish();
     }
 
-    clSetKernelArg(m_finiteDifferenceSchemeKernel, 1, sizeof(cl_mem), (void*)&m_clNormalInteropBuffer);
-    clSetKernelArg(m_finiteDifferenceSchemeKernel, 2, sizeof(cl_mem), (void*)&m_clTangentInteropBuffer);
-    clSetKernelArg(m_finiteDifferenceSchemeKernel, 3, sizeof(int), &m_gridWidth);
-    clSetKernelArg(m_finiteDifferenceSchemeKernel, 4, sizeof(float), m_waves.spatialStep());
+    // every command consumes the event of its predecessor
+    event = m_solver.enqueueAcquireOutputs(event);
+    event = m_solver.enqueueSteps(m_substeps, event);
+    cl_event released = m_solver.enqueueReleaseOutputs(event);
 
-    if(clEnqueueNDRangeKernel(m_queue, m_finiteDifferenceSchemeKernel, 2, NULL, m_global, NULL, 0, 0, 0) != CL_SUCCESS)
+    // The only sync point of the frame. cl_khr_gl_event makes the release implicitly
+    // synchronize with the GL commands issued afterwards by this thread, so submitting
+    // the work is enough. Otherwise the host has to wait before GL may draw.
+    if(m_clCreateEventFromGLsync != 0)
     {
-        std::cerr << "Finite Difference Scheme Kernel Execution failed\n";
+        clFlush(m_solver.queue());
     }
-
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clNormalInteropBuffer, 0, 0, 0) != CL_SUCCESS)
+    else if(released != 0)
     {
-        std::cerr << "Failed to release gl normal buffers\n";
+        clWaitForEvents(1, &released);
     }
+    OpenCLWaveSolver::releaseEvent(released);
 
-    if(clEnqueueReleaseGLObjects(m_queue, 1, &m_clTangentInteropBuffer, 0, 0, 0) != CL_SUCCESS)
+    if(glFence != 0)
     {
-        std::cerr << "Failed to release gl tangent buffers\n";
+        glDeleteSync(glFence);
     }
-    clFinish(m_queue);
+}
+
+void OpenCLWaveSimulation::advanceSubsteps()
+{
+    // the last substep runs the kernels that write the vbos
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueHeightSteps(m_substeps-1, 0));
+    clFinish(m_solver.queue());
+}
+
+void OpenCLWaveSimulation::computeVertexDisplacement()
+{
+    cl_event event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueVertexDisplacement(event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+    clFinish(m_solver.queue());
+}
+
+void OpenCLWaveSimulation::computeFiniteDifferenceScheme()
+{
+    cl_event event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueFiniteDifferenceScheme(event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+    clFinish(m_solver.queue());
+}
+
+void OpenCLWaveSimulation::computeFusedStep()
+{
+    cl_event event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueFusedStep(event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+    clFinish(m_solver.queue());
+}
+
+void OpenCLWaveSimulation::computeHeightOutput()
+{
+    // a height-only step followed by the copy into the height output
+    cl_event event = m_solver.enqueueAcquireOutputs(0);
+    event = m_solver.enqueueSteps(1, event);
+    OpenCLWaveSolver::releaseEvent(m_solver.enqueueReleaseOutputs(event));
+    clFinish(m_solver.queue());
 }
 
 void OpenCLWaveSimulation::disturbGrid()
-{  
+{
     int i = 5 + rand() % (m_waves.rowCount()-10);
     int j = 5 + rand() % (m_waves.columnCount()-10);
     float r = MathUtils::randF(1.0f, 2.0f);
 
-    if(m_pingpong)
-    {
-        // computeVertex displacement swapped the buffers before
-        clSetKernelArg(m_disturbKernel, 0, sizeof(cl_mem), (void*)&m_clPong);
-    }
-    else
-    {
-        clSetKernelArg(m_disturbKernel, 0, sizeof(cl_mem), (void*)&m_clPing);
-    }
-    
-    clSetKernelArg(m_disturbKernel, 1, sizeof(unsigned int), &i);
-    clSetKernelArg(m_disturbKernel, 2, sizeof(unsigned int), &j);
-    clSetKernelArg(m_disturbKernel, 3, sizeof(int), &m_gridWidth);
-    clSetKernelArg(m_disturbKernel, 4, sizeof(float), &r);
-
-    size_t global[] = {1, 1};
-    if(clEnqueueNDRangeKernel(m_queue, m_disturbKernel, 2, NULL, global, NULL, 0, 0, 0) != CL_SUCCESS)
-    {
-        std::cerr << "Disturb Grid Kernel Execution failed\n";
-    }
-    clFinish(m_queue);
+    m_solver.disturbances().push(i, j, r);
 }
 
 void OpenCLWaveSimulation::onMouseEvent(int button, int state, int x, int y)
@@ -589,6 +602,80 @@ void OpenCLWaveSimulation::onKeyboardEvent(unsigned char key, int x, int y)
         }
         state = !state;
     }
+    else if(key == 'l')
+    {
+        if(m_solver.setLocalTiling(!m_solver.localTiling()))
+        {
+            std::cout << "Vertex displacement uses " << (m_solver.localTiling() ? "local memory tiles" : "global memory loads") << "\n";
+        }
+    }
+    else if(key == '+' || key == '-')
+    {
+        if(key == '+' && m_substeps < 64)
+        {
+            ++m_substeps;
+        }
+        else if(key == '-' && m_substeps > 1)
+        {
+            --m_substeps;
+        }
+        std::cout << m_substeps << " substeps per frame\n";
+    }
+    else if(key == '[' || key == ']')
+    {
+        unsigned int steps = m_solver.stepsPerLaunch();
+        if(key == ']' && steps < 8)
+        {
+            ++steps;
+        }
+        else if(key == '[' && steps > 1)
+        {
+            --steps;
+        }
+        m_solver.setStepsPerLaunch(steps);
+        std::cout << steps << " steps per launch\n";
+    }
+    else if(key == 'p')
+    {
+        m_asyncPipeline = !m_asyncPipeline;
+        m_frameSeconds = 0.0;
+        m_frameCount = 0;
+        m_frameReportStart = std::chrono::steady_clock::now();
+    }
+    else if(key == 'r')
+    {
+        // rain drops are generated by the kernels of every step
+        DisturbanceQueue& disturbances = m_solver.disturbances();
+        disturbances.setRain(disturbances.rainPerStep() == 0 ? 2 : 0, 0.25f, 0.75f);
+        std::cout << "Rain " << (disturbances.rainPerStep() ? "on" : "off") << "\n";
+    }
+    else if(key == 'f')
+    {
+        if(m_solver.setFusedKernel(!m_solver.fusedKernel()))
+        {
+            std::cout << "Normals are computed " << (m_solver.fusedKernel() ? "in the fused kernel" : "in a separate kernel") << "\n";
+        }
+    }
+    else if(key == 'i')
+    {
+        if(m_solver.setImageStorage(!m_solver.imageStorage()))
+        {
+            std::cout << "Heights are stored in " << (m_solver.imageStorage() ? "images" : "buffers") << "\n";
+        }
+    }
+    else if(key == 'n')
+    {
+        m_heightRendering = !m_heightRendering;
+        m_solver.setHeightOutput(m_heightRendering);
+        std::cout << (m_heightRendering ? "Positions and normals are computed in the vertex shader from the heights"
+                                        : "The vertex buffers are written by the solver") << "\n";
+    }
+    else if(key == 'm')
+    {
+        GridMesh::Layout layout = static_cast<GridMesh::Layout>((m_gridMesh.layout() + 1) % GridMesh::LAYOUT_COUNT);
+        m_gridMesh.build(m_waves.rowCount(), m_waves.columnCount(), layout);
+        std::cout << "Grid mesh: " << m_gridMesh.statistics() << "\n";
+    }
 }
 
 void OpenCLWaveSimulation::onMotionEvent(int x, int y)
@@ -618,65 +705,7 @@ void OpenCLWaveSimulation::onMotionEvent(int x, int y)
 
 void OpenCLWaveSimulation::cleanup()
 {
-    if(m_queue != 0)
-    {
-        clReleaseCommandQueue(m_queue);
-    }
-
-    if(m_vertexDisplacementKernel != 0)
-    {
-        clReleaseKernel(m_vertexDisplacementKernel);
-    }
-
-    if(m_finiteDifferenceSchemeKernel != 0)
-    {
-        clReleaseKernel(m_finiteDifferenceSchemeKernel);
-    }
-
-    if(m_disturbKernel != 0)
-    {
-        clReleaseKernel(m_disturbKernel);
-    }
-
-    if(m_glGridInitKernel != 0)
-    {
-        clReleaseKernel(m_glGridInitKernel);
-    }
-
-    if(m_program != 0)
-    {
-        clReleaseProgram(m_program);
-    }
-
-    if(m_context != 0)
-    {
-        clReleaseContext(m_context);
-    }
-
-    if(m_clPing)
-    {
-        clReleaseMemObject(m_clPing);
-    }
-
-    if(m_clPong)
-    {
-        clReleaseMemObject(m_clPong);
-    }
-
-    if(m_clPositionInteropBuffer)
-    {
-        clReleaseMemObject(m_clPositionInteropBuffer);
-    }
-
-    if(m_clNormalInteropBuffer)
-    {
-        clReleaseMemObject(m_clNormalInteropBuffer);
-    }
-
-    if(m_clTangentInteropBuffer)
-    {
-        clReleaseMemObject(m_clTangentInteropBuffer);
-    }
+    m_solver.release();
 
     // after releasing the ocl references, one can delete the corresponding ogl objects
     if(m_positionVBO != 0)
@@ -697,11 +726,19 @@ void OpenCLWaveSimulation::cleanup()
         glDeleteBuffers(1, &m_tangentVBO);
     }
 
-    if(m_ibo)
+    if(m_heightVBO)
     {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-        glDeleteBuffers(1, &m_ibo);
+        glDeleteTextures(1, &m_heightTexture);
+        glDeleteBuffers(1, &m_heightVBO);
     }
 
+    if(m_heightImageTextures[0] != 0)
+    {
+        glDeleteTextures(3, m_heightImageTextures);
+    }
+
+    m_gridMesh.release();
+
     delete m_glslProgram;
+    delete m_heightProgram;
 }
\ No newline at end of file
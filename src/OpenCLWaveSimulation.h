@@ -29,9 +29,12 @@
 #include "GLSLProgram.h"
 #include "Chronometer.hpp"
 #include "GpuWaves.h"
+#include "OpenCLWaveSolver.h"
+#include "GridMesh.h"
 
 // std
 #include <string>
+#include <chrono>
 
 // ocl
 #include <CL/cl.h>
@@ -60,36 +63,46 @@ public:
 protected:
     void initScene();
     void initOCL();
+    void buildProgram(GLSLProgram* program, const char* vertexShader);
+    void setSceneUniforms(GLSLProgram* program);
     void cleanup();
 
     void buildWaveGrid();
 
+    // legacy pipeline, every step acquires its buffers and waits for the device
     void computeVertexDisplacement();
     void computeFiniteDifferenceScheme();
+    void computeFusedStep();
+    void computeHeightOutput();
+
+    // queues a random drop for the next step
     void disturbGrid();
     void initGLBuffer();
 
+    // asynchronous pipeline, one acquire/release per frame with the kernels chained by events.
+    // The enqueue functions consume the event they wait for and return the event of their command.
+    void simulateFrame();
+
+    // runs all but the last substep of a frame as height-only multi-step launches
+    void advanceSubsteps();
+
+    void reportFrameTime(double seconds);
+
 private:
     // ocl
     cl_platform_id m_platform;
     cl_device_id m_device;
-    cl_context m_context;
-    cl_command_queue m_queue;
-    cl_program m_program;
-
-    cl_kernel m_vertexDisplacementKernel;
-    cl_kernel m_finiteDifferenceSchemeKernel;
-    cl_kernel m_disturbKernel;
-    cl_kernel m_glGridInitKernel;
-
-    cl_mem m_clPositionInteropBuffer;
-    cl_mem m_clNormalInteropBuffer;
-    cl_mem m_clTangentInteropBuffer;
-    cl_mem m_clPing;
-    cl_mem m_clPong;
-
-    size_t m_kernelsize;
-    size_t m_global[2];
+
+    // owns the context, queue, kernels and buffers, its outputs are the vbos
+    OpenCLWaveSolver m_solver;
+
+    // simulation steps per rendered frame
+    unsigned int m_substeps;
+
+    // cl_khr_gl_event, 0 if the device lacks the extension
+    typedef cl_event (CL_API_CALL *CreateEventFromGLsyncFunc)(cl_context, cl_GLsync, cl_int*);
+    CreateEventFromGLsyncFunc m_clCreateEventFromGLsync;
+    bool m_asyncPipeline;
     std::string m_fxFilePath;
     std::string m_programSource;
 
@@ -100,6 +113,17 @@ private:
     GLSLProgram* m_glslProgram;
     GLuint m_vaoWaves;
 
+    // height render mode, the solver only writes the heights into m_heightVBO and
+    // render_waves_heights.vert rebuilds positions and normals from its texture buffer.
+    // With the image storage the shader samples the current one of the shared height
+    // images m_heightImageTextures instead, and nothing is copied.
+    GLSLProgram* m_heightProgram;
+    GLuint m_vaoHeights;
+    GLuint m_heightVBO;
+    GLuint m_heightTexture;
+    GLuint m_heightImageTextures[3];
+    bool m_heightRendering;
+
     // transformation matrices
     glm::mat4 m_modelM;
     glm::mat4 m_viewM;
@@ -110,7 +134,9 @@ private:
     GLuint m_positionVBO;
     GLuint m_normalVBO;
     GLuint m_tangentVBO;
-    GLuint m_ibo;
+
+    // index buffer and draw calls of the grid, 'm' cycles its layout
+    GridMesh m_gridMesh;
 
     // light, material and camera
     glm::vec4 m_materialAmbient;
@@ -122,9 +148,13 @@ private:
     glm::vec4 m_lightDiffuse;
     glm::vec4 m_lightSpecular;
     
+    // wall clock frame time of the current pipeline
+    std::chrono::steady_clock::time_point m_frameReportStart;
+    double m_frameSeconds;
+    unsigned int m_frameCount;
+
     // animation
     Chronometer m_waveTrigger;
-    bool m_pingpong;
     GPUWaves m_waves;
 
     // navigation
@@ -0,0 +1,1436 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "OpenCLWaveSolver.h"
+#include "ProgramCache.h"
+#include "WorkGroupTuner.h"
+#include "HalfFloat.h"
+
+// std
+#include <iostream>
+#include <algorithm>
+
+// drops beyond this stay queued for the following steps
+static const unsigned int MAX_DROPS_PER_STEP = 256;
+
+// edge of the work group of the tiled kernels, shrunk if a kernel can't be launched with it
+static const size_t TILE_SIZE = 16;
+
+static const char* STEP_KERNEL_NAMES[] = {"compute_vertex_displacement", "compute_vertex_displacement_local",
+                                          "compute_finite_difference_scheme", "compute_fused_step", "compute_multi_step",
+                                          "compute_height_step", "compute_vertex_displacement_image", "compute_height_image",
+                                          "compute_finite_difference_scheme_image"};
+
+// index of the first drop argument per step kernel, the finite difference schemes have none
+static const cl_uint DROP_ARG_INDEX[] = {8, 9, 0, 11, 10, 6, 8, 6, 0};
+
+// GL_TEXTURE_2D, the solver doesn't include the GL headers
+static const cl_GLenum GL_TEXTURE_2D_TARGET = 0x0DE1;
+
+OpenCLWaveSolver::OpenCLWaveSolver()
+    : m_platform(0),
+      m_device(0),
+      m_context(0),
+      m_queue(0),
+      m_program(0),
+      m_gridInitKernel(0),
+      m_imageGridInitKernel(0),
+      m_positionBuffer(0),
+      m_normalBuffer(0),
+      m_tangentBuffer(0),
+      m_glBuffers(false),
+      m_heightOutputBuffer(0),
+      m_glHeightBuffer(false),
+      m_heightOutput(false),
+      m_heightPair(0),
+      m_pingpong(true),
+      m_imageRotation(0),
+      m_imageSupport(false),
+      m_useImages(false),
+      m_glHeightTextures(false),
+      m_halfHeights(false),
+      m_bindPerLaunch(false),
+      m_dropBuffer(0),
+      m_dropsUploaded(0),
+      m_gridWidth(0),
+      m_gridHeight(0),
+      m_k1(0.0f),
+      m_k2(0.0f),
+      m_k3(0.0f),
+      m_spatialStep(0.0f),
+      m_useLocalTiling(false),
+      m_useFusedKernel(false),
+      m_useMultiStep(false),
+      m_stepsPerLaunch(1)
+{
+    m_global[0] = m_global[1] = 0;
+    m_displacementLocal[0] = m_displacementLocal[1] = 0;
+    m_finiteDifferenceLocal[0] = m_finiteDifferenceLocal[1] = 0;
+    m_heightStepLocal[0] = m_heightStepLocal[1] = 0;
+    m_tileLocal[0] = TILE_SIZE;
+    m_tileLocal[1] = TILE_SIZE;
+    m_tileGlobal[0] = m_tileGlobal[1] = 0;
+    for(int s = 0; s < STATE_COUNT; ++s)
+    {
+        for(int k = 0; k < STEP_KERNEL_COUNT; ++k)
+        {
+            m_stepKernels[k][s] = 0;
+            m_dropArgsBound[k][s] = false;
+        }
+        m_boundSteps[s] = 0;
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        m_heights[i] = 0;
+    }
+    for(int i = 0; i < IMAGE_COUNT; ++i)
+    {
+        m_heightImages[i] = 0;
+    }
+}
+
+OpenCLWaveSolver::~OpenCLWaveSolver()
+{
+    release();
+}
+
+bool OpenCLWaveSolver::init(cl_device_id device, const GPUWaves& waves, const std::string& programSource,
+                            const cl_context_properties* contextProperties)
+{
+    release();
+
+    m_device = device;
+    clGetDeviceInfo(m_device, CL_DEVICE_PLATFORM, sizeof(m_platform), &m_platform, NULL);
+
+    m_gridWidth = static_cast<int>(waves.columnCount());
+    m_gridHeight = static_cast<int>(waves.rowCount());
+    m_k1 = *waves.k1();
+    m_k2 = *waves.k2();
+    m_k3 = *waves.k3();
+    m_spatialStep = *waves.spatialStep();
+
+    m_global[0] = m_gridWidth;
+    m_global[1] = m_gridHeight;
+    m_tileLocal[0] = TILE_SIZE;
+    m_tileLocal[1] = TILE_SIZE;
+    m_tileGlobal[0] = ((m_gridWidth + m_tileLocal[0] - 1) / m_tileLocal[0]) * m_tileLocal[0];
+    m_tileGlobal[1] = ((m_gridHeight + m_tileLocal[1] - 1) / m_tileLocal[1]) * m_tileLocal[1];
+
+    // create context and queue
+    cl_context_properties platformProperties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)m_platform, 0};
+    cl_int err = CL_SUCCESS;
+    m_context = clCreateContext(contextProperties ? contextProperties : platformProperties, 1, &m_device, NULL, NULL, &err);
+    if(m_context == 0 || err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create OpenCL context!" << std::endl;
+        return false;
+    }
+
+    m_queue = clCreateCommandQueue(m_context, m_device, 0, &err);
+    if(m_queue == 0 || err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create OpenCL command queue!" << std::endl;
+        return false;
+    }
+
+    // the simulation state only holds the heights, positions are rebuilt when writing the outputs
+    const size_t stateSize = m_global[0] * m_global[1] * heightSize();
+    const size_t outputSize = m_global[0] * m_global[1] * 4 * sizeof(float);
+    std::vector<cl_half> halfHeights;
+    const void* heights = waves.getHeights();
+    if(m_halfHeights)
+    {
+        halfHeights.resize(m_global[0] * m_global[1]);
+        for(size_t i = 0; i < halfHeights.size(); ++i)
+        {
+            halfHeights[i] = HalfFloat::fromFloat(waves.getHeights()[i]);
+        }
+        heights = &halfHeights[0];
+    }
+
+    // the second pair of the multi-step kernel, the height images and the height output
+    // are only allocated once they are used
+    cl_int errors[6];
+    m_heights[0] = clCreateBuffer(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateSize, (void*)heights, &errors[0]);
+    m_heights[1] = clCreateBuffer(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, stateSize, (void*)heights, &errors[1]);
+    m_positionBuffer = clCreateBuffer(m_context, CL_MEM_WRITE_ONLY, outputSize, NULL, &errors[2]);
+    m_normalBuffer = clCreateBuffer(m_context, CL_MEM_WRITE_ONLY, outputSize, NULL, &errors[3]);
+    m_tangentBuffer = clCreateBuffer(m_context, CL_MEM_WRITE_ONLY, outputSize, NULL, &errors[4]);
+    m_dropBuffer = clCreateBuffer(m_context, CL_MEM_READ_ONLY, MAX_DROPS_PER_STEP * sizeof(Drop), NULL, &errors[5]);
+    for(int i = 0; i < 6; ++i)
+    {
+        if(errors[i] != CL_SUCCESS)
+        {
+            std::cerr << "Failed creating cl_mem read write buffer\n";
+            return false;
+        }
+    }
+
+    // build program, the binary is cached for later launches
+    ProgramCache programCache;
+    m_program = programCache.build(m_context, m_device, programSource,
+                                   GPUWaves::programOptions() + (m_halfHeights ? " -D HALF_HEIGHTS" : ""));
+    if(m_program == 0)
+    {
+        return false;
+    }
+
+    m_gridInitKernel = createKernel("initialize_gl_grid");
+    if(!m_gridInitKernel)
+    {
+        return false;
+    }
+
+    // the image kernels are only compiled for devices with image support
+    m_imageSupport = heightImageFormatSupported();
+    if(m_imageSupport)
+    {
+        m_imageGridInitKernel = createKernel("initialize_gl_grid_image");
+        m_imageSupport = m_imageGridInitKernel != 0;
+    }
+
+    // only the ping/pong order changes between steps, so every state gets kernel objects
+    // with all arguments bound once the buffers are known, and a launch sets none of them
+    for(int k = 0; k < STEP_KERNEL_COUNT; ++k)
+    {
+        bool imageKernel = k >= VERTEX_DISPLACEMENT_IMAGE;
+        if(imageKernel && !m_imageSupport)
+        {
+            continue;
+        }
+
+        for(unsigned int s = 0; s < (imageKernel ? IMAGE_COUNT : STATE_COUNT); ++s)
+        {
+            m_stepKernels[k][s] = createKernel(STEP_KERNEL_NAMES[k]);
+            if(!m_stepKernels[k][s])
+            {
+                return false;
+            }
+        }
+    }
+
+    // The fused kernel relies on the same local memory tile. The tiles need local memory
+    // and a work group the kernels can be launched with, otherwise the height steps fall
+    // back to compute_height_step.
+    fitTileToKernels();
+    m_useLocalTiling = GPUWaves::useLocalMemoryTiling(m_device, m_tileLocal) && tileFits(VERTEX_DISPLACEMENT_LOCAL);
+    m_useFusedKernel = m_useLocalTiling && tileFits(FUSED_STEP);
+    m_useMultiStep = GPUWaves::useLocalMemoryTiling(m_device, m_tileLocal) && tileFits(MULTI_STEP);
+    m_stepsPerLaunch = m_useMultiStep ? GPUWaves::multiStepCount(m_device, m_tileLocal) : 1;
+
+    if(m_useMultiStep)
+    {
+        m_heights[2] = clCreateBuffer(m_context, CL_MEM_READ_WRITE, stateSize, NULL, &errors[0]);
+        m_heights[3] = clCreateBuffer(m_context, CL_MEM_READ_WRITE, stateSize, NULL, &errors[1]);
+        if(errors[0] != CL_SUCCESS || errors[1] != CL_SUCCESS)
+        {
+            std::cerr << "Failed creating cl_mem read write buffer\n";
+            return false;
+        }
+    }
+    rebindAllKernelArgs();
+
+    tuneWorkGroups();
+    return true;
+}
+
+bool OpenCLWaveSolver::tileFits(StepKernel kernel)
+{
+    // CL_KERNEL_LOCAL_MEM_SIZE counts the __local arguments as they are bound, so the tiles
+    // are bound here first and counted exactly once. compute_multi_step needs its two tiles
+    // with the halo of at least one step, its next launch binds the tiles of its steps again.
+    cl_kernel object = m_stepKernels[kernel][0];
+    if(kernel == MULTI_STEP)
+    {
+        size_t tileSize = GPUWaves::multiStepTileSize(m_tileLocal, 1);
+        clSetKernelArg(object, 14, tileSize, NULL);
+        clSetKernelArg(object, 15, tileSize, NULL);
+        m_boundSteps[0] = 0;
+    }
+    else
+    {
+        clSetKernelArg(object, kernel == FUSED_STEP ? 15 : 13, GPUWaves::localTileSize(m_tileLocal), NULL);
+    }
+
+    size_t maxWorkGroupSize = 0;
+    cl_ulong kernelLocalMemSize = 0;
+    cl_ulong deviceLocalMemSize = 0;
+    if(clGetKernelWorkGroupInfo(m_stepKernels[kernel][0], m_device, CL_KERNEL_WORK_GROUP_SIZE,
+                                sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL) != CL_SUCCESS ||
+       clGetKernelWorkGroupInfo(m_stepKernels[kernel][0], m_device, CL_KERNEL_LOCAL_MEM_SIZE,
+                                sizeof(kernelLocalMemSize), &kernelLocalMemSize, NULL) != CL_SUCCESS ||
+       clGetDeviceInfo(m_device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(deviceLocalMemSize), &deviceLocalMemSize, NULL) != CL_SUCCESS)
+    {
+        return false;
+    }
+
+    return m_tileLocal[0] * m_tileLocal[1] <= maxWorkGroupSize &&
+           kernelLocalMemSize <= deviceLocalMemSize;
+}
+
+void OpenCLWaveSolver::fitTileToKernels()
+{
+    const StepKernel tiledKernels[] = {VERTEX_DISPLACEMENT_LOCAL, FUSED_STEP, MULTI_STEP};
+    size_t limit = m_tileLocal[0] * m_tileLocal[1];
+    for(int k = 0; k < 3; ++k)
+    {
+        size_t maxWorkGroupSize = 0;
+        if(clGetKernelWorkGroupInfo(m_stepKernels[tiledKernels[k]][0], m_device, CL_KERNEL_WORK_GROUP_SIZE,
+                                    sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL) == CL_SUCCESS)
+        {
+            limit = std::min(limit, maxWorkGroupSize);
+        }
+    }
+    if(m_tileLocal[0] * m_tileLocal[1] <= limit)
+    {
+        return;
+    }
+
+    // halving the longer edge keeps the tile close to square, so the halo stays small
+    while(m_tileLocal[0] * m_tileLocal[1] > limit && m_tileLocal[0] * m_tileLocal[1] > 1)
+    {
+        size_t& edge = (m_tileLocal[0] >= m_tileLocal[1]) ? m_tileLocal[0] : m_tileLocal[1];
+        edge = std::max<size_t>(edge / 2, 1);
+    }
+    m_tileGlobal[0] = ((m_gridWidth + m_tileLocal[0] - 1) / m_tileLocal[0]) * m_tileLocal[0];
+    m_tileGlobal[1] = ((m_gridHeight + m_tileLocal[1] - 1) / m_tileLocal[1]) * m_tileLocal[1];
+    std::cout << "Work group of the tiled kernels shrunk to " << m_tileLocal[0] << "x" << m_tileLocal[1]
+              << " to fit the kernel limit of " << limit << "\n";
+
+    // the local memory arguments are sized by the tile
+    rebindAllKernelArgs();
+}
+
+cl_kernel OpenCLWaveSolver::createKernel(const char* name)
+{
+    cl_int err = CL_SUCCESS;
+    cl_kernel kernel = clCreateKernel(m_program, name, &err);
+    if(!kernel || err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create compute kernel: " << name << "!" << std::endl;
+        return 0;
+    }
+    return kernel;
+}
+
+size_t OpenCLWaveSolver::heightSize() const
+{
+    return m_halfHeights ? sizeof(cl_half) : sizeof(float);
+}
+
+unsigned int OpenCLWaveSolver::state() const
+{
+    return 2 * m_heightPair + (m_pingpong ? 1 : 0);
+}
+
+unsigned int OpenCLWaveSolver::kernelState(StepKernel kernel) const
+{
+    return kernel >= VERTEX_DISPLACEMENT_IMAGE ? m_imageRotation : state();
+}
+
+cl_mem OpenCLWaveSolver::prevHeights(unsigned int state) const
+{
+    // ping is the first buffer of a pair, with pingpong set prev is ping
+    return m_heights[2 * (state / 2) + (state % 2 ? 0 : 1)];
+}
+
+cl_mem OpenCLWaveSolver::currHeights(unsigned int state) const
+{
+    return m_heights[2 * (state / 2) + (state % 2 ? 1 : 0)];
+}
+
+bool OpenCLWaveSolver::heightImageFormatSupported() const
+{
+    cl_bool imageSupport = CL_FALSE;
+    clGetDeviceInfo(m_device, CL_DEVICE_IMAGE_SUPPORT, sizeof(imageSupport), &imageSupport, NULL);
+    if(!imageSupport)
+    {
+        return false;
+    }
+
+    cl_uint formatCount = 0;
+    clGetSupportedImageFormats(m_context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, 0, NULL, &formatCount);
+    std::vector<cl_image_format> formats(formatCount);
+    if(formatCount > 0)
+    {
+        clGetSupportedImageFormats(m_context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, formatCount, &formats[0], NULL);
+    }
+
+    // the images hold the heights in the layout of the buffers, so they copy without conversion
+    cl_image_format format = {CL_R, static_cast<cl_channel_type>(m_halfHeights ? CL_HALF_FLOAT : CL_FLOAT)};
+    bool formatSupported = false;
+    for(size_t i = 0; i < formats.size(); ++i)
+    {
+        formatSupported |= formats[i].image_channel_order == format.image_channel_order &&
+                           formats[i].image_channel_data_type == format.image_channel_data_type;
+    }
+    return formatSupported;
+}
+
+bool OpenCLWaveSolver::createHeightImages()
+{
+    cl_image_format format = {CL_R, static_cast<cl_channel_type>(m_halfHeights ? CL_HALF_FLOAT : CL_FLOAT)};
+    for(int i = 0; i < IMAGE_COUNT; ++i)
+    {
+        cl_int err = CL_SUCCESS;
+        m_heightImages[i] = clCreateImage2D(m_context, CL_MEM_READ_WRITE, &format, m_global[0], m_global[1], 0, NULL, &err);
+        if(err != CL_SUCCESS)
+        {
+            std::cerr << "Failed creating cl_mem height image\n";
+            releaseHeightImages();
+            return false;
+        }
+    }
+    m_imageRotation = 0;
+    return true;
+}
+
+void OpenCLWaveSolver::bindKernelArgs(StepKernel kernel, unsigned int state)
+{
+    // the image kernels are bound once the images exist
+    if(kernel >= VERTEX_DISPLACEMENT_IMAGE && m_heightImages[0] == 0)
+    {
+        return;
+    }
+
+    cl_kernel object = m_stepKernels[kernel][state];
+    cl_mem prev = prevHeights(state);
+    cl_mem curr = currHeights(state);
+
+    // the image kernels read prev and curr and write next of their rotation
+    cl_mem prevImage = m_heightImages[state % IMAGE_COUNT];
+    cl_mem currImage = m_heightImages[(state + 1) % IMAGE_COUNT];
+    cl_mem nextImage = m_heightImages[(state + 2) % IMAGE_COUNT];
+
+    // the queued drops are uploaded into the same buffer for every launch
+    int noDrops = 0;
+    cl_uint noRain[] = {0, 0, 0, 0};
+    cl_float noRainShape[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    if(DROP_ARG_INDEX[kernel] != 0)
+    {
+        cl_uint dropArg = DROP_ARG_INDEX[kernel];
+        clSetKernelArg(object, dropArg, sizeof(cl_mem), (void*)&m_dropBuffer);
+        clSetKernelArg(object, dropArg+1, sizeof(int), &noDrops);
+        clSetKernelArg(object, dropArg+2, sizeof(noRain), noRain);
+        clSetKernelArg(object, dropArg+3, sizeof(noRainShape), noRainShape);
+        m_dropArgsBound[kernel][state] = false;
+    }
+
+    switch(kernel)
+    {
+    case VERTEX_DISPLACEMENT:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prev);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&m_positionBuffer);
+        clSetKernelArg(object, 3, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 4, sizeof(float), &m_k1);
+        clSetKernelArg(object, 5, sizeof(float), &m_k2);
+        clSetKernelArg(object, 6, sizeof(float), &m_k3);
+        clSetKernelArg(object, 7, sizeof(float), &m_spatialStep);
+        break;
+
+    case VERTEX_DISPLACEMENT_LOCAL:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prev);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&m_positionBuffer);
+        clSetKernelArg(object, 3, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 4, sizeof(int), &m_gridHeight);
+        clSetKernelArg(object, 5, sizeof(float), &m_k1);
+        clSetKernelArg(object, 6, sizeof(float), &m_k2);
+        clSetKernelArg(object, 7, sizeof(float), &m_k3);
+        clSetKernelArg(object, 8, sizeof(float), &m_spatialStep);
+        clSetKernelArg(object, 13, GPUWaves::localTileSize(m_tileLocal), NULL);
+        break;
+
+    case FINITE_DIFFERENCE_SCHEME:
+        // runs after the vertex displacement swapped the buffers, the new solution is in curr
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&m_normalBuffer);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&m_tangentBuffer);
+        clSetKernelArg(object, 3, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 4, sizeof(float), &m_spatialStep);
+        break;
+
+    case FUSED_STEP:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prev);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&m_positionBuffer);
+        clSetKernelArg(object, 3, sizeof(cl_mem), (void*)&m_normalBuffer);
+        clSetKernelArg(object, 4, sizeof(cl_mem), (void*)&m_tangentBuffer);
+        clSetKernelArg(object, 5, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 6, sizeof(int), &m_gridHeight);
+        clSetKernelArg(object, 7, sizeof(float), &m_k1);
+        clSetKernelArg(object, 8, sizeof(float), &m_k2);
+        clSetKernelArg(object, 9, sizeof(float), &m_k3);
+        clSetKernelArg(object, 10, sizeof(float), &m_spatialStep);
+        clSetKernelArg(object, 15, GPUWaves::localTileSize(m_tileLocal), NULL);
+        break;
+
+    case MULTI_STEP:
+    {
+        // the new time levels go to the other pair, the steps are bound with the first launch
+        cl_mem nextPrev = prevHeights(state ^ 2);
+        cl_mem nextCurr = currHeights(state ^ 2);
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prev);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&nextPrev);
+        clSetKernelArg(object, 3, sizeof(cl_mem), (void*)&nextCurr);
+        clSetKernelArg(object, 4, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 5, sizeof(int), &m_gridHeight);
+        clSetKernelArg(object, 6, sizeof(float), &m_k1);
+        clSetKernelArg(object, 7, sizeof(float), &m_k2);
+        clSetKernelArg(object, 8, sizeof(float), &m_k3);
+        m_boundSteps[state] = 0;
+        break;
+    }
+
+    case HEIGHT_STEP:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prev);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&curr);
+        clSetKernelArg(object, 2, sizeof(int), &m_gridWidth);
+        clSetKernelArg(object, 3, sizeof(float), &m_k1);
+        clSetKernelArg(object, 4, sizeof(float), &m_k2);
+        clSetKernelArg(object, 5, sizeof(float), &m_k3);
+        break;
+
+    case VERTEX_DISPLACEMENT_IMAGE:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prevImage);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&currImage);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&nextImage);
+        clSetKernelArg(object, 3, sizeof(cl_mem), (void*)&m_positionBuffer);
+        clSetKernelArg(object, 4, sizeof(float), &m_k1);
+        clSetKernelArg(object, 5, sizeof(float), &m_k2);
+        clSetKernelArg(object, 6, sizeof(float), &m_k3);
+        clSetKernelArg(object, 7, sizeof(float), &m_spatialStep);
+        break;
+
+    case HEIGHT_STEP_IMAGE:
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&prevImage);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&currImage);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&nextImage);
+        clSetKernelArg(object, 3, sizeof(float), &m_k1);
+        clSetKernelArg(object, 4, sizeof(float), &m_k2);
+        clSetKernelArg(object, 5, sizeof(float), &m_k3);
+        break;
+
+    case FINITE_DIFFERENCE_SCHEME_IMAGE:
+        // runs after the rotation, the new solution is in curr
+        clSetKernelArg(object, 0, sizeof(cl_mem), (void*)&currImage);
+        clSetKernelArg(object, 1, sizeof(cl_mem), (void*)&m_normalBuffer);
+        clSetKernelArg(object, 2, sizeof(cl_mem), (void*)&m_tangentBuffer);
+        clSetKernelArg(object, 3, sizeof(float), &m_spatialStep);
+        break;
+
+    default:
+        break;
+    }
+}
+
+cl_kernel OpenCLWaveSolver::launchKernel(StepKernel kernel)
+{
+    if(m_bindPerLaunch)
+    {
+        bindKernelArgs(kernel, kernelState(kernel));
+    }
+    return m_stepKernels[kernel][kernelState(kernel)];
+}
+
+void OpenCLWaveSolver::rebindAllKernelArgs()
+{
+    for(int k = 0; k < STEP_KERNEL_COUNT; ++k)
+    {
+        for(unsigned int s = 0; s < STATE_COUNT; ++s)
+        {
+            if(m_stepKernels[k][s] != 0)
+            {
+                bindKernelArgs(static_cast<StepKernel>(k), s);
+            }
+        }
+    }
+}
+
+void OpenCLWaveSolver::setDropArgs(StepKernel kernel, unsigned int steps)
+{
+    // nothing to set if neither this launch nor the last launch of the kernel object has drops
+    bool& bound = m_dropArgsBound[kernel][kernelState(kernel)];
+    if(m_disturbances.empty() && m_disturbances.rainPerStep() == 0 && !bound)
+    {
+        return;
+    }
+
+    cl_kernel object = m_stepKernels[kernel][kernelState(kernel)];
+    cl_uint firstArg = DROP_ARG_INDEX[kernel];
+    int dropCount = 0;
+    if(!m_disturbances.empty())
+    {
+        // the last upload may still read the staging copy
+        if(m_dropsUploaded != 0)
+        {
+            clWaitForEvents(1, &m_dropsUploaded);
+            releaseEvent(m_dropsUploaded);
+            m_dropsUploaded = 0;
+        }
+
+        m_dropStaging.clear();
+        dropCount = static_cast<int>(m_disturbances.take(m_dropStaging, MAX_DROPS_PER_STEP));
+        if(clEnqueueWriteBuffer(m_queue, m_dropBuffer, CL_FALSE, 0, dropCount * sizeof(Drop), &m_dropStaging[0],
+                                0, NULL, &m_dropsUploaded) != CL_SUCCESS)
+        {
+            std::cerr << "Failed to upload " << dropCount << " drops\n";
+            dropCount = 0;
+        }
+    }
+
+    // the kernels generate the rain drops from their numbers
+    cl_uint rain[] = {m_disturbances.rainSeed(), m_disturbances.advanceRain(steps), m_disturbances.rainPerStep(), 0};
+    cl_float rainShape[] = {m_disturbances.rainMinMagnitude(), m_disturbances.rainMaxMagnitude(), m_disturbances.rainRadius(), 0.0f};
+
+    clSetKernelArg(object, firstArg+1, sizeof(int), &dropCount);
+    clSetKernelArg(object, firstArg+2, sizeof(rain), rain);
+    clSetKernelArg(object, firstArg+3, sizeof(rainShape), rainShape);
+    bound = dropCount > 0 || rain[2] > 0;
+}
+
+void OpenCLWaveSolver::tuneWorkGroups()
+{
+    // the grid is still flat, so the tuning launches leave the heights unchanged
+    WorkGroupTuner tuner;
+    tuner.tune(m_queue, m_stepKernels[VERTEX_DISPLACEMENT][state()], m_global, m_displacementLocal);
+    tuner.tune(m_queue, m_stepKernels[FINITE_DIFFERENCE_SCHEME][state()], m_global, m_finiteDifferenceLocal);
+    if(!m_useMultiStep)
+    {
+        tuner.tune(m_queue, m_stepKernels[HEIGHT_STEP][state()], m_global, m_heightStepLocal);
+    }
+}
+
+bool OpenCLWaveSolver::attachGLBuffers(cl_GLuint positionVBO, cl_GLuint normalVBO, cl_GLuint tangentVBO)
+{
+    releaseOutputs();
+    m_glBuffers = true;
+
+    int errCode;
+    m_positionBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, positionVBO, &errCode);
+    if(errCode != CL_SUCCESS)
+    {
+        std::cerr << "Failed creating cl_mem position buffer from gl buffer\n";
+        return false;
+    }
+
+    m_normalBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, normalVBO, &errCode);
+    if(errCode != CL_SUCCESS)
+    {
+        std::cerr << "Failed creating cl_mem normal buffer from gl buffer\n";
+        return false;
+    }
+
+    m_tangentBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, tangentVBO, &errCode);
+    if(errCode != CL_SUCCESS)
+    {
+        std::cerr << "Failed creating cl_mem tangent buffer from gl buffer\n";
+        return false;
+    }
+
+    // the kernel objects still refer to the replaced outputs
+    rebindAllKernelArgs();
+    return true;
+}
+
+bool OpenCLWaveSolver::hasGLBuffers() const
+{
+    return m_glBuffers;
+}
+
+bool OpenCLWaveSolver::setImageStorage(bool enabled)
+{
+    if(enabled == m_useImages)
+    {
+        return true;
+    }
+    if(enabled && !m_imageSupport)
+    {
+        std::cerr << "The device has no single channel images of the height format, the heights stay in buffers\n";
+        return false;
+    }
+    if(enabled && m_heightImages[0] == 0)
+    {
+        if(!createHeightImages())
+        {
+            return false;
+        }
+        rebindAllKernelArgs();
+    }
+
+    // prev and curr move to the other storage, the queue runs in order
+    releaseEvent(enqueueGLObjects(true, m_glHeightTextures ? m_heightImages : NULL, IMAGE_COUNT, 0));
+    const size_t origin[] = {0, 0, 0};
+    const size_t region[] = {m_global[0], m_global[1], 1};
+    cl_mem buffers[] = {prevHeights(state()), currHeights(state())};
+    cl_int err = CL_SUCCESS;
+    for(int i = 0; i < 2; ++i)
+    {
+        cl_mem image = m_heightImages[(m_imageRotation + i) % IMAGE_COUNT];
+        if(enabled)
+        {
+            err |= clEnqueueCopyBufferToImage(m_queue, buffers[i], image, 0, origin, region, 0, NULL, NULL);
+        }
+        else
+        {
+            err |= clEnqueueCopyImageToBuffer(m_queue, image, buffers[i], origin, region, 0, 0, NULL, NULL);
+        }
+    }
+    releaseEvent(enqueueGLObjects(false, m_glHeightTextures ? m_heightImages : NULL, IMAGE_COUNT, 0));
+    clFinish(m_queue);
+
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Failed to copy the heights between buffers and images\n";
+        return false;
+    }
+    m_useImages = enabled;
+
+    // the images of the solver are only kept while they hold the heights
+    if(!enabled && !m_glHeightTextures)
+    {
+        releaseHeightImages();
+    }
+    return true;
+}
+
+bool OpenCLWaveSolver::imageStorage() const
+{
+    return m_useImages;
+}
+
+bool OpenCLWaveSolver::imageStorageSupported() const
+{
+    return m_imageSupport;
+}
+
+bool OpenCLWaveSolver::attachGLHeightTextures(const cl_GLuint textures[3])
+{
+    if(!m_imageSupport)
+    {
+        std::cerr << "The device has no single channel images of the height format to share with GL textures\n";
+        return false;
+    }
+
+    cl_mem images[IMAGE_COUNT] = {0, 0, 0};
+    for(int i = 0; i < IMAGE_COUNT; ++i)
+    {
+        cl_int errCode = CL_SUCCESS;
+        images[i] = clCreateFromGLTexture(m_context, CL_MEM_READ_WRITE, GL_TEXTURE_2D_TARGET, 0, textures[i], &errCode);
+        if(errCode != CL_SUCCESS)
+        {
+            std::cerr << "Failed creating cl_mem height image from gl texture\n";
+            for(int j = 0; j < i; ++j)
+            {
+                clReleaseMemObject(images[j]);
+            }
+            return false;
+        }
+    }
+
+    // the textures take over the heights and the rotation of the images they replace
+    unsigned int rotation = m_imageRotation;
+    if(m_heightImages[0] != 0)
+    {
+        releaseEvent(enqueueGLObjects(true, images, IMAGE_COUNT, 0));
+        const size_t origin[] = {0, 0, 0};
+        const size_t region[] = {m_global[0], m_global[1], 1};
+        for(int i = 0; i < IMAGE_COUNT; ++i)
+        {
+            if(clEnqueueCopyImage(m_queue, m_heightImages[i], images[i], origin, origin, region, 0, NULL, NULL) != CL_SUCCESS)
+            {
+                std::cerr << "Failed to copy the heights into gl texture " << i << "\n";
+            }
+        }
+        releaseEvent(enqueueGLObjects(false, images, IMAGE_COUNT, 0));
+        clFinish(m_queue);
+    }
+
+    releaseHeightImages();
+    m_imageRotation = rotation;
+    for(int i = 0; i < IMAGE_COUNT; ++i)
+    {
+        m_heightImages[i] = images[i];
+    }
+    m_glHeightTextures = true;
+    rebindAllKernelArgs();
+    return true;
+}
+
+bool OpenCLWaveSolver::hasGLHeightTextures() const
+{
+    return m_glHeightTextures;
+}
+
+unsigned int OpenCLWaveSolver::currentHeightTexture() const
+{
+    return (m_imageRotation + 1) % IMAGE_COUNT;
+}
+
+bool OpenCLWaveSolver::heightTexturesCurrent() const
+{
+    return m_glHeightTextures && m_useImages;
+}
+
+bool OpenCLWaveSolver::setHeightOutput(bool enabled)
+{
+    if(!m_glHeightBuffer)
+    {
+        if(enabled && m_heightOutputBuffer == 0)
+        {
+            cl_int err = CL_SUCCESS;
+            m_heightOutputBuffer = clCreateBuffer(m_context, CL_MEM_WRITE_ONLY, m_global[0] * m_global[1] * heightSize(), NULL, &err);
+            if(err != CL_SUCCESS)
+            {
+                std::cerr << "Failed creating cl_mem height output buffer\n";
+                m_heightOutputBuffer = 0;
+                return false;
+            }
+        }
+        else if(!enabled)
+        {
+            releaseHeightOutput();
+        }
+    }
+    m_heightOutput = enabled;
+    return true;
+}
+
+bool OpenCLWaveSolver::heightOutput() const
+{
+    return m_heightOutput;
+}
+
+bool OpenCLWaveSolver::attachGLHeightBuffer(cl_GLuint heightBuffer)
+{
+    releaseHeightOutput();
+
+    cl_int errCode = CL_SUCCESS;
+    m_heightOutputBuffer = clCreateFromGLBuffer(m_context, CL_MEM_WRITE_ONLY, heightBuffer, &errCode);
+    if(errCode != CL_SUCCESS)
+    {
+        std::cerr << "Failed creating cl_mem height buffer from gl buffer\n";
+        return false;
+    }
+    m_glHeightBuffer = true;
+    return true;
+}
+
+bool OpenCLWaveSolver::hasGLHeightBuffer() const
+{
+    return m_glHeightBuffer;
+}
+
+cl_event OpenCLWaveSolver::enqueueGLObjects(bool acquire, const cl_mem* objects, cl_uint count, cl_event waitFor)
+{
+    if(objects == NULL)
+    {
+        return waitFor;
+    }
+
+    cl_event done = 0;
+    cl_int err = acquire ? clEnqueueAcquireGLObjects(m_queue, count, objects, waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done)
+                         : clEnqueueReleaseGLObjects(m_queue, count, objects, waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Failed to " << (acquire ? "acquire" : "release") << " gl objects\n";
+    }
+    releaseEvent(waitFor);
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueAcquireOutputs(cl_event waitFor)
+{
+    std::vector<cl_mem> glObjects = glOutputs();
+    return enqueueGLObjects(true, glObjects.empty() ? NULL : &glObjects[0], static_cast<cl_uint>(glObjects.size()), waitFor);
+}
+
+cl_event OpenCLWaveSolver::enqueueReleaseOutputs(cl_event waitFor)
+{
+    std::vector<cl_mem> glObjects = glOutputs();
+    return enqueueGLObjects(false, glObjects.empty() ? NULL : &glObjects[0], static_cast<cl_uint>(glObjects.size()), waitFor);
+}
+
+std::vector<cl_mem> OpenCLWaveSolver::glOutputs() const
+{
+    // the vertex buffers are left to GL while only the heights are written
+    std::vector<cl_mem> glObjects;
+    if(m_glBuffers && !m_heightOutput)
+    {
+        glObjects.push_back(m_positionBuffer);
+        glObjects.push_back(m_normalBuffer);
+        glObjects.push_back(m_tangentBuffer);
+    }
+    if(m_glHeightBuffer && m_heightOutput && !heightTexturesCurrent())
+    {
+        glObjects.push_back(m_heightOutputBuffer);
+    }
+    if(heightTexturesCurrent())
+    {
+        glObjects.insert(glObjects.end(), m_heightImages, m_heightImages + IMAGE_COUNT);
+    }
+    return glObjects;
+}
+
+cl_event OpenCLWaveSolver::enqueueInitializeOutputs(cl_event waitFor)
+{
+    cl_mem curr = currHeights(state());
+    cl_event done = 0;
+
+    if(m_useImages)
+    {
+        cl_mem currImage = m_heightImages[currentHeightTexture()];
+        clSetKernelArg(m_imageGridInitKernel, 0, sizeof(cl_mem), (void*)&m_positionBuffer);
+        clSetKernelArg(m_imageGridInitKernel, 1, sizeof(cl_mem), (void*)&m_normalBuffer);
+        clSetKernelArg(m_imageGridInitKernel, 2, sizeof(cl_mem), (void*)&m_tangentBuffer);
+        clSetKernelArg(m_imageGridInitKernel, 3, sizeof(cl_mem), (void*)&currImage);
+        clSetKernelArg(m_imageGridInitKernel, 4, sizeof(float), &m_spatialStep);
+
+        if(clEnqueueNDRangeKernel(m_queue, m_imageGridInitKernel, 2, NULL, m_global, NULL,
+                                  waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+        {
+            std::cerr << "OpenGL Grid Init Kernel Execution failed\n";
+        }
+        releaseEvent(waitFor);
+        return done;
+    }
+
+    clSetKernelArg(m_gridInitKernel, 0, sizeof(cl_mem), (void*)&m_positionBuffer);
+    clSetKernelArg(m_gridInitKernel, 1, sizeof(cl_mem), (void*)&m_normalBuffer);
+    clSetKernelArg(m_gridInitKernel, 2, sizeof(cl_mem), (void*)&m_tangentBuffer);
+    clSetKernelArg(m_gridInitKernel, 3, sizeof(cl_mem), (void*)&curr);
+    clSetKernelArg(m_gridInitKernel, 4, sizeof(int), &m_gridWidth);
+    clSetKernelArg(m_gridInitKernel, 5, sizeof(float), &m_spatialStep);
+
+    if(clEnqueueNDRangeKernel(m_queue, m_gridInitKernel, 2, NULL, m_global, NULL,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "OpenGL Grid Init Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueHeightOutput(cl_event waitFor)
+{
+    cl_event done = 0;
+    cl_int err = CL_SUCCESS;
+    if(m_useImages)
+    {
+        const size_t origin[] = {0, 0, 0};
+        const size_t region[] = {m_global[0], m_global[1], 1};
+        err = clEnqueueCopyImageToBuffer(m_queue, m_heightImages[currentHeightTexture()], m_heightOutputBuffer, origin, region, 0,
+                                         waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+    }
+    else
+    {
+        err = clEnqueueCopyBuffer(m_queue, currHeights(state()), m_heightOutputBuffer, 0, 0, m_global[0] * m_global[1] * heightSize(),
+                                  waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+    }
+
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Failed to copy the heights into the height output\n";
+    }
+    releaseEvent(waitFor);
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueDisturbGrid(unsigned int i, unsigned int j, float magnitude, cl_event waitFor)
+{
+    // the step kernels add the drop, nothing is launched for it
+    m_disturbances.push(i, j, magnitude);
+    return waitFor;
+}
+
+cl_event OpenCLWaveSolver::enqueueSteps(unsigned int steps, cl_event waitFor)
+{
+    if(steps == 0)
+    {
+        return waitFor;
+    }
+
+    // a renderer sampling the GL height textures needs no copy of the heights
+    if(m_heightOutput)
+    {
+        cl_event event = enqueueHeightSteps(steps, waitFor);
+        return heightTexturesCurrent() ? event : enqueueHeightOutput(event);
+    }
+
+    cl_event event = enqueueHeightSteps(steps-1, waitFor);
+    if(m_useFusedKernel && !m_useImages)
+    {
+        return enqueueFusedStep(event);
+    }
+
+    event = enqueueVertexDisplacement(event);
+    return enqueueFiniteDifferenceScheme(event);
+}
+
+cl_event OpenCLWaveSolver::enqueueHeightSteps(unsigned int steps, cl_event waitFor)
+{
+    cl_event event = waitFor;
+    if(m_useImages)
+    {
+        for(unsigned int i = 0; i < steps; ++i)
+        {
+            event = enqueueImageHeightStep(event);
+        }
+        return event;
+    }
+
+    if(!m_useMultiStep)
+    {
+        for(unsigned int i = 0; i < steps; ++i)
+        {
+            event = enqueueBufferHeightStep(event);
+        }
+        return event;
+    }
+
+    for(unsigned int remaining = steps; remaining > 0; )
+    {
+        unsigned int launchSteps = std::min(remaining, m_stepsPerLaunch);
+        event = enqueueMultiStep(launchSteps, event);
+        remaining -= launchSteps;
+    }
+    return event;
+}
+
+cl_event OpenCLWaveSolver::enqueueVertexDisplacement(cl_event waitFor)
+{
+    cl_int err;
+    cl_event done = 0;
+
+    if(m_useImages)
+    {
+        cl_kernel kernel = launchKernel(VERTEX_DISPLACEMENT_IMAGE);
+        setDropArgs(VERTEX_DISPLACEMENT_IMAGE, 1);
+        err = clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_global, NULL,
+                                     waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+        if(err != CL_SUCCESS)
+        {
+            std::cerr << "Vertex Displacement Image Kernel Execution failed\n";
+        }
+        releaseEvent(waitFor);
+
+        // rotate images
+        m_imageRotation = (m_imageRotation + 1) % IMAGE_COUNT;
+        return done;
+    }
+
+    if(m_useLocalTiling)
+    {
+        cl_kernel kernel = launchKernel(VERTEX_DISPLACEMENT_LOCAL);
+        setDropArgs(VERTEX_DISPLACEMENT_LOCAL, 1);
+        err = clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_tileGlobal, m_tileLocal,
+                                     waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+    }
+    else
+    {
+        cl_kernel kernel = launchKernel(VERTEX_DISPLACEMENT);
+        setDropArgs(VERTEX_DISPLACEMENT, 1);
+        err = clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_global, WorkGroupTuner::localSize(m_displacementLocal),
+                                     waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done);
+    }
+
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Vertex Displacement Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+
+    // swap buffers
+    m_pingpong = !m_pingpong;
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueFiniteDifferenceScheme(cl_event waitFor)
+{
+    cl_kernel kernel = launchKernel(m_useImages ? FINITE_DIFFERENCE_SCHEME_IMAGE : FINITE_DIFFERENCE_SCHEME);
+    cl_event done = 0;
+
+    // the tuned work group belongs to the buffer kernel
+    const size_t* local = m_useImages ? NULL : WorkGroupTuner::localSize(m_finiteDifferenceLocal);
+    if(clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_global, local,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Finite Difference Scheme Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueImageHeightStep(cl_event waitFor)
+{
+    cl_kernel kernel = launchKernel(HEIGHT_STEP_IMAGE);
+    setDropArgs(HEIGHT_STEP_IMAGE, 1);
+    cl_event done = 0;
+
+    if(clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_global, NULL,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Height Image Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+
+    // rotate images
+    m_imageRotation = (m_imageRotation + 1) % IMAGE_COUNT;
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueBufferHeightStep(cl_event waitFor)
+{
+    cl_kernel kernel = launchKernel(HEIGHT_STEP);
+    setDropArgs(HEIGHT_STEP, 1);
+    cl_event done = 0;
+
+    if(clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_global, WorkGroupTuner::localSize(m_heightStepLocal),
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Height Step Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+
+    // swap buffers, unless nothing was launched
+    if(done != 0)
+    {
+        m_pingpong = !m_pingpong;
+    }
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueFusedStep(cl_event waitFor)
+{
+    // compute_fused_step reads buffers, with the image storage the two separate passes do the step
+    if(m_useImages)
+    {
+        return enqueueFiniteDifferenceScheme(enqueueVertexDisplacement(waitFor));
+    }
+
+    cl_kernel kernel = launchKernel(FUSED_STEP);
+    setDropArgs(FUSED_STEP, 1);
+    cl_event done = 0;
+
+    if(clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_tileGlobal, m_tileLocal,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Fused Step Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+
+    // swap buffers
+    m_pingpong = !m_pingpong;
+    return done;
+}
+
+cl_event OpenCLWaveSolver::enqueueMultiStep(unsigned int steps, cl_event waitFor)
+{
+    if(!m_useMultiStep)
+    {
+        std::cerr << "The tiles of the multi step kernel don't fit the device\n";
+        releaseEvent(waitFor);
+        return 0;
+    }
+
+    cl_kernel kernel = launchKernel(MULTI_STEP);
+    setDropArgs(MULTI_STEP, steps);
+    cl_event done = 0;
+
+    // the tiles grow with the steps, which only change for the last launch of a frame
+    if(m_boundSteps[state()] != steps)
+    {
+        int stepCount = static_cast<int>(steps);
+        size_t tileSize = GPUWaves::multiStepTileSize(m_tileLocal, steps);
+        clSetKernelArg(kernel, 9, sizeof(int), &stepCount);
+        clSetKernelArg(kernel, 14, tileSize, NULL);
+        clSetKernelArg(kernel, 15, tileSize, NULL);
+        m_boundSteps[state()] = steps;
+    }
+
+    if(clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, m_tileGlobal, m_tileLocal,
+                              waitFor ? 1 : 0, waitFor ? &waitFor : NULL, &done) != CL_SUCCESS)
+    {
+        std::cerr << "Multi Step Kernel Execution failed\n";
+    }
+    releaseEvent(waitFor);
+
+    // the new time levels keep their ping/pong roles in the other pair, a failed launch left them in place
+    if(done != 0)
+    {
+        m_heightPair = 1 - m_heightPair;
+    }
+    return done;
+}
+
+DisturbanceQueue& OpenCLWaveSolver::disturbances()
+{
+    return m_disturbances;
+}
+
+bool OpenCLWaveSolver::readHeights(float* heights)
+{
+    // half heights are read into a staging copy first
+    const unsigned int count = static_cast<unsigned int>(m_global[0] * m_global[1]);
+    std::vector<cl_half> halfHeights(m_halfHeights ? count : 0);
+    void* destination = m_halfHeights ? (void*)&halfHeights[0] : (void*)heights;
+
+    bool success = false;
+    if(m_useImages)
+    {
+        const size_t origin[] = {0, 0, 0};
+        const size_t region[] = {m_global[0], m_global[1], 1};
+        releaseEvent(enqueueGLObjects(true, m_glHeightTextures ? m_heightImages : NULL, IMAGE_COUNT, 0));
+        success = clEnqueueReadImage(m_queue, m_heightImages[currentHeightTexture()], CL_TRUE, origin, region,
+                                     0, 0, destination, 0, NULL, NULL) == CL_SUCCESS;
+        releaseEvent(enqueueGLObjects(false, m_glHeightTextures ? m_heightImages : NULL, IMAGE_COUNT, 0));
+    }
+    else
+    {
+        cl_mem curr = currHeights(state());
+        success = clEnqueueReadBuffer(m_queue, curr, CL_TRUE, 0, count * heightSize(),
+                                      destination, 0, NULL, NULL) == CL_SUCCESS;
+    }
+
+    for(unsigned int i = 0; i < halfHeights.size() && success; ++i)
+    {
+        heights[i] = HalfFloat::toFloat(halfHeights[i]);
+    }
+    return success;
+}
+
+void OpenCLWaveSolver::setHalfHeights(bool enabled)
+{
+    m_halfHeights = enabled;
+}
+
+bool OpenCLWaveSolver::halfHeights() const
+{
+    return m_halfHeights;
+}
+
+bool OpenCLWaveSolver::setLocalTiling(bool enabled)
+{
+    if(enabled && !tileFits(VERTEX_DISPLACEMENT_LOCAL))
+    {
+        std::cerr << "The local memory tiles don't fit the vertex displacement kernel on this device\n";
+        return false;
+    }
+    m_useLocalTiling = enabled;
+    return true;
+}
+
+bool OpenCLWaveSolver::localTiling() const
+{
+    return m_useLocalTiling;
+}
+
+bool OpenCLWaveSolver::setFusedKernel(bool enabled)
+{
+    if(enabled && !tileFits(FUSED_STEP))
+    {
+        std::cerr << "The local memory tiles don't fit the fused kernel on this device\n";
+        return false;
+    }
+    m_useFusedKernel = enabled;
+    return true;
+}
+
+bool OpenCLWaveSolver::fusedKernel() const
+{
+    return m_useFusedKernel;
+}
+
+void OpenCLWaveSolver::setStepsPerLaunch(unsigned int steps)
+{
+    m_stepsPerLaunch = m_useMultiStep ? std::max(steps, 1u) : 1;
+}
+
+unsigned int OpenCLWaveSolver::stepsPerLaunch() const
+{
+    return m_stepsPerLaunch;
+}
+
+void OpenCLWaveSolver::setBindPerLaunch(bool enabled)
+{
+    m_bindPerLaunch = enabled;
+}
+
+bool OpenCLWaveSolver::bindPerLaunch() const
+{
+    return m_bindPerLaunch;
+}
+
+cl_platform_id OpenCLWaveSolver::platform() const
+{
+    return m_platform;
+}
+
+cl_device_id OpenCLWaveSolver::device() const
+{
+    return m_device;
+}
+
+cl_context OpenCLWaveSolver::context() const
+{
+    return m_context;
+}
+
+cl_command_queue OpenCLWaveSolver::queue() const
+{
+    return m_queue;
+}
+
+cl_mem OpenCLWaveSolver::positionBuffer() const
+{
+    return m_positionBuffer;
+}
+
+cl_mem OpenCLWaveSolver::normalBuffer() const
+{
+    return m_normalBuffer;
+}
+
+cl_mem OpenCLWaveSolver::tangentBuffer() const
+{
+    return m_tangentBuffer;
+}
+
+cl_mem OpenCLWaveSolver::heightOutputBuffer() const
+{
+    return m_heightOutputBuffer;
+}
+
+void OpenCLWaveSolver::releaseEvent(cl_event event)
+{
+    if(event != 0)
+    {
+        clReleaseEvent(event);
+    }
+}
+
+void OpenCLWaveSolver::releaseOutputs()
+{
+    cl_mem* outputs[] = {&m_positionBuffer, &m_normalBuffer, &m_tangentBuffer};
+    for(int i = 0; i < 3; ++i)
+    {
+        if(*outputs[i] != 0)
+        {
+            clReleaseMemObject(*outputs[i]);
+            *outputs[i] = 0;
+        }
+    }
+    m_glBuffers = false;
+}
+
+void OpenCLWaveSolver::releaseHeightOutput()
+{
+    if(m_heightOutputBuffer != 0)
+    {
+        clReleaseMemObject(m_heightOutputBuffer);
+        m_heightOutputBuffer = 0;
+    }
+    m_glHeightBuffer = false;
+}
+
+void OpenCLWaveSolver::release()
+{
+    if(m_queue != 0)
+    {
+        clFinish(m_queue);
+        clReleaseCommandQueue(m_queue);
+        m_queue = 0;
+    }
+    releaseEvent(m_dropsUploaded);
+    m_dropsUploaded = 0;
+
+    for(int k = 0; k < STEP_KERNEL_COUNT; ++k)
+    {
+        for(int s = 0; s < STATE_COUNT; ++s)
+        {
+            if(m_stepKernels[k][s] != 0)
+            {
+                clReleaseKernel(m_stepKernels[k][s]);
+                m_stepKernels[k][s] = 0;
+            }
+        }
+    }
+
+    cl_kernel* kernels[] = {&m_gridInitKernel, &m_imageGridInitKernel};
+    for(int i = 0; i < 2; ++i)
+    {
+        if(*kernels[i] != 0)
+        {
+            clReleaseKernel(*kernels[i]);
+            *kernels[i] = 0;
+        }
+    }
+
+    if(m_program != 0)
+    {
+        clReleaseProgram(m_program);
+        m_program = 0;
+    }
+
+    // the GL objects may only be deleted after these references are gone
+    releaseOutputs();
+    releaseHeightOutput();
+    releaseHeightImages();
+    cl_mem* buffers[] = {&m_heights[0], &m_heights[1], &m_heights[2], &m_heights[3], &m_dropBuffer};
+    for(int i = 0; i < 5; ++i)
+    {
+        if(*buffers[i] != 0)
+        {
+            clReleaseMemObject(*buffers[i]);
+            *buffers[i] = 0;
+        }
+    }
+
+    if(m_context != 0)
+    {
+        clReleaseContext(m_context);
+        m_context = 0;
+    }
+    m_heightPair = 0;
+    m_pingpong = true;
+    m_imageSupport = false;
+    m_useImages = false;
+    m_heightOutput = false;
+}
+
+void OpenCLWaveSolver::releaseHeightImages()
+{
+    for(int i = 0; i < IMAGE_COUNT; ++i)
+    {
+        if(m_heightImages[i] != 0)
+        {
+            clReleaseMemObject(m_heightImages[i]);
+            m_heightImages[i] = 0;
+        }
+    }
+    m_imageRotation = 0;
+    m_glHeightTextures = false;
+}
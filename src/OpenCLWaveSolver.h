@@ -0,0 +1,318 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef OPENCL_WAVE_SOLVER_H
+#define OPENCL_WAVE_SOLVER_H
+
+// own
+#include "GpuWaves.h"
+#include "DisturbanceQueue.h"
+
+// std
+#include <string>
+#include <vector>
+
+// ocl
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+
+/**
+*   @brief OpenCL wave solver that owns its context, queue, program and buffers.
+*
+*   The solver runs without any window or GL context. Its outputs (positions, normals and
+*   tangents) are plain device buffers unless GL vertex buffers are attached, which needs a
+*   context created with the GL sharing properties. Attached outputs have to be acquired
+*   around the commands writing them with enqueueAcquireOutputs and enqueueReleaseOutputs.
+*
+*   The enqueue functions consume the event they wait for and return the event of their command,
+*   so a frame can be chained without host synchronization.
+*
+*   Drops pushed to disturbances() and its rain are added by the kernels of the next time step.
+*/
+class OpenCLWaveSolver
+{
+public:
+    OpenCLWaveSolver();
+    ~OpenCLWaveSolver();
+
+    /**
+    *   @brief Creates the context, queue, program, kernels and buffers for the grid of waves.
+    *
+    *   contextProperties are passed to clCreateContext, NULL creates a plain context on the
+    *   platform of the device. Returns false on failure, the reason is printed to std::cerr.
+    */
+    bool init(cl_device_id device, const GPUWaves& waves, const std::string& programSource,
+              const cl_context_properties* contextProperties = NULL);
+
+    // releases all OpenCL objects, GL buffers attached before may be deleted afterwards
+    void release();
+
+    /**
+    *   @brief Stores the heights as half (fp16) values, the kernels still compute in float.
+    *
+    *   Builds the program with -D HALF_HEIGHTS, so it takes effect with the next init().
+    *   Height images and attached GL height textures become CL_HALF_FLOAT.
+    */
+    void setHalfHeights(bool enabled);
+    bool halfHeights() const;
+
+    /**
+    *   @brief Replaces the output buffers by shared GL vertex buffers.
+    */
+    bool attachGLBuffers(cl_GLuint positionVBO, cl_GLuint normalVBO, cl_GLuint tangentVBO);
+    bool hasGLBuffers() const;
+
+    /**
+    *   @brief Stores the heights in three rotating images (CL_R, CL_FLOAT) read through the
+    *   texture cache instead of buffers.
+    *
+    *   The current heights move to the other storage. Returns false if the device can't hold
+    *   such images. The image path has no local tiling, fused or multi-step kernels. The images are
+    *   allocated here and released again when the storage is turned off, attached GL
+    *   textures are kept.
+    */
+    bool setImageStorage(bool enabled);
+    bool imageStorage() const;
+    bool imageStorageSupported() const;
+
+    /**
+    *   @brief Replaces the height images by three GL_TEXTURE_2D textures of the grid size with
+    *   a single float channel, so a renderer can sample the heights directly.
+    *
+    *   The textures are acquired and released with the outputs while the image storage is
+    *   used, currentHeightTexture() is then the index of the one holding the current heights.
+    */
+    bool attachGLHeightTextures(const cl_GLuint textures[3]);
+    bool hasGLHeightTextures() const;
+    unsigned int currentHeightTexture() const;
+
+    // true while the attached GL textures hold the heights, the height output is then left unwritten
+    bool heightTexturesCurrent() const;
+
+    /**
+    *   @brief Makes the current heights the only output of a frame.
+    *
+    *   enqueueSteps then runs height-only steps and copies the current heights into the height
+    *   output, from which a renderer rebuilds positions and normals. This skips the finite
+    *   difference kernel and writes heightSize() bytes per vertex instead of the 48 bytes of
+    *   positions, normals and tangents. The copy is skipped while heightTexturesCurrent().
+    *   Without an attached GL buffer the height output is
+    *   allocated here and released again when turned off, returns false if that fails.
+    */
+    bool setHeightOutput(bool enabled);
+    bool heightOutput() const;
+
+    // replaces the height output by a shared GL buffer of rows*cols heights, e.g. of a texture buffer
+    bool attachGLHeightBuffer(cl_GLuint heightBuffer);
+    bool hasGLHeightBuffer() const;
+
+    // no-ops returning waitFor without attached GL buffers or textures
+    cl_event enqueueAcquireOutputs(cl_event waitFor);
+    cl_event enqueueReleaseOutputs(cl_event waitFor);
+
+    // writes the outputs of the current heights, e.g. before the first frame
+    cl_event enqueueInitializeOutputs(cl_event waitFor);
+    // copies the current heights into the height output
+    cl_event enqueueHeightOutput(cl_event waitFor);
+    // queues a drop of radius 1 at row i and column j for the next step, like disturbances().push
+    cl_event enqueueDisturbGrid(unsigned int i, unsigned int j, float magnitude, cl_event waitFor);
+
+    // drops for the next time step, no launch of their own
+    DisturbanceQueue& disturbances();
+
+    // advances steps time steps, only the last one writes the outputs
+    cl_event enqueueSteps(unsigned int steps, cl_event waitFor);
+
+    // height-only time steps with compute_multi_step, stepsPerLaunch() per launch. One
+    // compute_height_step launch per step if its tiles don't fit the device, or one
+    // compute_height_image launch per step with the image storage.
+    cl_event enqueueHeightSteps(unsigned int steps, cl_event waitFor);
+
+    cl_event enqueueVertexDisplacement(cl_event waitFor);
+    cl_event enqueueFiniteDifferenceScheme(cl_event waitFor);
+    // compute_fused_step on the buffers, the vertex displacement and finite difference passes with the image storage
+    cl_event enqueueFusedStep(cl_event waitFor);
+    // returns 0 without a launch if the tiles of compute_multi_step don't fit the device
+    cl_event enqueueMultiStep(unsigned int steps, cl_event waitFor);
+
+    // blocking copy of the current heights into rows*cols floats, converted from half if needed
+    bool readHeights(float* heights);
+
+    // kernel selection, the defaults depend on the device. Tiling and fusing can't be
+    // switched on if the tile doesn't fit the kernel, the reason is printed to std::cerr.
+    bool setLocalTiling(bool enabled);
+    bool localTiling() const;
+    bool setFusedKernel(bool enabled);
+    bool fusedKernel() const;
+    void setStepsPerLaunch(unsigned int steps);
+    unsigned int stepsPerLaunch() const;
+
+    // sets all arguments of a kernel before every launch instead of binding them once,
+    // only meant to measure the launch overhead
+    void setBindPerLaunch(bool enabled);
+    bool bindPerLaunch() const;
+
+    cl_platform_id platform() const;
+    cl_device_id device() const;
+    cl_context context() const;
+    cl_command_queue queue() const;
+
+    cl_mem positionBuffer() const;
+    cl_mem normalBuffer() const;
+    cl_mem tangentBuffer() const;
+    cl_mem heightOutputBuffer() const;
+
+    static void releaseEvent(cl_event event);
+
+private:
+    OpenCLWaveSolver(const OpenCLWaveSolver&);
+    OpenCLWaveSolver& operator=(const OpenCLWaveSolver&);
+
+    // kernels with one object per state of the height buffers
+    enum StepKernel
+    {
+        VERTEX_DISPLACEMENT, VERTEX_DISPLACEMENT_LOCAL, FINITE_DIFFERENCE_SCHEME, FUSED_STEP, MULTI_STEP,
+        HEIGHT_STEP, VERTEX_DISPLACEMENT_IMAGE, HEIGHT_STEP_IMAGE, FINITE_DIFFERENCE_SCHEME_IMAGE, STEP_KERNEL_COUNT
+    };
+
+    // The ping/pong order flips with every single step and compute_multi_step moves the
+    // state to the other pair of height buffers, state() = 2 * pair + ping/pong order.
+    // The image kernels use the rotation of the three height images as their state.
+    enum
+    {
+        STATE_COUNT = 4,
+        IMAGE_COUNT = 3
+    };
+
+    cl_kernel createKernel(const char* name);
+
+    // bytes of one stored height
+    size_t heightSize() const;
+
+    unsigned int state() const;
+    unsigned int kernelState(StepKernel kernel) const;
+    cl_mem prevHeights(unsigned int state) const;
+    cl_mem currHeights(unsigned int state) const;
+
+    // whether the device supports single channel images of the height format
+    bool heightImageFormatSupported() const;
+    bool createHeightImages();
+    cl_event enqueueImageHeightStep(cl_event waitFor);
+    cl_event enqueueBufferHeightStep(cl_event waitFor);
+
+    // whether the work group and local memory of a tiled kernel stay within the limits of
+    // the kernel object and the device
+    bool tileFits(StepKernel kernel);
+
+    // shrinks the tile shared by the tiled kernels until it fits all of them
+    void fitTileToKernels();
+    void rebindAllKernelArgs();
+    void releaseHeightImages();
+
+    // the attached GL objects written by the current output mode
+    std::vector<cl_mem> glOutputs() const;
+
+    // acquires or releases count GL objects, a no-op returning waitFor if objects is NULL
+    cl_event enqueueGLObjects(bool acquire, const cl_mem* objects, cl_uint count, cl_event waitFor);
+
+    // binds all arguments that are the same for every launch of the kernel object of a state
+    void bindKernelArgs(StepKernel kernel, unsigned int state);
+    // returns the kernel object of the current state for the next launch
+    cl_kernel launchKernel(StepKernel kernel);
+
+    // uploads the queued drops and sets the drop count and rain of a launch advancing steps steps,
+    // the kernel object keeps them while no drops are queued and it doesn't rain
+    void setDropArgs(StepKernel kernel, unsigned int steps);
+    void tuneWorkGroups();
+    void releaseOutputs();
+    void releaseHeightOutput();
+
+    cl_platform_id m_platform;
+    cl_device_id m_device;
+    cl_context m_context;
+    cl_command_queue m_queue;
+    cl_program m_program;
+
+    cl_kernel m_stepKernels[STEP_KERNEL_COUNT][STATE_COUNT];
+    cl_kernel m_gridInitKernel;
+    cl_kernel m_imageGridInitKernel;
+
+    cl_mem m_positionBuffer;
+    cl_mem m_normalBuffer;
+    cl_mem m_tangentBuffer;
+    bool m_glBuffers;
+
+    // holds a copy of the current heights after each frame while m_heightOutput is set
+    cl_mem m_heightOutputBuffer;
+    bool m_glHeightBuffer;
+    bool m_heightOutput;
+
+    // two pairs of ping and pong, compute_multi_step writes the new time levels to the other pair
+    cl_mem m_heights[4];
+    unsigned int m_heightPair;
+    bool m_pingpong;
+
+    // prev, curr and next heights are m_heightImages[rotation + 0, 1, 2 mod 3]
+    cl_mem m_heightImages[IMAGE_COUNT];
+    unsigned int m_imageRotation;
+    bool m_imageSupport;
+    bool m_useImages;
+    bool m_glHeightTextures;
+    bool m_halfHeights;
+
+    // whether a kernel object holds drops or rain of its last launch, and the steps
+    // bound to the compute_multi_step objects (0 if none are bound)
+    bool m_dropArgsBound[STEP_KERNEL_COUNT][STATE_COUNT];
+    unsigned int m_boundSteps[STATE_COUNT];
+    bool m_bindPerLaunch;
+
+    // drops of the next launch, the staging copy is read by the non-blocking upload
+    DisturbanceQueue m_disturbances;
+    std::vector<Drop> m_dropStaging;
+    cl_mem m_dropBuffer;
+    cl_event m_dropsUploaded;
+
+    int m_gridWidth;
+    int m_gridHeight;
+    float m_k1;
+    float m_k2;
+    float m_k3;
+    float m_spatialStep;
+
+    size_t m_global[2];
+
+    // tuned work groups of the untiled kernels, {0, 0} leaves the choice to the driver
+    size_t m_displacementLocal[2];
+    size_t m_finiteDifferenceLocal[2];
+    size_t m_heightStepLocal[2];
+
+    // work group and padded global size of the local memory tiled kernels
+    size_t m_tileLocal[2];
+    size_t m_tileGlobal[2];
+    bool m_useLocalTiling;
+    bool m_useFusedKernel;
+    bool m_useMultiStep;
+    unsigned int m_stepsPerLaunch;
+};
+
+#endif // OPENCL_WAVE_SOLVER_H
@@ -0,0 +1,231 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "ProgramCache.h"
+
+// std
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+// 64 bit FNV-1a
+static unsigned long long fnvHash(const std::string& data, unsigned long long hash = 14695981039346656037ULL)
+{
+    for(std::string::size_type i = 0; i < data.size(); ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string deviceString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, NULL, &size);
+    std::string value(size, '\0');
+    if(size > 0)
+    {
+        clGetDeviceInfo(device, param, size, &value[0], NULL);
+    }
+    return value;
+}
+
+static void printBuildLog(cl_program program, cl_device_id device)
+{
+    std::string log(2048, '\0');
+    size_t size = 0;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log.size(), &log[0], &size);
+    std::cerr << log.c_str() << std::endl;
+}
+
+ProgramCache::ProgramCache(const std::string& directory)
+    : m_directory(directory),
+      m_lastBuildCached(false),
+      m_lastBuildSeconds(0.0)
+{
+}
+
+std::string ProgramCache::cacheFile(cl_device_id device, const std::string& source, const std::string& options) const
+{
+    // the separators keep e.g. source "ab" + options "c" apart from "a" + "bc"
+    unsigned long long hash = fnvHash(source);
+    hash = fnvHash(std::string(1, '\0') + options, hash);
+    hash = fnvHash(std::string(1, '\0') + deviceString(device, CL_DEVICE_NAME), hash);
+    hash = fnvHash(std::string(1, '\0') + deviceString(device, CL_DRIVER_VERSION), hash);
+
+    std::stringstream sstream;
+    sstream << m_directory << "/program-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return sstream.str();
+}
+
+cl_program ProgramCache::build(cl_context context, cl_device_id device, const std::string& source, const std::string& options)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string path = cacheFile(device, source, options);
+
+    cl_program program = buildFromBinary(context, device, path, options);
+    m_lastBuildCached = program != 0;
+    if(program == 0)
+    {
+        program = buildFromSource(context, device, source, options);
+        if(program != 0)
+        {
+            storeBinary(program, path);
+        }
+    }
+
+    m_lastBuildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(program != 0)
+    {
+        std::cout << "OpenCL program " << (m_lastBuildCached ? "loaded from " : "built from source and cached to ")
+                  << path << " in " << 1000.0 * m_lastBuildSeconds << " ms\n";
+    }
+    return program;
+}
+
+bool ProgramCache::lastBuildCached() const
+{
+    return m_lastBuildCached;
+}
+
+double ProgramCache::lastBuildSeconds() const
+{
+    return m_lastBuildSeconds;
+}
+
+cl_program ProgramCache::buildFromBinary(cl_context context, cl_device_id device, const std::string& path, const std::string& options) const
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if(!file)
+    {
+        return 0;
+    }
+
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(binary.empty())
+    {
+        return 0;
+    }
+
+    const unsigned char* data = &binary[0];
+    const size_t size = binary.size();
+    cl_int binaryStatus = CL_SUCCESS;
+    cl_int err = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, &data, &binaryStatus, &err);
+    if(err != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        std::cerr << "Cached OpenCL program " << path << " was rejected, rebuilding from source\n";
+        if(program != 0)
+        {
+            clReleaseProgram(program);
+        }
+        return 0;
+    }
+
+    // binaries still need to be built, but skip the compiler front end
+    if(clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL) != CL_SUCCESS)
+    {
+        std::cerr << "Failed to build cached OpenCL program " << path << ", rebuilding from source\n";
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+cl_program ProgramCache::buildFromSource(cl_context context, cl_device_id device, const std::string& source, const std::string& options) const
+{
+    const char* data = source.c_str();
+    const size_t size = source.length();
+    cl_int err = CL_SUCCESS;
+    cl_program program = clCreateProgramWithSource(context, 1, &data, &size, &err);
+    if(err != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to create program from source!" << std::endl;
+        return 0;
+    }
+
+    if(clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL) != CL_SUCCESS)
+    {
+        std::cerr << "Error: Failed to build program executable!" << std::endl;
+        printBuildLog(program, device);
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void ProgramCache::storeBinary(cl_program program, const std::string& path) const
+{
+    // the program was built for a single device
+    size_t size = 0;
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0)
+    {
+        return;
+    }
+
+    std::vector<unsigned char> binary(size);
+    unsigned char* data = &binary[0];
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL) != CL_SUCCESS)
+    {
+        return;
+    }
+
+    // other processes may load the cache concurrently, so they must never see a partial file
+    std::stringstream tmpPath;
+    tmpPath << path << "." << std::chrono::steady_clock::now().time_since_epoch().count() << ".tmp";
+
+    std::ofstream file(tmpPath.str().c_str(), std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "Failed to write OpenCL program cache " << path << "\n";
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(data), size);
+    file.close();
+
+    // a short write, e.g. on a full disk, must not end up under the valid key
+    if(!file.good())
+    {
+        std::cerr << "Failed to write OpenCL program cache " << path << "\n";
+        std::remove(tmpPath.str().c_str());
+        return;
+    }
+
+    // rename replaces an existing file atomically on POSIX, but fails on Windows
+    if(std::rename(tmpPath.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(path.c_str());
+        if(std::rename(tmpPath.str().c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmpPath.str().c_str());
+        }
+    }
+}
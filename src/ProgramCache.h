@@ -0,0 +1,68 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+// std
+#include <string>
+
+// ocl
+#include <CL/cl.h>
+
+/**
+*   @brief Builds OpenCL programs and keeps their binaries on disk.
+*
+*   A cache entry is keyed by a hash of the program source, the build options,
+*   the device name and the driver version. The first build of a program stores
+*   CL_PROGRAM_BINARIES, later builds load them with clCreateProgramWithBinary and
+*   fall back to a source build if the driver rejects the binary.
+*/
+class ProgramCache
+{
+public:
+    explicit ProgramCache(const std::string& directory = ".");
+
+    /**
+    *   @brief Returns the built program or 0 on failure, the build log is printed to std::cerr.
+    */
+    cl_program build(cl_context context, cl_device_id device, const std::string& source, const std::string& options = "");
+
+    // path of the cache file for a program
+    std::string cacheFile(cl_device_id device, const std::string& source, const std::string& options) const;
+
+    // whether the last build was loaded from the cache and how long it took
+    bool lastBuildCached() const;
+    double lastBuildSeconds() const;
+
+private:
+    cl_program buildFromBinary(cl_context context, cl_device_id device, const std::string& path, const std::string& options) const;
+    cl_program buildFromSource(cl_context context, cl_device_id device, const std::string& source, const std::string& options) const;
+    void storeBinary(cl_program program, const std::string& path) const;
+
+    std::string m_directory;
+    bool m_lastBuildCached;
+    double m_lastBuildSeconds;
+};
+
+#endif // PROGRAM_CACHE_H
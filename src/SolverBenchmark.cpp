@@ -0,0 +1,1268 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "SolverBenchmark.h"
+#include "CpuWaves.h"
+#include "GpuWaves.h"
+#include "StencilKernels.h"
+#include "OpenCLWaveSolver.h"
+#include "OpenCLDeviceSelector.h"
+#include "MultiDeviceWaveSolver.h"
+#include "HalfFloat.h"
+
+// std
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// Modelled memory traffic per cell and time step. The CPU solver streams the float
+// height planes prev (r/w) and curr (r) in the height pass and curr (r) plus the vec4
+// normal and tangent (w) in the normal pass.
+static const double CPU_BYTES_PER_CELL = (4.0 + 2.0 * 4.0) * sizeof(float);
+
+// the fused pass reads the new heights for the normals while they are still in cache
+static const double CPU_FUSED_BYTES_PER_CELL = (3.0 + 2.0 * 4.0) * sizeof(float);
+
+// stepN() only runs the height pass per step, so its runs are modelled with the
+// traffic of an unblocked height sweep. Temporally blocked runs show up as a higher
+// effective bandwidth.
+static const double CPU_HEIGHT_BYTES_PER_CELL = 3.0 * sizeof(float);
+
+// compute_vertex_displacement reads the float heights prev and curr, writes prev and the
+// float4 position buffer, compute_finite_difference_scheme reads curr and writes the float4
+// normal and tangent. The image variant moves the same amount, it writes a third image
+// instead of prev.
+static const double OCL_BYTES_PER_CELL = (4.0 + 3.0 * 4.0) * sizeof(float);
+
+// compute_multi_step only advances the heights, modelled like an unblocked height update
+static const double OCL_HEIGHT_BYTES_PER_CELL = 3.0 * sizeof(float);
+
+// compute_fused_step reads the heights of curr only once
+static const double OCL_FUSED_BYTES_PER_CELL = (3.0 + 3.0 * 4.0) * sizeof(float);
+
+// the height output runs a height-only step and copies the new heights for the renderer
+static const double OCL_HEIGHT_OUTPUT_BYTES_PER_CELL = (3.0 + 2.0) * sizeof(float);
+
+// The fp16 storage of the CPU solver moves three halves per height update. A step() also
+// decodes the new heights into a float plane that the normal pass reads.
+static const double CPU_HALF_BYTES_PER_CELL = 3.0 * sizeof(uint16_t) + (sizeof(uint16_t) + sizeof(float)) +
+                                              (1.0 + 2.0 * 4.0) * sizeof(float);
+static const double CPU_HALF_HEIGHT_BYTES_PER_CELL = 3.0 * sizeof(uint16_t);
+
+// the OpenCL kernels only load and store the heights as halves
+static double halfHeightBytesPerCell(double bytesPerCell, double heightsPerCell)
+{
+    return bytesPerCell - heightsPerCell * (sizeof(float) - sizeof(cl_half));
+}
+
+// steps after which --half-error compares the fp16 storage with the fp32 solvers
+static const unsigned int HALF_ERROR_STEPS[] = {100, 1000, 10000};
+
+// number of drops injected before every timed run
+static const int DROP_COUNT = 16;
+
+// grid size and steps of the launch overhead runs, small enough for the host to be the bottleneck
+static const unsigned int OVERHEAD_GRID_SIZE = 32;
+static const unsigned int OVERHEAD_STEPS = 5000;
+
+static double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<unsigned int> parseList(const char* arg)
+{
+    std::vector<unsigned int> values;
+    std::stringstream sstream(arg);
+    std::string item;
+    while(std::getline(sstream, item, ','))
+    {
+        unsigned int value = static_cast<unsigned int>(atoi(item.c_str()));
+        if(value > 0)
+        {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+static std::string deviceName(cl_device_id device)
+{
+    char name[256] = {0};
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    return std::string(name);
+}
+
+SolverBenchmark::SolverBenchmark(int argc, char** argv)
+    : m_argc(argc),
+      m_argv(argv),
+      m_validate(false),
+      m_launchOverhead(false),
+      m_halfError(false),
+      m_rain(0),
+      m_runCPU(true),
+      m_runOpenCL(true),
+      m_listDevices(false),
+      m_multiDevice(false),
+      m_subDevices(0),
+      m_format("csv"),
+      m_kernelPath("WaveSimulation.cl")
+{
+}
+
+SolverBenchmark::~SolverBenchmark()
+{
+    if(m_subDevices > 0)
+    {
+        for(unsigned int i = 0; i < m_slabDevices.size(); ++i)
+        {
+            clReleaseDevice(m_slabDevices[i]);
+        }
+    }
+}
+
+bool SolverBenchmark::init()
+{
+    if(!parseArguments())
+    {
+        printUsage();
+        return false;
+    }
+
+    // the stencil validation and the device list run no solver on a device
+    if(m_runOpenCL && !m_validate && !m_listDevices)
+    {
+        std::ifstream file(m_kernelPath.c_str());
+        if(!file)
+        {
+            std::cerr << "Failed to open kernel source " << m_kernelPath << ", skipping OpenCL runs\n";
+            m_runOpenCL = false;
+        }
+        else
+        {
+            m_programSource.assign(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+            queryOpenCLDevices();
+        }
+    }
+
+    return true;
+}
+
+bool SolverBenchmark::parseArguments()
+{
+    m_sizes.clear();
+    m_steps.clear();
+    m_threads.clear();
+    m_kernelSets.clear();
+    m_blockSteps.clear();
+    m_passModes.clear();
+    m_clVariants.clear();
+    m_clStepsPerLaunch.clear();
+    m_halfStorage.clear();
+
+    for(int i = 1; i < m_argc; ++i)
+    {
+        std::string arg(m_argv[i]);
+        const char* value = (i+1 < m_argc) ? m_argv[i+1] : 0;
+
+        if(arg == "--help" || arg == "-h")
+        {
+            return false;
+        }
+        else if(arg == "--validate")
+        {
+            m_validate = true;
+            continue;
+        }
+        else if(arg == "--launch-overhead")
+        {
+            m_launchOverhead = true;
+            continue;
+        }
+        else if(arg == "--half-error")
+        {
+            m_halfError = true;
+            continue;
+        }
+        else if(arg == "--list-devices")
+        {
+            m_listDevices = true;
+            continue;
+        }
+        else if(arg == "--fastest")
+        {
+            m_deviceSelector.setPickFastest(true);
+            continue;
+        }
+        else if(arg == "--multi-device")
+        {
+            m_multiDevice = true;
+            continue;
+        }
+        else if(value == 0)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        else if(arg == "--sizes")
+        {
+            m_sizes = parseList(value);
+        }
+        else if(arg == "--steps")
+        {
+            m_steps = parseList(value);
+        }
+        else if(arg == "--threads")
+        {
+            m_threads = parseList(value);
+        }
+        else if(arg == "--rain")
+        {
+            m_rain = static_cast<unsigned int>(atoi(value));
+        }
+        else if(arg == "--kernels")
+        {
+            std::stringstream sstream(value);
+            std::string name;
+            while(std::getline(sstream, name, ','))
+            {
+                const StencilKernelSet* kernels = StencilKernels::find(name);
+                if(kernels == 0)
+                {
+                    std::cerr << "Stencil kernels " << name << " are not available on this CPU\n";
+                    return false;
+                }
+                m_kernelSets.push_back(kernels);
+            }
+        }
+        else if(arg == "--blocking")
+        {
+            m_blockSteps = parseList(value);
+        }
+        else if(arg == "--passes")
+        {
+            std::stringstream sstream(value);
+            std::string mode;
+            while(std::getline(sstream, mode, ','))
+            {
+                if(mode == "two")
+                {
+                    m_passModes.push_back(CPUWaves::TWO_PASS);
+                }
+                else if(mode == "fused")
+                {
+                    m_passModes.push_back(CPUWaves::FUSED);
+                }
+                else
+                {
+                    std::cerr << "Unknown pass mode " << mode << "\n";
+                    return false;
+                }
+            }
+        }
+        else if(arg == "--storage")
+        {
+            std::stringstream sstream(value);
+            std::string storage;
+            while(std::getline(sstream, storage, ','))
+            {
+                if(storage != "fp32" && storage != "fp16")
+                {
+                    std::cerr << "Unknown height storage " << storage << "\n";
+                    return false;
+                }
+                m_halfStorage.push_back(storage == "fp16");
+            }
+        }
+        else if(arg == "--backend")
+        {
+            std::string backend(value);
+            m_runCPU    = backend == "cpu"    || backend == "all";
+            m_runOpenCL = backend == "opencl" || backend == "all";
+            if(!m_runCPU && !m_runOpenCL)
+            {
+                std::cerr << "Unknown backend " << backend << "\n";
+                return false;
+            }
+        }
+        else if(arg == "--cl-variants")
+        {
+            std::stringstream sstream(value);
+            std::string variant;
+            while(std::getline(sstream, variant, ','))
+            {
+                if(variant != "buffer" && variant != "local" && variant != "fused" && variant != "multi" && variant != "image" &&
+                   variant != "heights")
+                {
+                    std::cerr << "Unknown OpenCL variant " << variant << "\n";
+                    return false;
+                }
+                m_clVariants.push_back(variant);
+            }
+        }
+        else if(arg == "--cl-steps-per-launch")
+        {
+            m_clStepsPerLaunch = parseList(value);
+        }
+        else if(arg == "--platform")
+        {
+            m_deviceSelector.setPlatform(value);
+        }
+        else if(arg == "--device")
+        {
+            m_deviceSelector.setDevice(value);
+        }
+        else if(arg == "--device-type")
+        {
+            if(!m_deviceSelector.setDeviceType(value))
+            {
+                return false;
+            }
+        }
+        else if(arg == "--sub-devices")
+        {
+            m_subDevices = static_cast<unsigned int>(atoi(value));
+            if(m_subDevices < 2)
+            {
+                std::cerr << "--sub-devices needs at least 2 sub-devices\n";
+                return false;
+            }
+        }
+        else if(arg == "--format")
+        {
+            m_format = value;
+            if(m_format != "csv" && m_format != "json")
+            {
+                std::cerr << "Unknown format " << m_format << "\n";
+                return false;
+            }
+        }
+        else if(arg == "--output")
+        {
+            m_outputPath = value;
+        }
+        else if(arg == "--kernel")
+        {
+            m_kernelPath = value;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return false;
+        }
+        ++i;
+    }
+
+    if(m_sizes.empty())
+    {
+        m_sizes.push_back(256);
+        m_sizes.push_back(512);
+        m_sizes.push_back(1024);
+        m_sizes.push_back(2048);
+    }
+
+    if(m_steps.empty())
+    {
+        m_steps.push_back(100);
+    }
+
+    if(m_threads.empty())
+    {
+        m_threads.push_back(1);
+    }
+
+    if(m_kernelSets.empty())
+    {
+        m_kernelSets.push_back(&StencilKernels::best());
+    }
+
+    if(m_passModes.empty())
+    {
+        m_passModes.push_back(CPUWaves::FUSED);
+    }
+
+    if(m_clVariants.empty())
+    {
+        m_clVariants.push_back("buffer");
+        m_clVariants.push_back("local");
+        m_clVariants.push_back("fused");
+        m_clVariants.push_back("multi");
+        m_clVariants.push_back("image");
+        m_clVariants.push_back("heights");
+    }
+
+    if(m_clStepsPerLaunch.empty())
+    {
+        m_clStepsPerLaunch.push_back(0);
+    }
+
+    if(m_halfStorage.empty())
+    {
+        m_halfStorage.push_back(false);
+    }
+
+    return true;
+}
+
+void SolverBenchmark::printUsage() const
+{
+    std::cerr << "Usage: WaveSim-Bench [options]\n"
+              << "  --sizes n1,n2,...     square grid sizes to sweep (default 256,512,1024,2048)\n"
+              << "  --steps s1,s2,...     time steps per run (default 100)\n"
+              << "  --threads t1,t2,...   CPU solver thread counts to sweep (default 1)\n"
+              << "  --kernels k1,k2,...   CPU stencil kernels to sweep: scalar, sse2, avx2, avx512, neon (default best)\n"
+              << "  --blocking b1,b2,...  time CPUWaves::stepN() with b steps per temporally blocked pass,\n"
+              << "                        1 disables blocking (default: time single step() calls)\n"
+              << "  --passes p1,p2,...    CPU normal pass modes to sweep: two, fused (default fused)\n"
+              << "  --validate            check all stencil kernels against the scalar reference and exit\n"
+              << "  --launch-overhead     measure the host cost of enqueueing OpenCL steps and exit\n"
+              << "  --half-error          compare the fp16 height storage with fp32 over long runs and exit\n"
+              << "  --rain n              drops generated in every timed step (default 0)\n"
+              << "  --storage s1,s2       height storage to sweep: fp32, fp16 (default fp32)\n"
+              << "  --backend cpu|opencl|all\n"
+              << "  --cl-variants v1,...  OpenCL kernels to sweep: buffer, local, fused, multi,\n"
+              << "                        image, heights (default all)\n"
+              << "  --cl-steps-per-launch k1,k2,...\n"
+              << "                        time steps per launch of the multi variant (default per device)\n"
+              << "  --platform index|name run only OpenCL devices of this platform (default all)\n"
+              << "  --device index|name   run only this OpenCL device, the index counts the devices\n"
+              << "                        left by --platform and --device-type (default all)\n"
+              << "  --device-type gpu|cpu|accelerator|all\n"
+              << "  --fastest             run only the device that is fastest in a short calibration\n"
+              << "  --list-devices        print the OpenCL platforms and devices and exit\n"
+              << "  --multi-device        also split every grid into slabs over all matching devices\n"
+              << "  --sub-devices n       also split every grid over n sub-devices of the first matching device\n"
+              << "  --format csv|json     result format (default csv)\n"
+              << "  --output file         write results to file instead of stdout\n"
+              << "  --kernel file         OpenCL source (default WaveSimulation.cl)\n";
+}
+
+void SolverBenchmark::queryOpenCLDevices()
+{
+    m_devices = m_deviceSelector.matchingDevices();
+    if(m_devices.empty())
+    {
+        std::cerr << "No OpenCL device found, skipping OpenCL runs\n";
+        m_runOpenCL = false;
+        return;
+    }
+
+    for(unsigned int i = 0; i < m_devices.size(); ++i)
+    {
+        std::cerr << "OpenCL device " << i << ": " << deviceName(m_devices[i]) << "\n";
+    }
+
+    if(m_subDevices > 0)
+    {
+        m_slabDevices = MultiDeviceWaveSolver::createSubDevices(m_devices[0], m_subDevices);
+        if(m_slabDevices.empty())
+        {
+            m_subDevices = 0;
+        }
+    }
+    else if(m_multiDevice)
+    {
+        m_slabDevices = m_devices;
+    }
+
+    // the slab sizes follow a calibration that is shared by all grid sizes
+    for(unsigned int i = 0; i < m_slabDevices.size(); ++i)
+    {
+        m_slabWeights.push_back(OpenCLDeviceSelector::calibrate(m_slabDevices[i], m_programSource));
+        if(m_slabWeights.back() <= 0.0)
+        {
+            std::cerr << "Calibration failed on " << deviceName(m_slabDevices[i]) << ", skipping multi-device runs\n";
+            m_slabWeights.clear();
+            break;
+        }
+    }
+
+    // every matching device runs unless only the fastest one is wanted
+    if(m_deviceSelector.pickFastest())
+    {
+        cl_device_id fastest = m_deviceSelector.select(m_programSource);
+        m_devices.assign(1, fastest);
+        m_runOpenCL = fastest != 0;
+    }
+}
+
+int SolverBenchmark::run()
+{
+    if(m_validate)
+    {
+        return validateStencilKernels() ? 0 : 1;
+    }
+
+    if(m_listDevices)
+    {
+        OpenCLDeviceSelector::listDevices(std::cout);
+        return 0;
+    }
+
+    if(m_halfError)
+    {
+        reportHalfStorageError();
+        return 0;
+    }
+
+    if(m_launchOverhead)
+    {
+        for(unsigned int d = 0; d < m_devices.size() && m_runOpenCL; ++d)
+        {
+            benchmarkLaunchOverhead(m_devices[d]);
+        }
+        return 0;
+    }
+
+    for(unsigned int s = 0; s < m_sizes.size(); ++s)
+    {
+        for(unsigned int n = 0; n < m_steps.size(); ++n)
+        {
+            if(m_runCPU)
+            {
+                for(unsigned int k = 0; k < m_kernelSets.size(); ++k)
+                {
+                    for(unsigned int t = 0; t < m_threads.size(); ++t)
+                    {
+                        for(unsigned int p = 0; p < m_passModes.size(); ++p)
+                        {
+                            for(unsigned int h = 0; h < m_halfStorage.size(); ++h)
+                            {
+                                if(m_blockSteps.empty())
+                                {
+                                    benchmarkCPU(m_sizes[s], m_steps[n], m_threads[t], *m_kernelSets[k], 0,
+                                                 m_passModes[p], m_halfStorage[h]);
+                                }
+                                for(unsigned int b = 0; b < m_blockSteps.size(); ++b)
+                                {
+                                    benchmarkCPU(m_sizes[s], m_steps[n], m_threads[t], *m_kernelSets[k], m_blockSteps[b],
+                                                 m_passModes[p], m_halfStorage[h]);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            if(m_runOpenCL)
+            {
+                for(unsigned int d = 0; d < m_devices.size(); ++d)
+                {
+                    for(unsigned int v = 0; v < m_clVariants.size(); ++v)
+                    {
+                        for(unsigned int h = 0; h < m_halfStorage.size(); ++h)
+                        {
+                            if(m_clVariants[v] != "multi")
+                            {
+                                benchmarkOpenCL(m_devices[d], m_sizes[s], m_steps[n], m_clVariants[v], 0, m_halfStorage[h]);
+                                continue;
+                            }
+                            for(unsigned int k = 0; k < m_clStepsPerLaunch.size(); ++k)
+                            {
+                                benchmarkOpenCL(m_devices[d], m_sizes[s], m_steps[n], m_clVariants[v],
+                                                m_clStepsPerLaunch[k], m_halfStorage[h]);
+                            }
+                        }
+                    }
+                }
+
+                if(!m_slabWeights.empty())
+                {
+                    benchmarkMultiDevice(m_sizes[s], m_steps[n]);
+                }
+            }
+        }
+    }
+
+    printScaling();
+
+    std::ofstream file;
+    if(!m_outputPath.empty())
+    {
+        file.open(m_outputPath.c_str());
+        if(!file)
+        {
+            std::cerr << "Failed to open " << m_outputPath << " for writing\n";
+            return 1;
+        }
+    }
+    std::ostream& out = m_outputPath.empty() ? std::cout : file;
+
+    if(m_format == "json")
+    {
+        writeJSON(out);
+    }
+    else
+    {
+        writeCSV(out);
+    }
+
+    return 0;
+}
+
+void SolverBenchmark::benchmarkCPU(unsigned int size, unsigned int steps, unsigned int threads, const StencilKernelSet& kernels,
+                                   unsigned int blockSteps, CPUWaves::PassMode passMode, bool halfStorage)
+{
+    if(halfStorage && blockSteps > 1)
+    {
+        std::cerr << "cpu [" << kernels.name << "] temporal blocking is not available with fp16 storage, skipped\n";
+        return;
+    }
+
+    std::string variant = kernels.name;
+    if(passMode == CPUWaves::TWO_PASS)
+    {
+        variant += "-2pass";
+    }
+    if(blockSteps == 1)
+    {
+        variant += "-naive";
+    }
+    else if(blockSteps > 1)
+    {
+        std::stringstream sstream;
+        sstream << variant << "-tb" << blockSteps;
+        variant = sstream.str();
+    }
+    if(m_rain > 0)
+    {
+        std::stringstream sstream;
+        sstream << variant << "-rain" << m_rain;
+        variant = sstream.str();
+    }
+    if(halfStorage)
+    {
+        variant += "-fp16";
+    }
+
+    std::cerr << "cpu [" << variant << "] " << size << "x" << size << ", " << steps << " steps, " << threads << " threads\n";
+
+    CPUWaves waves;
+    waves.init(size, size, 1.0f, 0.03f, 3.25f, 0.4f);
+    waves.setThreadCount(threads);
+    waves.setStencilKernels(kernels);
+    waves.setTemporalBlocking(blockSteps);
+    waves.setPassMode(passMode);
+    waves.setHalfStorage(halfStorage);
+
+    // the drops are applied by the warm up step
+    srand(0);
+    for(int d = 0; d < DROP_COUNT; ++d)
+    {
+        waves.disturbances().push(5 + rand() % (size-10), 5 + rand() % (size-10), 1.5f);
+    }
+
+    // warm up caches and page in all buffers
+    waves.step();
+    waves.disturbances().setRain(m_rain);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(blockSteps == 0)
+    {
+        for(unsigned int n = 0; n < steps; ++n)
+        {
+            waves.step();
+        }
+    }
+    else
+    {
+        waves.stepN(steps);
+    }
+
+    Result result;
+    result.backend = "cpu";
+    result.device = "host";
+    result.variant = variant;
+    result.rows = size;
+    result.cols = size;
+    result.steps = steps;
+    result.threads = waves.threadCount();
+    result.seconds = secondsSince(start);
+    if(blockSteps != 0)
+    {
+        result.bytesPerCell = halfStorage ? CPU_HALF_HEIGHT_BYTES_PER_CELL : CPU_HEIGHT_BYTES_PER_CELL;
+    }
+    else if(halfStorage)
+    {
+        result.bytesPerCell = CPU_HALF_BYTES_PER_CELL;
+    }
+    else
+    {
+        result.bytesPerCell = (passMode == CPUWaves::FUSED) ? CPU_FUSED_BYTES_PER_CELL : CPU_BYTES_PER_CELL;
+    }
+    m_results.push_back(result);
+}
+
+void SolverBenchmark::benchmarkOpenCL(cl_device_id device, unsigned int size, unsigned int steps,
+                                      const std::string& variant, unsigned int stepsPerLaunch, bool halfHeights)
+{
+    std::string name = deviceName(device);
+    const bool localTiling = variant != "buffer" && variant != "image";
+    const bool fused = variant == "fused";
+    const bool multi = variant == "multi";
+    const bool image = variant == "image";
+    const bool heights = variant == "heights";
+
+    GPUWaves waves;
+    waves.init(size, size, 1.0f, 0.03f, 3.25f, 0.4f);
+
+    // the same solver the application runs, with plain device buffers as outputs
+    OpenCLWaveSolver solver;
+    solver.setHalfHeights(halfHeights);
+    if(!solver.init(device, waves, m_programSource))
+    {
+        std::cerr << "Failed to set up the OpenCL solver on " << name << "\n";
+        return;
+    }
+
+    std::string variantName = variant;
+    if(multi)
+    {
+        if(stepsPerLaunch == 0)
+        {
+            stepsPerLaunch = solver.stepsPerLaunch();
+        }
+        solver.setStepsPerLaunch(stepsPerLaunch);
+        std::stringstream sstream;
+        sstream << variant << stepsPerLaunch;
+        variantName = sstream.str();
+    }
+    if(m_rain > 0)
+    {
+        std::stringstream sstream;
+        sstream << variantName << "-rain" << m_rain;
+        variantName = sstream.str();
+    }
+    if(halfHeights)
+    {
+        variantName += "-fp16";
+    }
+
+    std::cerr << "opencl [" << name << ", " << variantName << "] " << size << "x" << size << ", " << steps << " steps\n";
+    if(localTiling && !solver.localTiling())
+    {
+        std::cerr << "  no dedicated local memory, the application would use the buffer variant here\n";
+    }
+    if(!solver.setLocalTiling(localTiling) || !solver.setFusedKernel(fused))
+    {
+        return;
+    }
+    if(!solver.setHeightOutput(heights) || (image && !solver.setImageStorage(true)))
+    {
+        return;
+    }
+
+    // the drops are applied by the warm up launch
+    srand(0);
+    for(int d = 0; d < DROP_COUNT; ++d)
+    {
+        unsigned int i = 5 + rand() % (size-10);
+        unsigned int j = 5 + rand() % (size-10);
+        solver.disturbances().push(i, j, 1.5f);
+    }
+
+    // one warm up launch is executed before the timed ones
+    const unsigned int launches = multi ? (steps + stepsPerLaunch - 1) / stepsPerLaunch : steps;
+    bool failed = false;
+    std::chrono::steady_clock::time_point start;
+    for(unsigned int n = 0; n <= launches && !failed; ++n)
+    {
+        if(n == 1)
+        {
+            clFinish(solver.queue());
+            solver.disturbances().setRain(m_rain);
+            start = std::chrono::steady_clock::now();
+        }
+
+        // a failed launch returns no event
+        cl_event event = 0;
+        if(multi)
+        {
+            unsigned int launchSteps = (n == 0) ? stepsPerLaunch : std::min(stepsPerLaunch, steps - (n-1)*stepsPerLaunch);
+            event = solver.enqueueMultiStep(launchSteps, 0);
+        }
+        else
+        {
+            event = solver.enqueueSteps(1, 0);
+        }
+
+        failed = event == 0;
+        OpenCLWaveSolver::releaseEvent(event);
+    }
+    clFinish(solver.queue());
+
+    if(!failed)
+    {
+        Result result;
+        result.backend = "opencl";
+        result.device = name;
+        result.variant = variantName;
+        result.rows = size;
+        result.cols = size;
+        result.steps = steps;
+        result.threads = 0;
+        result.seconds = secondsSince(start);
+        result.bytesPerCell = OCL_BYTES_PER_CELL;
+        double heightsPerCell = 4.0;
+        if(fused)
+        {
+            result.bytesPerCell = OCL_FUSED_BYTES_PER_CELL;
+            heightsPerCell = 3.0;
+        }
+        else if(multi)
+        {
+            result.bytesPerCell = OCL_HEIGHT_BYTES_PER_CELL;
+            heightsPerCell = 3.0;
+        }
+        else if(heights)
+        {
+            result.bytesPerCell = OCL_HEIGHT_OUTPUT_BYTES_PER_CELL;
+            heightsPerCell = 5.0;
+        }
+        if(halfHeights)
+        {
+            result.bytesPerCell = halfHeightBytesPerCell(result.bytesPerCell, heightsPerCell);
+        }
+        m_results.push_back(result);
+    }
+}
+
+void SolverBenchmark::benchmarkMultiDevice(unsigned int size, unsigned int steps)
+{
+    std::string name;
+    for(unsigned int d = 0; d < m_slabDevices.size(); ++d)
+    {
+        name += (d == 0 ? "" : " + ") + deviceName(m_slabDevices[d]);
+    }
+
+    std::stringstream sstream;
+    sstream << "slabs" << m_slabDevices.size();
+    std::string variantName = sstream.str();
+    std::cerr << "opencl-multi [" << variantName << "] " << size << "x" << size << ", " << steps << " steps\n";
+
+    // both solvers start from the same disturbed heights, the drops are set on the host
+    // in the shape of disturb_slab
+    GPUWaves waves;
+    waves.init(size, size, 1.0f, 0.03f, 3.25f, 0.4f);
+    float* initialHeights = waves.getHeights();
+    srand(0);
+    for(int d = 0; d < DROP_COUNT; ++d)
+    {
+        unsigned int i = 5 + rand() % (size-10);
+        unsigned int j = 5 + rand() % (size-10);
+        initialHeights[i*size+j] += 1.5f;
+        initialHeights[i*size+j+1] += 0.75f;
+        initialHeights[i*size+j-1] += 0.75f;
+        initialHeights[(i+1)*size+j] += 0.75f;
+        initialHeights[(i-1)*size+j] += 0.75f;
+    }
+
+    MultiDeviceWaveSolver solver;
+    if(!solver.init(m_slabDevices, waves, m_programSource, m_slabWeights))
+    {
+        std::cerr << "Failed to split the grid over " << name << "\n";
+        return;
+    }
+
+    // the same height-only steps on one device give the expected heights
+    OpenCLWaveSolver reference;
+    if(!reference.init(m_devices[0], waves, m_programSource))
+    {
+        std::cerr << "Failed to set up the OpenCL solver on " << deviceName(m_devices[0]) << "\n";
+        return;
+    }
+
+    // one warm up step
+    bool ok = solver.step(1);
+    solver.finish();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ok = ok && solver.step(steps);
+    solver.finish();
+    double seconds = secondsSince(start);
+
+    cl_event event = reference.enqueueHeightSteps(steps + 1, 0);
+    ok = ok && event != 0;
+    OpenCLWaveSolver::releaseEvent(event);
+
+    std::vector<float> heights(size * size);
+    std::vector<float> expected(size * size);
+    ok = ok && solver.readHeights(&heights[0]) && reference.readHeights(&expected[0]);
+    if(!ok)
+    {
+        std::cerr << "Multi-device run on " << name << " failed\n";
+        return;
+    }
+
+    float maxDifference = 0.0f;
+    for(unsigned int i = 0; i < heights.size(); ++i)
+    {
+        maxDifference = std::max(maxDifference, std::fabs(heights[i] - expected[i]));
+    }
+    std::cerr << "  max height difference to a single device: " << maxDifference << "\n";
+
+    Result result;
+    result.backend = "opencl-multi";
+    result.device = name;
+    result.variant = variantName;
+    result.rows = size;
+    result.cols = size;
+    result.steps = steps;
+    result.threads = 0;
+    result.seconds = seconds;
+    result.bytesPerCell = OCL_HEIGHT_BYTES_PER_CELL;
+    m_results.push_back(result);
+}
+
+void SolverBenchmark::benchmarkLaunchOverhead(cl_device_id device) const
+{
+    std::string name = deviceName(device);
+    GPUWaves waves;
+    waves.init(OVERHEAD_GRID_SIZE, OVERHEAD_GRID_SIZE, 1.0f, 0.03f, 3.25f, 0.4f);
+
+    std::cerr << "\nLaunch overhead on " << name << ", " << OVERHEAD_STEPS << " steps of "
+              << OVERHEAD_GRID_SIZE << "x" << OVERHEAD_GRID_SIZE << ": \n"
+              << "------------------------------------------------\n";
+
+    for(int bindPerLaunch = 1; bindPerLaunch >= 0; --bindPerLaunch)
+    {
+        OpenCLWaveSolver solver;
+        if(!solver.init(device, waves, m_programSource))
+        {
+            std::cerr << "Failed to set up the OpenCL solver on " << name << "\n";
+            return;
+        }
+        solver.setLocalTiling(false);
+        solver.setFusedKernel(false);
+        solver.setBindPerLaunch(bindPerLaunch != 0);
+
+        // warm up the driver paths of both kernels
+        OpenCLWaveSolver::releaseEvent(solver.enqueueSteps(1, 0));
+        clFinish(solver.queue());
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(unsigned int n = 0; n < OVERHEAD_STEPS; ++n)
+        {
+            OpenCLWaveSolver::releaseEvent(solver.enqueueSteps(1, 0));
+        }
+        double enqueueSeconds = secondsSince(start);
+        clFinish(solver.queue());
+        double totalSeconds = secondsSince(start);
+
+        std::cerr << (bindPerLaunch ? "arguments set per launch" : "arguments bound once  ") << " | "
+                  << 1.0e6 * enqueueSeconds / OVERHEAD_STEPS << " us enqueue per step | "
+                  << 1.0e6 * totalSeconds / OVERHEAD_STEPS << " us per step\n";
+    }
+}
+
+static void printHeightError(const std::string& name, unsigned int steps, const float* reference,
+                             const float* heights, unsigned int count)
+{
+    double maxError = 0.0, squaredError = 0.0, maxHeight = 0.0;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        double error = std::fabs(static_cast<double>(heights[i]) - reference[i]);
+        maxError = std::max(maxError, error);
+        squaredError += error * error;
+        maxHeight = std::max(maxHeight, std::fabs(static_cast<double>(reference[i])));
+    }
+
+    std::cout << name << " | " << steps << " steps | max error " << maxError
+              << " | rms error " << std::sqrt(squaredError / count)
+              << " | max height " << maxHeight
+              << " | max error / max height " << (maxHeight > 0.0 ? 100.0 * maxError / maxHeight : 0.0) << "%\n";
+}
+
+void SolverBenchmark::reportHalfStorageError() const
+{
+    const unsigned int size = m_sizes[0];
+    const unsigned int count = size * size;
+    const unsigned int checkpoints = sizeof(HALF_ERROR_STEPS) / sizeof(HALF_ERROR_STEPS[0]);
+    std::cout << "fp16 height storage against fp32 on a " << size << "x" << size << " grid, "
+              << DROP_COUNT << " drops and " << m_rain << " rain drops per step: \n"
+              << "------------------------------------------------\n";
+
+    // both solvers get the same drops and rain
+    std::vector<std::pair<unsigned int, unsigned int> > drops;
+    srand(0);
+    for(int d = 0; d < DROP_COUNT; ++d)
+    {
+        unsigned int i = 5 + rand() % (size-10);
+        unsigned int j = 5 + rand() % (size-10);
+        drops.push_back(std::make_pair(i, j));
+    }
+
+    if(m_runCPU)
+    {
+        CPUWaves reference, half;
+        CPUWaves* waves[] = {&reference, &half};
+        for(int w = 0; w < 2; ++w)
+        {
+            waves[w]->init(size, size, 1.0f, 0.03f, 3.25f, 0.4f);
+            waves[w]->setHalfStorage(w == 1);
+            for(unsigned int d = 0; d < drops.size(); ++d)
+            {
+                waves[w]->disturbances().push(drops[d].first, drops[d].second, 1.5f);
+            }
+            waves[w]->disturbances().setRain(m_rain);
+        }
+
+        unsigned int done = 0;
+        for(unsigned int c = 0; c < checkpoints; ++c)
+        {
+            reference.stepN(HALF_ERROR_STEPS[c] - done);
+            half.stepN(HALF_ERROR_STEPS[c] - done);
+            done = HALF_ERROR_STEPS[c];
+            printHeightError("cpu", done, reference.getCurrentHeights(), half.getCurrentHeights(), count);
+        }
+    }
+
+    for(unsigned int d = 0; d < m_devices.size() && m_runOpenCL; ++d)
+    {
+        std::string name = deviceName(m_devices[d]);
+        GPUWaves waves;
+        waves.init(size, size, 1.0f, 0.03f, 3.25f, 0.4f);
+
+        OpenCLWaveSolver reference, half;
+        OpenCLWaveSolver* solvers[] = {&reference, &half};
+        bool ok = true;
+        for(int s = 0; s < 2 && ok; ++s)
+        {
+            solvers[s]->setHalfHeights(s == 1);
+            ok = solvers[s]->init(m_devices[d], waves, m_programSource);
+            for(unsigned int k = 0; k < drops.size() && ok; ++k)
+            {
+                solvers[s]->disturbances().push(drops[k].first, drops[k].second, 1.5f);
+            }
+            solvers[s]->disturbances().setRain(m_rain);
+        }
+        if(!ok)
+        {
+            std::cerr << "Failed to set up the OpenCL solvers on " << name << "\n";
+            continue;
+        }
+
+        std::vector<float> expected(count), heights(count);
+        unsigned int done = 0;
+        for(unsigned int c = 0; c < checkpoints && ok; ++c)
+        {
+            for(int s = 0; s < 2; ++s)
+            {
+                OpenCLWaveSolver::releaseEvent(solvers[s]->enqueueSteps(HALF_ERROR_STEPS[c] - done, 0));
+            }
+            done = HALF_ERROR_STEPS[c];
+            ok = reference.readHeights(&expected[0]) && half.readHeights(&heights[0]);
+            if(ok)
+            {
+                printHeightError("opencl [" + name + "]", done, &expected[0], &heights[0], count);
+            }
+        }
+    }
+}
+
+void SolverBenchmark::writeCSV(std::ostream& out) const
+{
+    out << "backend,device,variant,rows,cols,steps,threads,seconds,cells_per_sec,ns_per_cell,gb_per_sec\n";
+    for(unsigned int i = 0; i < m_results.size(); ++i)
+    {
+        const Result& r = m_results[i];
+        double cells = static_cast<double>(r.rows) * r.cols * r.steps;
+        double cellsPerSecond = cells / r.seconds;
+
+        out << r.backend << ",\"" << r.device << "\"," << r.variant << ","
+            << r.rows << "," << r.cols << "," << r.steps << "," << r.threads << ","
+            << r.seconds << "," << cellsPerSecond << ","
+            << 1.0e9 / cellsPerSecond << ","
+            << cellsPerSecond * r.bytesPerCell * 1.0e-9 << "\n";
+    }
+}
+
+void SolverBenchmark::writeJSON(std::ostream& out) const
+{
+    out << "[\n";
+    for(unsigned int i = 0; i < m_results.size(); ++i)
+    {
+        const Result& r = m_results[i];
+        double cells = static_cast<double>(r.rows) * r.cols * r.steps;
+        double cellsPerSecond = cells / r.seconds;
+
+        out << "  {\"backend\": \"" << r.backend << "\", "
+            << "\"device\": \"" << r.device << "\", "
+            << "\"variant\": \"" << r.variant << "\", "
+            << "\"rows\": " << r.rows << ", "
+            << "\"cols\": " << r.cols << ", "
+            << "\"steps\": " << r.steps << ", "
+            << "\"threads\": " << r.threads << ", "
+            << "\"seconds\": " << r.seconds << ", "
+            << "\"cells_per_sec\": " << cellsPerSecond << ", "
+            << "\"ns_per_cell\": " << 1.0e9 / cellsPerSecond << ", "
+            << "\"gb_per_sec\": " << cellsPerSecond * r.bytesPerCell * 1.0e-9 << "}"
+            << (i+1 < m_results.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+}
+
+void SolverBenchmark::printScaling() const
+{
+    // compares every multithreaded CPU run against the single threaded run of the same configuration
+    bool header = false;
+    for(unsigned int i = 0; i < m_results.size(); ++i)
+    {
+        const Result& r = m_results[i];
+        if(r.backend != "cpu" || r.threads <= 1)
+        {
+            continue;
+        }
+
+        for(unsigned int k = 0; k < m_results.size(); ++k)
+        {
+            const Result& base = m_results[k];
+            if(base.backend == r.backend && base.variant == r.variant && base.threads == 1 &&
+               base.rows == r.rows && base.cols == r.cols && base.steps == r.steps)
+            {
+                if(!header)
+                {
+                    std::cerr << "\nThread scaling: \n"
+                              << "------------------------------------------------\n";
+                    header = true;
+                }
+
+                double speedup = base.seconds / r.seconds;
+                std::cerr << r.variant << " " << r.rows << "x" << r.cols << " | "
+                          << r.threads << " threads | speedup " << speedup
+                          << " | efficiency " << 100.0 * speedup / r.threads << "%\n";
+                break;
+            }
+        }
+    }
+}
+
+// The loops of the original CPUWaves implementation, kept as ground truth for --validate.
+static void referenceHeightRow(float* prev, const float* up, const float* curr, const float* down,
+                               unsigned int n, float k1, float k2, float k3)
+{
+    for(unsigned int j = 1; j < n-1; ++j)
+    {
+        prev[j] = k1*prev[j] + k2*curr[j] + k3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+    }
+}
+
+static void referenceNormalRow(const float* up, const float* curr, const float* down,
+                               glm::vec4* normals, glm::vec4* tangents, unsigned int n, float spatialStep)
+{
+    for(unsigned int j = 1; j < n-1; ++j)
+    {
+        float l = curr[j-1];
+        float r = curr[j+1];
+        float t = up[j];
+        float b = down[j];
+        normals[j]  = glm::normalize(glm::vec4(l-r, 2.0f*spatialStep, b-t, 1.0f));
+        tangents[j] = glm::normalize(glm::vec4(2.0f*spatialStep, r-l, 0.0f, 1.0f));
+    }
+}
+
+static unsigned int ulpDistance(float a, float b)
+{
+    int ia, ib;
+    memcpy(&ia, &a, sizeof(float));
+    memcpy(&ib, &b, sizeof(float));
+    if((ia < 0) != (ib < 0))
+    {
+        return (a == b) ? 0 : 0xffffffffu;
+    }
+    return static_cast<unsigned int>(ia > ib ? ia - ib : ib - ia);
+}
+
+static unsigned int maxUlpDistance(const float* a, const float* b, unsigned int count)
+{
+    unsigned int distance = 0;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        distance = std::max(distance, ulpDistance(a[i], b[i]));
+    }
+    return distance;
+}
+
+bool SolverBenchmark::validateStencilKernels() const
+{
+    const float k1 = -0.988f, k2 = 0.356f, k3 = 0.411f, spatialStep = 1.0f;
+    const unsigned int rowLengths[] = {3, 4, 5, 8, 9, 17, 18, 31, 33, 64, 67, 1024, 1031};
+    const unsigned int lengthCount = sizeof(rowLengths) / sizeof(rowLengths[0]);
+
+    std::vector<const StencilKernelSet*> sets = StencilKernels::supported();
+    bool valid = true;
+
+    srand(0);
+    for(unsigned int k = 0; k < sets.size(); ++k)
+    {
+        unsigned int heightUlp = 0, normalUlp = 0, referenceNormalUlp = 0;
+        for(unsigned int l = 0; l < lengthCount; ++l)
+        {
+            const unsigned int n = rowLengths[l];
+            std::vector<float> up(n), curr(n), down(n), prev(n);
+            for(unsigned int j = 0; j < n; ++j)
+            {
+                up[j]   = 4.0f * rand() / RAND_MAX - 2.0f;
+                curr[j] = 4.0f * rand() / RAND_MAX - 2.0f;
+                down[j] = 4.0f * rand() / RAND_MAX - 2.0f;
+                prev[j] = 4.0f * rand() / RAND_MAX - 2.0f;
+            }
+
+            // heights have to match the original loop bit by bit
+            std::vector<float> expected(prev), actual(prev);
+            referenceHeightRow(&expected[0], &up[0], &curr[0], &down[0], n, k1, k2, k3);
+            sets[k]->updateHeightRow(&actual[0], &up[0], &curr[0], &down[0], n, k1, k2, k3);
+            heightUlp = std::max(heightUlp, maxUlpDistance(&expected[0], &actual[0], n));
+
+            // normals have to match the scalar set bit by bit and glm::normalize up to rounding
+            std::vector<glm::vec4> scalarNormals(n), scalarTangents(n), normals(n), tangents(n);
+            std::vector<glm::vec4> referenceNormals(n), referenceTangents(n);
+            StencilKernels::scalar().computeNormalRow(&up[0], &curr[0], &down[0],
+                reinterpret_cast<float*>(&scalarNormals[0]), reinterpret_cast<float*>(&scalarTangents[0]), n, spatialStep);
+            sets[k]->computeNormalRow(&up[0], &curr[0], &down[0],
+                reinterpret_cast<float*>(&normals[0]), reinterpret_cast<float*>(&tangents[0]), n, spatialStep);
+            referenceNormalRow(&up[0], &curr[0], &down[0], &referenceNormals[0], &referenceTangents[0], n, spatialStep);
+
+            const unsigned int count = 4 * (n-2);
+            normalUlp = std::max(normalUlp, maxUlpDistance(reinterpret_cast<float*>(&scalarNormals[1]), reinterpret_cast<float*>(&normals[1]), count));
+            normalUlp = std::max(normalUlp, maxUlpDistance(reinterpret_cast<float*>(&scalarTangents[1]), reinterpret_cast<float*>(&tangents[1]), count));
+            referenceNormalUlp = std::max(referenceNormalUlp, maxUlpDistance(reinterpret_cast<float*>(&referenceNormals[1]), reinterpret_cast<float*>(&normals[1]), count));
+            referenceNormalUlp = std::max(referenceNormalUlp, maxUlpDistance(reinterpret_cast<float*>(&referenceTangents[1]), reinterpret_cast<float*>(&tangents[1]), count));
+        }
+
+        bool passed = heightUlp == 0 && normalUlp == 0 && referenceNormalUlp <= 4;
+        valid = valid && passed;
+        std::cout << sets[k]->name << " | heights max ulp " << heightUlp
+                  << " | normals vs scalar max ulp " << normalUlp
+                  << " | normals vs glm max ulp " << referenceNormalUlp
+                  << " | " << (passed ? "passed" : "FAILED") << "\n";
+    }
+
+    return valid;
+}
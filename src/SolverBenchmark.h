@@ -0,0 +1,144 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SOLVER_BENCHMARK_H
+#define SOLVER_BENCHMARK_H
+
+// own
+#include "CpuWaves.h"
+#include "OpenCLDeviceSelector.h"
+
+// std
+#include <string>
+#include <vector>
+#include <ostream>
+
+// ocl
+#include <CL/cl.h>
+
+struct StencilKernelSet;
+
+/**
+*   @brief Headless throughput benchmark for the CPU solver and the OpenCL kernels.
+*
+*   Sweeps grid sizes and step counts without creating any window or GL context
+*   and reports cells/second, ns/cell and an estimated memory bandwidth as CSV or JSON.
+*/
+class SolverBenchmark
+{
+public:
+    SolverBenchmark(int argc, char** argv);
+    ~SolverBenchmark();
+
+    bool init();
+    int run();
+
+protected:
+    struct Result
+    {
+        std::string backend;
+        std::string device;
+        std::string variant;
+        unsigned int rows;
+        unsigned int cols;
+        unsigned int steps;
+        unsigned int threads;
+        double seconds;
+
+        // modelled memory traffic of one time step per grid cell
+        double bytesPerCell;
+    };
+
+    bool parseArguments();
+    void printUsage() const;
+    void queryOpenCLDevices();
+
+    // blockSteps 0 times single step() calls, otherwise one stepN() call with temporal
+    // blocking of blockSteps steps per pass (1 advances the whole grid once per step)
+    void benchmarkCPU(unsigned int size, unsigned int steps, unsigned int threads, const StencilKernelSet& kernels,
+                      unsigned int blockSteps, CPUWaves::PassMode passMode, bool halfStorage);
+    // variant is "buffer" (compute_vertex_displacement), "local" (compute_vertex_displacement_local),
+    // both followed by compute_finite_difference_scheme, "fused" (compute_fused_step) or "multi"
+    // (height-only compute_multi_step with stepsPerLaunch steps per launch, 0 picks them per device)
+    // "image" (the kernels of the image storage) or "heights" (height-only steps that copy
+    // the heights into the height output, the frame of the height render mode)
+    void benchmarkOpenCL(cl_device_id device, unsigned int size, unsigned int steps,
+                         const std::string& variant, unsigned int stepsPerLaunch, bool halfHeights);
+    // splits the grid into slabs over m_slabDevices and compares the heights with a single device run
+    void benchmarkMultiDevice(unsigned int size, unsigned int steps);
+
+    void writeCSV(std::ostream& out) const;
+    void writeJSON(std::ostream& out) const;
+    void printScaling() const;
+
+    // compares every supported stencil kernel set against the scalar reference
+    bool validateStencilKernels() const;
+
+    // host time per enqueued step of compute_vertex_displacement and compute_finite_difference_scheme
+    // on a tiny grid, with arguments bound once and with all arguments set before every launch
+    void benchmarkLaunchOverhead(cl_device_id device) const;
+
+    // difference of the fp16 height storage to the fp32 solvers after an increasing number of steps
+    void reportHalfStorageError() const;
+
+private:
+    int m_argc;
+    char** m_argv;
+
+    std::vector<unsigned int> m_sizes;
+    std::vector<unsigned int> m_steps;
+    std::vector<unsigned int> m_threads;
+    std::vector<const StencilKernelSet*> m_kernelSets;
+    std::vector<unsigned int> m_blockSteps;
+    std::vector<CPUWaves::PassMode> m_passModes;
+    bool m_validate;
+    bool m_launchOverhead;
+    bool m_halfError;
+
+    // height storage of the timed runs, fp16 if set
+    std::vector<bool> m_halfStorage;
+
+    // drops generated per time step during the timed steps
+    unsigned int m_rain;
+
+    bool m_runCPU;
+    bool m_runOpenCL;
+    bool m_listDevices;
+    OpenCLDeviceSelector m_deviceSelector;
+    std::vector<std::string> m_clVariants;
+    std::vector<unsigned int> m_clStepsPerLaunch;
+    bool m_multiDevice;
+    unsigned int m_subDevices;
+
+    std::string m_format;
+    std::string m_outputPath;
+    std::string m_kernelPath;
+    std::string m_programSource;
+
+    std::vector<cl_device_id> m_devices;
+    std::vector<cl_device_id> m_slabDevices;
+    std::vector<double> m_slabWeights;
+    std::vector<Result> m_results;
+};
+
+#endif // SOLVER_BENCHMARK_H
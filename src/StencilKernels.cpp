@@ -0,0 +1,139 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "StencilKernels.h"
+
+#if defined(_MSC_VER) && defined(STENCIL_KERNELS_X86)
+#   include <intrin.h>
+#   include <immintrin.h>
+#endif
+
+static void scalarHeightRow(float* prev, const float* up, const float* curr, const float* down,
+                            unsigned int n, float k1, float k2, float k3)
+{
+    for(unsigned int j = 1; j < n-1; ++j)
+    {
+        StencilKernels::heightCell(prev, up, curr, down, j, k1, k2, k3);
+    }
+}
+
+static void scalarNormalRow(const float* up, const float* curr, const float* down,
+                            float* normals, float* tangents, unsigned int n, float spatialStep)
+{
+    for(unsigned int j = 1; j < n-1; ++j)
+    {
+        StencilKernels::normalCell(up, curr, down, normals, tangents, j, spatialStep);
+    }
+}
+
+static const StencilKernelSet s_scalarStencilKernels = {"scalar", scalarHeightRow, scalarNormalRow};
+
+#ifdef STENCIL_KERNELS_X86
+enum CpuFeature
+{
+    CPU_AVX2,
+    CPU_AVX512F
+};
+
+static bool cpuSupports(CpuFeature feature)
+{
+#   if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7)
+    {
+        return false;
+    }
+
+    // the OS has to save the ymm/zmm state on context switches
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if(!osxsave)
+    {
+        return false;
+    }
+    unsigned long long xcr0 = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+    if(feature == CPU_AVX2)
+    {
+        return (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    }
+    return (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+#   else
+    __builtin_cpu_init();
+    if(feature == CPU_AVX2)
+    {
+        return __builtin_cpu_supports("avx2") != 0;
+    }
+    return __builtin_cpu_supports("avx512f") != 0;
+#   endif
+}
+#endif
+
+const StencilKernelSet& StencilKernels::scalar()
+{
+    return s_scalarStencilKernels;
+}
+
+std::vector<const StencilKernelSet*> StencilKernels::supported()
+{
+    std::vector<const StencilKernelSet*> sets;
+    sets.push_back(&s_scalarStencilKernels);
+
+#if defined(STENCIL_KERNELS_X86)
+    // SSE2 is part of every x86-64 CPU and required by the build on 32 bit
+    sets.push_back(&g_sse2StencilKernels);
+    if(cpuSupports(CPU_AVX2))
+    {
+        sets.push_back(&g_avx2StencilKernels);
+    }
+    if(cpuSupports(CPU_AVX512F))
+    {
+        sets.push_back(&g_avx512StencilKernels);
+    }
+#elif defined(STENCIL_KERNELS_NEON)
+    sets.push_back(&g_neonStencilKernels);
+#endif
+
+    return sets;
+}
+
+const StencilKernelSet& StencilKernels::best()
+{
+    static const StencilKernelSet* s_best = supported().back();
+    return *s_best;
+}
+
+const StencilKernelSet* StencilKernels::find(const std::string& name)
+{
+    std::vector<const StencilKernelSet*> sets = supported();
+    for(unsigned int i = 0; i < sets.size(); ++i)
+    {
+        if(name == sets[i]->name)
+        {
+            return sets[i];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef STENCIL_KERNELS_H
+#define STENCIL_KERNELS_H
+
+// std
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Row kernels of the CPU solver. Each kernel processes the interior columns
+// [1, n-1) of one grid row; up and down are the neighbouring rows i-1 and i+1.
+//
+// All implementations evaluate the same operations in the same order without
+// fused multiply-adds, so every instruction set produces bit-identical results.
+
+// prev = k1*prev + k2*curr + k3*(down + up + right + left), written in place.
+typedef void (*HeightRowKernel)(float* prev, const float* up, const float* curr, const float* down,
+                                unsigned int n, float k1, float k2, float k3);
+
+// normals and tangents hold 4 floats (x, y, z, w) per grid point.
+typedef void (*NormalRowKernel)(const float* up, const float* curr, const float* down,
+                                float* normals, float* tangents, unsigned int n, float spatialStep);
+
+struct StencilKernelSet
+{
+    const char* name;
+    HeightRowKernel updateHeightRow;
+    NormalRowKernel computeNormalRow;
+};
+
+class StencilKernels
+{
+public:
+    // portable reference implementation, always available
+    static const StencilKernelSet& scalar();
+
+    // fastest set supported by the executing CPU, determined by CPUID once
+    static const StencilKernelSet& best();
+
+    // set with the given name if it was compiled in and is supported by the CPU, 0 otherwise
+    static const StencilKernelSet* find(const std::string& name);
+
+    // all sets usable on the executing CPU, scalar first
+    static std::vector<const StencilKernelSet*> supported();
+
+    // scalar evaluation of a single cell, also used for the remainders of the vector loops
+    static inline void heightCell(float* prev, const float* up, const float* curr, const float* down,
+                                  unsigned int j, float k1, float k2, float k3)
+    {
+        prev[j] = k1*prev[j] + k2*curr[j] + k3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+    }
+
+    static inline void normalCell(const float* up, const float* curr, const float* down,
+                                  float* normals, float* tangents, unsigned int j, float spatialStep)
+    {
+        float l = curr[j-1];
+        float r = curr[j+1];
+        float t = up[j];
+        float b = down[j];
+
+        float nx = l-r;
+        float ny = 2.0f*spatialStep;
+        float nz = b-t;
+        float nInv = 1.0f / std::sqrt((nx*nx + ny*ny) + (nz*nz + 1.0f));
+        normals[4*j]   = nx*nInv;
+        normals[4*j+1] = ny*nInv;
+        normals[4*j+2] = nz*nInv;
+        normals[4*j+3] = nInv;
+
+        float tx = 2.0f*spatialStep;
+        float ty = r-l;
+        float tInv = 1.0f / std::sqrt((tx*tx + ty*ty) + 1.0f);
+        tangents[4*j]   = tx*tInv;
+        tangents[4*j+1] = ty*tInv;
+        tangents[4*j+2] = 0.0f;
+        tangents[4*j+3] = tInv;
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define STENCIL_KERNELS_X86
+extern const StencilKernelSet g_sse2StencilKernels;
+extern const StencilKernelSet g_avx2StencilKernels;
+extern const StencilKernelSet g_avx512StencilKernels;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#   define STENCIL_KERNELS_NEON
+extern const StencilKernelSet g_neonStencilKernels;
+#endif
+
+#endif // STENCIL_KERNELS_H
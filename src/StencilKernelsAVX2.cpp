@@ -0,0 +1,109 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "StencilKernels.h"
+
+#ifdef STENCIL_KERNELS_X86
+
+#include <immintrin.h>
+
+// interleaves 4 lanes of x, y, z and w into 4 consecutive vec4
+static inline void storeInterleaved(float* dst, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(dst,      x);
+    _mm_storeu_ps(dst + 4,  y);
+    _mm_storeu_ps(dst + 8,  z);
+    _mm_storeu_ps(dst + 12, w);
+}
+
+static inline void storeInterleaved(float* dst, __m256 x, __m256 y, __m256 z, __m256 w)
+{
+    storeInterleaved(dst,      _mm256_castps256_ps128(x), _mm256_castps256_ps128(y),
+                               _mm256_castps256_ps128(z), _mm256_castps256_ps128(w));
+    storeInterleaved(dst + 16, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                               _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(w, 1));
+}
+
+static void avx2HeightRow(float* prev, const float* up, const float* curr, const float* down,
+                          unsigned int n, float k1, float k2, float k3)
+{
+    const __m256 vk1 = _mm256_set1_ps(k1);
+    const __m256 vk2 = _mm256_set1_ps(k2);
+    const __m256 vk3 = _mm256_set1_ps(k3);
+
+    unsigned int j = 1;
+    for(; j + 8 <= n-1; j += 8)
+    {
+        __m256 neighbours = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j)),
+                                                        _mm256_loadu_ps(curr + j + 1)),
+                                          _mm256_loadu_ps(curr + j - 1));
+        __m256 result = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vk1, _mm256_loadu_ps(prev + j)),
+                                                    _mm256_mul_ps(vk2, _mm256_loadu_ps(curr + j))),
+                                      _mm256_mul_ps(vk3, neighbours));
+        _mm256_storeu_ps(prev + j, result);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::heightCell(prev, up, curr, down, j, k1, k2, k3);
+    }
+}
+
+static void avx2NormalRow(const float* up, const float* curr, const float* down,
+                          float* normals, float* tangents, unsigned int n, float spatialStep)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 ny = _mm256_set1_ps(2.0f*spatialStep);
+    const __m256 nyy = _mm256_mul_ps(ny, ny);
+
+    unsigned int j = 1;
+    for(; j + 8 <= n-1; j += 8)
+    {
+        __m256 l = _mm256_loadu_ps(curr + j - 1);
+        __m256 r = _mm256_loadu_ps(curr + j + 1);
+        __m256 t = _mm256_loadu_ps(up + j);
+        __m256 b = _mm256_loadu_ps(down + j);
+
+        __m256 nx = _mm256_sub_ps(l, r);
+        __m256 nz = _mm256_sub_ps(b, t);
+        __m256 nInv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), nyy),
+                                                                      _mm256_add_ps(_mm256_mul_ps(nz, nz), one))));
+        storeInterleaved(normals + 4*j, _mm256_mul_ps(nx, nInv), _mm256_mul_ps(ny, nInv), _mm256_mul_ps(nz, nInv), nInv);
+
+        // the tangent x component equals the normal y component before normalization
+        __m256 ty = _mm256_sub_ps(r, l);
+        __m256 tInv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(nyy, _mm256_mul_ps(ty, ty)), one)));
+        storeInterleaved(tangents + 4*j, _mm256_mul_ps(ny, tInv), _mm256_mul_ps(ty, tInv), zero, tInv);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::normalCell(up, curr, down, normals, tangents, j, spatialStep);
+    }
+}
+
+const StencilKernelSet g_avx2StencilKernels = {"avx2", avx2HeightRow, avx2NormalRow};
+
+#endif // STENCIL_KERNELS_X86
@@ -0,0 +1,113 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "StencilKernels.h"
+
+#ifdef STENCIL_KERNELS_X86
+
+#include <immintrin.h>
+
+// interleaves 4 lanes of x, y, z and w into 4 consecutive vec4
+static inline void storeInterleaved(float* dst, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(dst,      x);
+    _mm_storeu_ps(dst + 4,  y);
+    _mm_storeu_ps(dst + 8,  z);
+    _mm_storeu_ps(dst + 12, w);
+}
+
+static inline void storeInterleaved(float* dst, __m512 x, __m512 y, __m512 z, __m512 w)
+{
+    storeInterleaved(dst,      _mm512_extractf32x4_ps(x, 0), _mm512_extractf32x4_ps(y, 0),
+                               _mm512_extractf32x4_ps(z, 0), _mm512_extractf32x4_ps(w, 0));
+    storeInterleaved(dst + 16, _mm512_extractf32x4_ps(x, 1), _mm512_extractf32x4_ps(y, 1),
+                               _mm512_extractf32x4_ps(z, 1), _mm512_extractf32x4_ps(w, 1));
+    storeInterleaved(dst + 32, _mm512_extractf32x4_ps(x, 2), _mm512_extractf32x4_ps(y, 2),
+                               _mm512_extractf32x4_ps(z, 2), _mm512_extractf32x4_ps(w, 2));
+    storeInterleaved(dst + 48, _mm512_extractf32x4_ps(x, 3), _mm512_extractf32x4_ps(y, 3),
+                               _mm512_extractf32x4_ps(z, 3), _mm512_extractf32x4_ps(w, 3));
+}
+
+static void avx512HeightRow(float* prev, const float* up, const float* curr, const float* down,
+                            unsigned int n, float k1, float k2, float k3)
+{
+    const __m512 vk1 = _mm512_set1_ps(k1);
+    const __m512 vk2 = _mm512_set1_ps(k2);
+    const __m512 vk3 = _mm512_set1_ps(k3);
+
+    unsigned int j = 1;
+    for(; j + 16 <= n-1; j += 16)
+    {
+        __m512 neighbours = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(down + j), _mm512_loadu_ps(up + j)),
+                                                        _mm512_loadu_ps(curr + j + 1)),
+                                          _mm512_loadu_ps(curr + j - 1));
+        __m512 result = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vk1, _mm512_loadu_ps(prev + j)),
+                                                    _mm512_mul_ps(vk2, _mm512_loadu_ps(curr + j))),
+                                      _mm512_mul_ps(vk3, neighbours));
+        _mm512_storeu_ps(prev + j, result);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::heightCell(prev, up, curr, down, j, k1, k2, k3);
+    }
+}
+
+static void avx512NormalRow(const float* up, const float* curr, const float* down,
+                            float* normals, float* tangents, unsigned int n, float spatialStep)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 ny = _mm512_set1_ps(2.0f*spatialStep);
+    const __m512 nyy = _mm512_mul_ps(ny, ny);
+
+    unsigned int j = 1;
+    for(; j + 16 <= n-1; j += 16)
+    {
+        __m512 l = _mm512_loadu_ps(curr + j - 1);
+        __m512 r = _mm512_loadu_ps(curr + j + 1);
+        __m512 t = _mm512_loadu_ps(up + j);
+        __m512 b = _mm512_loadu_ps(down + j);
+
+        __m512 nx = _mm512_sub_ps(l, r);
+        __m512 nz = _mm512_sub_ps(b, t);
+        __m512 nInv = _mm512_div_ps(one, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, nx), nyy),
+                                                                      _mm512_add_ps(_mm512_mul_ps(nz, nz), one))));
+        storeInterleaved(normals + 4*j, _mm512_mul_ps(nx, nInv), _mm512_mul_ps(ny, nInv), _mm512_mul_ps(nz, nInv), nInv);
+
+        // the tangent x component equals the normal y component before normalization
+        __m512 ty = _mm512_sub_ps(r, l);
+        __m512 tInv = _mm512_div_ps(one, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(nyy, _mm512_mul_ps(ty, ty)), one)));
+        storeInterleaved(tangents + 4*j, _mm512_mul_ps(ny, tInv), _mm512_mul_ps(ty, tInv), zero, tInv);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::normalCell(up, curr, down, normals, tangents, j, spatialStep);
+    }
+}
+
+const StencilKernelSet g_avx512StencilKernels = {"avx512", avx512HeightRow, avx512NormalRow};
+
+#endif // STENCIL_KERNELS_X86
@@ -0,0 +1,102 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "StencilKernels.h"
+
+#ifdef STENCIL_KERNELS_NEON
+
+#include <arm_neon.h>
+
+static void neonHeightRow(float* prev, const float* up, const float* curr, const float* down,
+                          unsigned int n, float k1, float k2, float k3)
+{
+    const float32x4_t vk1 = vdupq_n_f32(k1);
+    const float32x4_t vk2 = vdupq_n_f32(k2);
+    const float32x4_t vk3 = vdupq_n_f32(k3);
+
+    unsigned int j = 1;
+    for(; j + 4 <= n-1; j += 4)
+    {
+        // vmulq/vaddq on purpose: vmlaq may be fused and would differ from the scalar kernel
+        float32x4_t neighbours = vaddq_f32(vaddq_f32(vaddq_f32(vld1q_f32(down + j), vld1q_f32(up + j)),
+                                                     vld1q_f32(curr + j + 1)),
+                                           vld1q_f32(curr + j - 1));
+        float32x4_t result = vaddq_f32(vaddq_f32(vmulq_f32(vk1, vld1q_f32(prev + j)),
+                                                 vmulq_f32(vk2, vld1q_f32(curr + j))),
+                                       vmulq_f32(vk3, neighbours));
+        vst1q_f32(prev + j, result);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::heightCell(prev, up, curr, down, j, k1, k2, k3);
+    }
+}
+
+static void neonNormalRow(const float* up, const float* curr, const float* down,
+                          float* normals, float* tangents, unsigned int n, float spatialStep)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t ny = vdupq_n_f32(2.0f*spatialStep);
+    const float32x4_t nyy = vmulq_f32(ny, ny);
+
+    unsigned int j = 1;
+    for(; j + 4 <= n-1; j += 4)
+    {
+        float32x4_t l = vld1q_f32(curr + j - 1);
+        float32x4_t r = vld1q_f32(curr + j + 1);
+        float32x4_t t = vld1q_f32(up + j);
+        float32x4_t b = vld1q_f32(down + j);
+
+        float32x4_t nx = vsubq_f32(l, r);
+        float32x4_t nz = vsubq_f32(b, t);
+        float32x4_t nInv = vdivq_f32(one, vsqrtq_f32(vaddq_f32(vaddq_f32(vmulq_f32(nx, nx), nyy),
+                                                               vaddq_f32(vmulq_f32(nz, nz), one))));
+        float32x4x4_t normal;
+        normal.val[0] = vmulq_f32(nx, nInv);
+        normal.val[1] = vmulq_f32(ny, nInv);
+        normal.val[2] = vmulq_f32(nz, nInv);
+        normal.val[3] = nInv;
+        vst4q_f32(normals + 4*j, normal);
+
+        // the tangent x component equals the normal y component before normalization
+        float32x4_t ty = vsubq_f32(r, l);
+        float32x4_t tInv = vdivq_f32(one, vsqrtq_f32(vaddq_f32(vaddq_f32(nyy, vmulq_f32(ty, ty)), one)));
+        float32x4x4_t tangent;
+        tangent.val[0] = vmulq_f32(ny, tInv);
+        tangent.val[1] = vmulq_f32(ty, tInv);
+        tangent.val[2] = zero;
+        tangent.val[3] = tInv;
+        vst4q_f32(tangents + 4*j, tangent);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::normalCell(up, curr, down, normals, tangents, j, spatialStep);
+    }
+}
+
+const StencilKernelSet g_neonStencilKernels = {"neon", neonHeightRow, neonNormalRow};
+
+#endif // STENCIL_KERNELS_NEON
@@ -0,0 +1,107 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "StencilKernels.h"
+
+#ifdef STENCIL_KERNELS_X86
+
+#include <emmintrin.h>
+
+static void sse2HeightRow(float* prev, const float* up, const float* curr, const float* down,
+                          unsigned int n, float k1, float k2, float k3)
+{
+    const __m128 vk1 = _mm_set1_ps(k1);
+    const __m128 vk2 = _mm_set1_ps(k2);
+    const __m128 vk3 = _mm_set1_ps(k3);
+
+    unsigned int j = 1;
+    for(; j + 4 <= n-1; j += 4)
+    {
+        __m128 neighbours = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j)),
+                                                  _mm_loadu_ps(curr + j + 1)),
+                                       _mm_loadu_ps(curr + j - 1));
+        __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vk1, _mm_loadu_ps(prev + j)),
+                                              _mm_mul_ps(vk2, _mm_loadu_ps(curr + j))),
+                                   _mm_mul_ps(vk3, neighbours));
+        _mm_storeu_ps(prev + j, result);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::heightCell(prev, up, curr, down, j, k1, k2, k3);
+    }
+}
+
+static void sse2NormalRow(const float* up, const float* curr, const float* down,
+                          float* normals, float* tangents, unsigned int n, float spatialStep)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 ny = _mm_set1_ps(2.0f*spatialStep);
+    const __m128 nyy = _mm_mul_ps(ny, ny);
+
+    unsigned int j = 1;
+    for(; j + 4 <= n-1; j += 4)
+    {
+        __m128 l = _mm_loadu_ps(curr + j - 1);
+        __m128 r = _mm_loadu_ps(curr + j + 1);
+        __m128 t = _mm_loadu_ps(up + j);
+        __m128 b = _mm_loadu_ps(down + j);
+
+        __m128 nx = _mm_sub_ps(l, r);
+        __m128 nz = _mm_sub_ps(b, t);
+        __m128 nInv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), nyy),
+                                                             _mm_add_ps(_mm_mul_ps(nz, nz), one))));
+        __m128 x = _mm_mul_ps(nx, nInv);
+        __m128 y = _mm_mul_ps(ny, nInv);
+        __m128 z = _mm_mul_ps(nz, nInv);
+        __m128 w = nInv;
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(normals + 4*j,      x);
+        _mm_storeu_ps(normals + 4*j + 4,  y);
+        _mm_storeu_ps(normals + 4*j + 8,  z);
+        _mm_storeu_ps(normals + 4*j + 12, w);
+
+        // the tangent x component equals the normal y component before normalization
+        __m128 ty = _mm_sub_ps(r, l);
+        __m128 tInv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(nyy, _mm_mul_ps(ty, ty)), one)));
+        x = _mm_mul_ps(ny, tInv);
+        y = _mm_mul_ps(ty, tInv);
+        z = zero;
+        w = tInv;
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(tangents + 4*j,      x);
+        _mm_storeu_ps(tangents + 4*j + 4,  y);
+        _mm_storeu_ps(tangents + 4*j + 8,  z);
+        _mm_storeu_ps(tangents + 4*j + 12, w);
+    }
+
+    for(; j < n-1; ++j)
+    {
+        StencilKernels::normalCell(up, curr, down, normals, tangents, j, spatialStep);
+    }
+}
+
+const StencilKernelSet g_sse2StencilKernels = {"sse2", sse2HeightRow, sse2NormalRow};
+
+#endif // STENCIL_KERNELS_X86
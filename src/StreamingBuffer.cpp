@@ -0,0 +1,252 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "StreamingBuffer.h"
+
+// std
+#include <iostream>
+#include <chrono>
+
+// offsets of vertex attributes, mapped ranges and texture buffer ranges are all served
+// by segments aligned to 256 bytes
+static const size_t SEGMENT_ALIGNMENT = 256;
+
+// glClientWaitSync timeout in nanoseconds, the wait is repeated until the fence signals
+static const GLuint64 WAIT_TIMEOUT = 1000000;
+
+StreamingBuffer::StreamingBuffer()
+    : m_buffer(0),
+      m_mode(ORPHANING),
+      m_segmentBytes(0),
+      m_segment(0),
+      m_mapped(false),
+      m_persistentData(NULL),
+      m_stallSeconds(0.0),
+      m_maps(0)
+{
+}
+
+void StreamingBuffer::create(size_t segmentBytes, unsigned int segmentCount, bool preferPersistent)
+{
+    release();
+
+    m_segmentBytes = (segmentBytes + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+    m_mode = (preferPersistent && GLEW_ARB_buffer_storage && segmentCount > 1) ? PERSISTENT : ORPHANING;
+    m_segment = 0;
+    m_stallSeconds = 0.0;
+    m_maps = 0;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if(m_mode == PERSISTENT)
+    {
+        // coherent writes are visible to draws issued after them without an explicit flush
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = static_cast<GLsizeiptr>(m_segmentBytes * segmentCount);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+        m_persistentData = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+        if(m_persistentData == NULL)
+        {
+            std::cerr << "Failed to map the streaming buffer persistently, falling back to orphaning\n";
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            create(segmentBytes, segmentCount, false);
+            return;
+        }
+        m_fences.assign(segmentCount, static_cast<GLsync>(0));
+        // the first map() moves on to segment 0
+        m_segment = segmentCount - 1;
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, m_segmentBytes, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamingBuffer::release()
+{
+    if(m_buffer == 0)
+    {
+        return;
+    }
+
+    for(size_t i = 0; i < m_fences.size(); ++i)
+    {
+        if(m_fences[i] != 0)
+        {
+            glDeleteSync(m_fences[i]);
+        }
+    }
+    m_fences.clear();
+
+    if(m_persistentData != NULL || m_mapped)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_persistentData = NULL;
+    m_mapped = false;
+    m_segmentBytes = 0;
+}
+
+void* StreamingBuffer::map()
+{
+    if(m_buffer == 0 || m_mapped)
+    {
+        return NULL;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    void* data = NULL;
+    if(m_mode == PERSISTENT)
+    {
+        m_segment = (m_segment + 1) % static_cast<unsigned int>(m_fences.size());
+        waitForSegment(m_segment);
+        data = m_persistentData + m_segment * m_segmentBytes;
+    }
+    else
+    {
+        // the orphaned storage is not read by any pending draw, so no synchronization is needed
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, m_segmentBytes, NULL, GL_STREAM_DRAW);
+        data = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, m_segmentBytes,
+                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    m_stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++m_maps;
+
+    m_mapped = (data != NULL);
+    if(!m_mapped)
+    {
+        std::cerr << "Failed to map the streaming buffer\n";
+    }
+    return data;
+}
+
+void StreamingBuffer::unmap()
+{
+    if(!m_mapped)
+    {
+        return;
+    }
+    m_mapped = false;
+
+    if(m_mode == ORPHANING)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        if(glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE)
+        {
+            std::cerr << "The streaming buffer was corrupted while mapped\n";
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+}
+
+void StreamingBuffer::fence()
+{
+    if(m_mode != PERSISTENT || m_buffer == 0)
+    {
+        return;
+    }
+
+    GLsync& sync = m_fences[m_segment];
+    if(sync != 0)
+    {
+        glDeleteSync(sync);
+    }
+    sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamingBuffer::waitForSegment(unsigned int segment)
+{
+    GLsync& sync = m_fences[segment];
+    if(sync == 0)
+    {
+        return;
+    }
+
+    // the fence is flushed with the first wait only, later waits would flush for nothing
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for(;;)
+    {
+        GLenum result = glClientWaitSync(sync, flags, WAIT_TIMEOUT);
+        if(result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+        {
+            break;
+        }
+        if(result == GL_WAIT_FAILED)
+        {
+            std::cerr << "Failed to wait for a streaming buffer segment\n";
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(sync);
+    sync = 0;
+}
+
+GLuint StreamingBuffer::buffer() const
+{
+    return m_buffer;
+}
+
+GLintptr StreamingBuffer::offset() const
+{
+    return (m_mode == PERSISTENT) ? static_cast<GLintptr>(m_segment * m_segmentBytes) : 0;
+}
+
+StreamingBuffer::Mode StreamingBuffer::mode() const
+{
+    return m_mode;
+}
+
+const char* StreamingBuffer::modeName(Mode mode)
+{
+    switch(mode)
+    {
+    case PERSISTENT:
+        return "persistent mapping";
+    case ORPHANING:
+        return "orphaning";
+    default:
+        return "unknown";
+    }
+}
+
+unsigned int StreamingBuffer::segmentCount() const
+{
+    return (m_mode == PERSISTENT) ? static_cast<unsigned int>(m_fences.size()) : 1;
+}
+
+double StreamingBuffer::stallMilliseconds()
+{
+    double ms = (m_maps > 0) ? 1000.0 * m_stallSeconds / m_maps : -1.0;
+    m_stallSeconds = 0.0;
+    m_maps = 0;
+    return ms;
+}
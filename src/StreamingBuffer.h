@@ -0,0 +1,100 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef STREAMING_BUFFER_H
+#define STREAMING_BUFFER_H
+
+// ogl
+#include <GL/glew.h>
+
+// std
+#include <vector>
+#include <cstddef>
+
+/**
+*   @brief Buffer object the CPU rewrites every frame without waiting for the draws still reading it.
+*
+*   With GL_ARB_buffer_storage the buffer is split into a ring of segments that stay mapped
+*   persistently and coherently. map() hands out the next segment once the fence placed
+*   behind the draws of its last use has signaled. Without the extension a single segment
+*   is orphaned and mapped unsynchronized, leaving the renaming to the driver. The time
+*   spent in map() is accumulated, so stalls of either mode can be compared.
+*/
+class StreamingBuffer
+{
+public:
+    enum Mode
+    {
+        PERSISTENT,
+        ORPHANING
+    };
+
+    StreamingBuffer();
+
+    // creates the buffer with segments of at least segmentBytes, replacing a previous one.
+    // segmentCount only applies to persistent mapping, which is used if preferred and supported.
+    void create(size_t segmentBytes, unsigned int segmentCount, bool preferPersistent = true);
+
+    // deletes the buffer and its fences, the context must still be current
+    void release();
+
+    // returns the write only memory of the next segment, valid until unmap()
+    void* map();
+    void unmap();
+
+    // guards the segment of the last map() with a fence, call after the draws reading it
+    void fence();
+
+    GLuint buffer() const;
+
+    // byte offset of the segment of the last map() in buffer()
+    GLintptr offset() const;
+
+    Mode mode() const;
+    static const char* modeName(Mode mode);
+    unsigned int segmentCount() const;
+
+    // average time map() waited for the GPU or the driver since the last call, -1 if there was no map()
+    double stallMilliseconds();
+
+private:
+    StreamingBuffer(const StreamingBuffer&);
+    StreamingBuffer& operator=(const StreamingBuffer&);
+
+    void waitForSegment(unsigned int segment);
+
+    GLuint m_buffer;
+    Mode m_mode;
+    size_t m_segmentBytes;
+    unsigned int m_segment;
+    bool m_mapped;
+
+    // persistent mode only, one fence per segment, 0 if the segment is free
+    std::vector<GLsync> m_fences;
+    unsigned char* m_persistentData;
+
+    double m_stallSeconds;
+    unsigned int m_maps;
+};
+
+#endif // STREAMING_BUFFER_H
@@ -0,0 +1,132 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : m_task(0),
+      m_taskCount(0),
+      m_nextTask(0),
+      m_activeWorkers(0),
+      m_generation(0),
+      m_shutdown(false)
+{
+    // the calling thread works on every job as well
+    for(unsigned int i = 1; i < threadCount; ++i)
+    {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_wakeUp.notify_all();
+
+    for(unsigned int i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i].join();
+    }
+}
+
+unsigned int ThreadPool::threadCount() const
+{
+    return static_cast<unsigned int>(m_workers.size()) + 1;
+}
+
+void ThreadPool::run(unsigned int taskCount, const std::function<void(unsigned int)>& task)
+{
+    if(m_workers.empty() || taskCount <= 1)
+    {
+        for(unsigned int i = 0; i < taskCount; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_taskCount = taskCount;
+        m_nextTask = 0;
+        m_activeWorkers = static_cast<unsigned int>(m_workers.size());
+        ++m_generation;
+    }
+    m_wakeUp.notify_all();
+
+    executeTasks();
+
+    // wait until every worker has left the job, only then may the next one start
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_activeWorkers != 0)
+    {
+        m_done.wait(lock);
+    }
+    m_task = 0;
+}
+
+void ThreadPool::workerLoop()
+{
+    unsigned int generation = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(!m_shutdown && m_generation == generation)
+            {
+                m_wakeUp.wait(lock);
+            }
+
+            if(m_shutdown)
+            {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        executeTasks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_activeWorkers == 0)
+        {
+            m_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::executeTasks()
+{
+    for(;;)
+    {
+        unsigned int index = m_nextTask++;
+        if(index >= m_taskCount)
+        {
+            break;
+        }
+        (*m_task)(index);
+    }
+}
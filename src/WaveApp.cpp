@@ -28,11 +28,16 @@
 #include <glm/gtc/matrix_inverse.hpp>
 
 #include <iostream>
+#include <thread>
 
 WaveApp::WaveApp(int argc, char** argv, const std::string& appName, int width, int height, int gridWidth, int gridHeight)
     : GlutApp(argc, argv, appName, width, height),
     m_mouseBitMask(0),
     m_glslProgram(new GLSLProgram),
+    m_heightProgram(new GLSLProgram),
+    m_heightVBO(0),
+    m_heightTexture(0),
+    m_heightRendering(false),
     m_theta(1.5f * MathUtils::Pi),
     m_phi(0.1f * MathUtils::Pi),
     m_radius(600.0f),
@@ -46,6 +51,7 @@ WaveApp::WaveApp(int argc, char** argv, const std::string& appName, int width, i
 WaveApp::~WaveApp()
 {
     delete m_glslProgram;
+    delete m_heightProgram;
 };
 
 bool WaveApp::init()
@@ -78,44 +84,16 @@ bool WaveApp::init()
 void WaveApp::buildWaveGrid()
 {
     m_waves.init(m_gridWidth, m_gridHeight, 1.0f, 0.03f, 3.25f, 0.4f);
+    m_waves.setThreadCount(std::thread::hardware_concurrency());
 
-    GLuint vboHandles[3];
-    glGenBuffers(3, vboHandles);
-    m_posVBO = vboHandles[0];
-    m_normalVBO = vboHandles[1];
-    m_indicesVBO = vboHandles[2];
-
-    // create vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_posVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 4 * m_gridWidth*m_gridHeight, reinterpret_cast<float*>(m_waves.getCurrentWaves()), GL_STREAM_DRAW);
-
-    // create normal buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 4 * m_gridWidth*m_gridHeight, reinterpret_cast<float*>(m_waves.getCurrentNormals()), GL_STREAM_DRAW);
+    // three segments let the CPU write one frame while the GPU still draws the two before
+    m_vertexStream.create(2 * sizeof(glm::vec4) * m_gridWidth*m_gridHeight, 3);
+    std::cout << "Vertex uploads use " << StreamingBuffer::modeName(m_vertexStream.mode())
+              << " with " << m_vertexStream.segmentCount() << " segment(s) (press 'u' to change)\n";
 
     // create index buffer
-    unsigned int* indices = new unsigned int[3 * m_waves.triangleCount()];
-    unsigned int m = m_waves.rowCount();
-    unsigned int n = m_waves.columnCount();
-    unsigned int k = 0;
-    for(unsigned int i = 0; i < m-1; ++i)
-    {
-        for(unsigned int j = 0; j < n-1; ++j)
-        {
-            indices[k]   = i*n+j;
-            indices[k+1] = i*n+j+1;
-            indices[k+2] = (i+1)*n+j;
-
-            indices[k+3] = (i+1)*n+j;
-            indices[k+4] = i*n+j+1;
-            indices[k+5] = (i+1)*n+j+1;
-
-            k += 6; // next quad
-        }
-    }
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 3 * m_waves.triangleCount(), indices, GL_STATIC_DRAW);
+    m_gridMesh.build(m_waves.rowCount(), m_waves.columnCount(), GridMesh::TILED_STRIPS);
+    std::cout << "Grid mesh: " << m_gridMesh.statistics() << " (press 'm' to change)\n";
 
     glGenVertexArrays(1, &m_vaoHandle);
     glBindVertexArray(m_vaoHandle);
@@ -123,48 +101,33 @@ void WaveApp::buildWaveGrid()
     glEnableVertexAttribArray(0); // vPos;
     glEnableVertexAttribArray(1); // vNormal;
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_posVBO);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
-
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalVBO);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (GLubyte*)NULL);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridMesh.indexBuffer());
+    glBindVertexArray(0);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indicesVBO);
+    // the height render mode has no vertex attributes, its vertex array only holds the indices
+    glGenBuffers(1, &m_heightVBO);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_heightVBO);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * m_gridWidth*m_gridHeight, m_waves.getCurrentHeights(), GL_STREAM_DRAW);
+    glGenTextures(1, &m_heightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_heightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, m_heightVBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenVertexArrays(1, &m_vaoHeights);
+    glBindVertexArray(m_vaoHeights);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridMesh.indexBuffer());
     glBindVertexArray(0);
 
-    delete[] indices;
+    uploadVertices(false);
+    m_drawReport.start();
+    std::cout << "The solver writes the vertex buffers every step (press 'n' to upload the heights only)\n";
 }
 
 void WaveApp::initScene()
 {
-    if(!m_glslProgram->compileShaderFromFile("render_waves.vert", GLSLShader::VERTEX))
-    {
-        std::cerr << "Vertex shader failed to compile\n";
-        std::cerr << "Build Log: " << m_glslProgram->log() << std::endl;
-        exit(1);
-    }
-
-    if(!m_glslProgram->compileShaderFromFile("render_waves.frag", GLSLShader::FRAGMENT))
-    {
-        std::cerr << "Fragment shader failed to compile\n";
-        std::cerr << "Build Log: " << m_glslProgram->log() << std::endl;
-        exit(1);
-    }
-
-    // bindAttribLocation or bindFragDataLocation here
-    m_glslProgram->bindAttribLocation(0, "vPos");
-    m_glslProgram->bindAttribLocation(1, "vNormal");
-    m_glslProgram->bindFragDataLocation(0, "FragColor");
-
-    if(!m_glslProgram->link())
-    {
-        std::cerr << "Shader program failed to link\n";
-        std::cerr << "Link Log: " << m_glslProgram->log() << std::endl;
-    }
-
-    m_glslProgram->use();
-    m_glslProgram->printActiveAttribs();
-    m_glslProgram->printActiveUniforms();
+    buildProgram(m_heightProgram, "render_waves_heights.vert");
+    buildProgram(m_glslProgram, "render_waves.vert");
 
     // init uniforms
     m_modelM = glm::mat4(1.0f);
@@ -182,15 +145,63 @@ void WaveApp::initScene()
     m_lightDiffuse  = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
     m_lightSpecular = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
 
-    m_glslProgram->setUniform("materialAmbient", m_materialAmbient);
-    m_glslProgram->setUniform("materialDiffuse", m_materialDiffuse);
-    m_glslProgram->setUniform("materialSpecular", m_materialSpecular);
-    m_glslProgram->setUniform("lightDir", m_lightDir);
-    m_glslProgram->setUniform("lightAmbient", m_lightAmbient);
-    m_glslProgram->setUniform("lightDiffuse", m_lightDiffuse);
-    m_glslProgram->setUniform("lightSpecular", m_lightSpecular);
-
     buildWaveGrid();
+
+    setSceneUniforms(m_heightProgram);
+    setSceneUniforms(m_glslProgram);
+}
+
+void WaveApp::buildProgram(GLSLProgram* program, const char* vertexShader)
+{
+    if(!program->compileShaderFromFile(vertexShader, GLSLShader::VERTEX))
+    {
+        std::cerr << "Vertex shader " << vertexShader << " failed to compile\n";
+        std::cerr << "Build Log: " << program->log() << std::endl;
+        exit(1);
+    }
+
+    if(!program->compileShaderFromFile("render_waves.frag", GLSLShader::FRAGMENT))
+    {
+        std::cerr << "Fragment shader failed to compile\n";
+        std::cerr << "Build Log: " << program->log() << std::endl;
+        exit(1);
+    }
+
+    // bindAttribLocation or bindFragDataLocation here
+    program->bindAttribLocation(0, "vPos");
+    program->bindAttribLocation(1, "vNormal");
+    program->bindFragDataLocation(0, "FragColor");
+
+    if(!program->link())
+    {
+        std::cerr << "Shader program failed to link\n";
+        std::cerr << "Link Log: " << program->log() << std::endl;
+    }
+
+    program->use();
+    program->printActiveAttribs();
+    program->printActiveUniforms();
+}
+
+void WaveApp::setSceneUniforms(GLSLProgram* program)
+{
+    // uniforms are set on the program in use
+    program->use();
+    program->setUniform("materialAmbient", m_materialAmbient);
+    program->setUniform("materialDiffuse", m_materialDiffuse);
+    program->setUniform("materialSpecular", m_materialSpecular);
+    program->setUniform("lightDir", m_lightDir);
+    program->setUniform("lightAmbient", m_lightAmbient);
+    program->setUniform("lightDiffuse", m_lightDiffuse);
+    program->setUniform("lightSpecular", m_lightSpecular);
+
+    // the heights come from the texture buffer, the image sampler only needs a unit of its own
+    program->setUniform("heights", 0);
+    program->setUniform("heightImage", 1);
+    program->setUniform("useHeightImage", false);
+    program->setUniform("gridWidth", static_cast<int>(m_waves.columnCount()));
+    program->setUniform("gridHeight", static_cast<int>(m_waves.rowCount()));
+    program->setUniform("spatialStep", m_waves.width() / m_waves.columnCount());
 }
 
 void WaveApp::onResize(int w, int h)
@@ -211,10 +222,36 @@ void WaveApp::render()
     updateScene(m_fpsChronometer.getPassedTimeSinceStart());
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glBindVertexArray(m_vaoHandle);
-    glDrawElements(GL_TRIANGLES, 3 * m_waves.triangleCount(), GL_UNSIGNED_INT, ((GLubyte*)NULL + (0)));
+    if(m_heightRendering)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, m_heightTexture);
+        glBindVertexArray(m_vaoHeights);
+    }
+    else
+    {
+        glBindVertexArray(m_vaoHandle);
+    }
+    m_gridMesh.draw();
+    if(!m_heightRendering)
+    {
+        m_vertexStream.fence();
+    }
 
     glutSwapBuffers();
+
+    if(m_drawReport.getPassedTimeSinceStart() >= 1.0)
+    {
+        std::cout << m_gridMesh.drawMilliseconds() << " ms/draw (" << GridMesh::layoutName(m_gridMesh.layout()) << ")";
+        double stall = m_vertexStream.stallMilliseconds();
+        if(stall >= 0.0)
+        {
+            std::cout << ", " << stall << " ms/upload stalled (" << StreamingBuffer::modeName(m_vertexStream.mode()) << ")";
+        }
+        std::cout << "\n";
+        m_drawReport.stop();
+        m_drawReport.start();
+    }
 }
 
 void WaveApp::updateScene(double dt)
@@ -230,13 +267,15 @@ void WaveApp::updateScene(double dt)
     glm::vec3 up(0.0f, 1.0f, 0.0f);
     m_viewM = glm::lookAt(pos, target, up);
 
-    m_glslProgram->setUniform("eyePosW", pos);
+    GLSLProgram* program = m_heightRendering ? m_heightProgram : m_glslProgram;
+    program->use();
+    program->setUniform("eyePosW", pos);
 
     glm::mat4 mv = m_viewM * m_modelM;
-    m_glslProgram->setUniform("MVP", m_projM * mv);
+    program->setUniform("MVP", m_projM * mv);
     m_worldInvTransposeM = glm::transpose(glm::inverse(glm::mat3(m_modelM)));
-    m_glslProgram->setUniform("WorldMatrix", m_modelM);
-    m_glslProgram->setUniform("WorldInvTranspose", m_worldInvTransposeM);
+    program->setUniform("WorldMatrix", m_modelM);
+    program->setUniform("WorldInvTranspose", m_worldInvTransposeM);
 
     if(m_waveTrigger.getPassedTimeSinceStart() >= 0.05) // 50ms
     {
@@ -245,30 +284,63 @@ void WaveApp::updateScene(double dt)
 
         float r = MathUtils::randF(1.0f, 2.0f);
 
-        m_waves.disturb(i, j, r);
+        m_waves.disturbances().push(i, j, r);
         m_waveTrigger.stop();
         m_waveTrigger.start();
     }
 
-    m_waves.update(dt);
+    if(!m_waves.stepDue(dt))
+    {
+        return;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_posVBO);
-    glm::vec4* positionData = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
-    
-    for(unsigned int i = 0; i < m_waves.vertexCount(); ++i)
+    if(m_heightRendering)
     {
-        positionData[i] = m_waves[i];
+        m_waves.step();
+
+        // 4 bytes per vertex, respecifying the store lets the driver orphan the one in use
+        glBindBuffer(GL_TEXTURE_BUFFER, m_heightVBO);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * m_waves.vertexCount(), m_waves.getCurrentHeights(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return;
     }
-    glUnmapBuffer(GL_ARRAY_BUFFER);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalVBO);
-    glm::vec4* normalData = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
+    uploadVertices(true);
+}
+
+void WaveApp::uploadVertices(bool step)
+{
+    glm::vec4* positionData = reinterpret_cast<glm::vec4*>(m_vertexStream.map());
+    if(positionData == NULL)
+    {
+        if(step)
+        {
+            m_waves.step();
+        }
+        return;
+    }
+    glm::vec4* normalData = positionData + m_waves.vertexCount();
 
-    for(unsigned int i = 0; i < m_waves.vertexCount(); ++i)
+    // the solver writes its output straight into the mapped segment, no copy pass
+    if(step)
     {
-        normalData[i] = m_waves.normal(i);
+        m_waves.setOutput(positionData, normalData);
+        m_waves.step();
+        m_waves.setOutput(0, 0);
     }
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+    else
+    {
+        m_waves.writeOutput(positionData, normalData);
+    }
+    m_vertexStream.unmap();
+
+    // the segment written moves through the ring, so the attributes follow its offset
+    GLintptr offset = m_vertexStream.offset();
+    glBindVertexArray(m_vaoHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexStream.buffer());
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLvoid*>(offset));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLvoid*>(offset + sizeof(glm::vec4) * m_waves.vertexCount()));
+    glBindVertexArray(0);
 }
 
 void WaveApp::onMouseEvent(int button, int state, int x, int y)
@@ -306,6 +378,42 @@ void WaveApp::onKeyboardEvent(unsigned char key, int x, int y)
         }
         state = !state;
     }
+    else if(key == 'r')
+    {
+        DisturbanceQueue& disturbances = m_waves.disturbances();
+        disturbances.setRain(disturbances.rainPerStep() == 0 ? 2 : 0, 0.25f, 0.75f);
+        std::cout << "Rain " << (disturbances.rainPerStep() ? "on" : "off") << "\n";
+    }
+    else if(key == 'h')
+    {
+        m_waves.setHalfStorage(!m_waves.halfStorage());
+        std::cout << "Heights are stored as " << (m_waves.halfStorage() ? "fp16" : "fp32") << "\n";
+    }
+    else if(key == 'n')
+    {
+        // the shader derives the normals, so the solver skips them
+        m_heightRendering = !m_heightRendering;
+        m_waves.setNormalOutput(!m_heightRendering);
+        if(!m_heightRendering)
+        {
+            // the vertex buffer was not written while the heights were uploaded
+            uploadVertices(false);
+        }
+        std::cout << (m_heightRendering ? "Only the heights are uploaded, the vertex shader computes positions and normals"
+                                        : "The solver writes the vertex buffers every step") << "\n";
+    }
+    else if(key == 'u')
+    {
+        m_vertexStream.create(2 * sizeof(glm::vec4) * m_waves.vertexCount(), 3, m_vertexStream.mode() == StreamingBuffer::ORPHANING);
+        uploadVertices(false);
+        std::cout << "Vertex uploads use " << StreamingBuffer::modeName(m_vertexStream.mode()) << "\n";
+    }
+    else if(key == 'm')
+    {
+        GridMesh::Layout layout = static_cast<GridMesh::Layout>((m_gridMesh.layout() + 1) % GridMesh::LAYOUT_COUNT);
+        m_gridMesh.build(m_waves.rowCount(), m_waves.columnCount(), layout);
+        std::cout << "Grid mesh: " << m_gridMesh.statistics() << "\n";
+    }
 }
 
 void WaveApp::onMotionEvent(int x, int y)
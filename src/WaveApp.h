@@ -27,6 +27,8 @@
 #include "GlutApp.h"
 #include "GLSLProgram.h"
 #include "CpuWaves.h"
+#include "GridMesh.h"
+#include "StreamingBuffer.h"
 #include "Chronometer.hpp"
 
 #include <string>
@@ -54,11 +56,22 @@ public:
 protected:
     void initScene();
     void buildWaveGrid();
+    void uploadVertices(bool step);
+    void buildProgram(GLSLProgram* program, const char* vertexShader);
+    void setSceneUniforms(GLSLProgram* program);
 
 private:
     GLSLProgram* m_glslProgram;
     GLuint m_vaoHandle;
 
+    // height render mode, only the heights are uploaded into the texture buffer of
+    // m_heightVBO and render_waves_heights.vert rebuilds positions and normals
+    GLSLProgram* m_heightProgram;
+    GLuint m_vaoHeights;
+    GLuint m_heightVBO;
+    GLuint m_heightTexture;
+    bool m_heightRendering;
+
     glm::mat4 m_modelM;
     glm::mat4 m_viewM;
     glm::mat4 m_projM;
@@ -86,9 +99,12 @@ private:
     glm::vec4 m_lightDiffuse;
     glm::vec4 m_lightSpecular;
 
-    GLuint m_posVBO;
-    GLuint m_normalVBO;
-    GLuint m_indicesVBO;
+    // each segment holds the positions followed by the normals of one frame
+    StreamingBuffer m_vertexStream;
+
+    // index buffer and draw calls of the grid, 'm' cycles its layout
+    GridMesh m_gridMesh;
+    Chronometer m_drawReport;
 
     int m_gridWidth;
     int m_gridHeight;
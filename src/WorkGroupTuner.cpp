@@ -0,0 +1,203 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// own
+#include "WorkGroupTuner.h"
+
+// std
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+
+// launches timed per candidate after one warm up launch
+static const int TUNING_LAUNCHES = 10;
+
+static std::string deviceString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, NULL, &size);
+    std::string value(size, '\0');
+    if(size > 0)
+    {
+        clGetDeviceInfo(device, param, size, &value[0], NULL);
+    }
+    return value.c_str();
+}
+
+static std::string kernelName(cl_kernel kernel)
+{
+    size_t size = 0;
+    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+    std::string value(size, '\0');
+    if(size > 0)
+    {
+        clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, &value[0], NULL);
+    }
+    return value.c_str();
+}
+
+WorkGroupTuner::WorkGroupTuner(const std::string& profilePath)
+    : m_profilePath(profilePath)
+{
+    loadProfile();
+}
+
+const size_t* WorkGroupTuner::localSize(const size_t local[2])
+{
+    return (local[0] == 0 || local[1] == 0) ? NULL : local;
+}
+
+void WorkGroupTuner::tune(cl_command_queue queue, cl_kernel kernel, const size_t global[2], size_t local[2])
+{
+    cl_device_id device = 0;
+    clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+    std::string name = kernelName(kernel);
+    std::string key = profileKey(device, kernel, global);
+
+    std::map<std::string, Size>::const_iterator entry = m_profile.find(key);
+    if(entry != m_profile.end())
+    {
+        local[0] = entry->second.first;
+        local[1] = entry->second.second;
+        std::cout << "Work group of " << name << " loaded from " << m_profilePath << ": "
+                  << local[0] << "x" << local[1] << "\n";
+        return;
+    }
+
+    size_t maxWorkGroupSize = 1;
+    size_t preferredMultiple = 1;
+    size_t maxItemSizes[3] = {1, 1, 1};
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL);
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                             sizeof(preferredMultiple), &preferredMultiple, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItemSizes), maxItemSizes, NULL);
+    if(preferredMultiple == 0 || preferredMultiple > maxWorkGroupSize)
+    {
+        preferredMultiple = 1;
+    }
+
+    // the driver choice is always valid and competes with the explicit sizes
+    std::vector<Size> candidates(1, Size(0, 0));
+    for(size_t x = 1; x <= maxItemSizes[0] && x <= maxWorkGroupSize; x *= 2)
+    {
+        for(size_t y = 1; y <= maxItemSizes[1] && x*y <= maxWorkGroupSize; y *= 2)
+        {
+            if((x*y) % preferredMultiple == 0 && global[0] % x == 0 && global[1] % y == 0)
+            {
+                candidates.push_back(Size(x, y));
+            }
+        }
+    }
+
+    Size best(0, 0);
+    double bestSeconds = -1.0;
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+        size_t candidate[] = {candidates[i].first, candidates[i].second};
+        double seconds = timeLaunches(queue, kernel, global, localSize(candidate));
+        if(seconds >= 0.0 && (bestSeconds < 0.0 || seconds < bestSeconds))
+        {
+            best = candidates[i];
+            bestSeconds = seconds;
+        }
+    }
+
+    local[0] = best.first;
+    local[1] = best.second;
+    if(bestSeconds < 0.0)
+    {
+        std::cerr << "Failed to launch " << name << " while tuning, the driver chooses the work group\n";
+        return;
+    }
+
+    std::cout << "Work group of " << name << " tuned over " << candidates.size() << " candidates: "
+              << local[0] << "x" << local[1] << " (" << 1000.0 * bestSeconds / TUNING_LAUNCHES << " ms per launch)\n";
+
+    m_profile[key] = best;
+    storeProfile(key, best);
+}
+
+std::string WorkGroupTuner::profileKey(cl_device_id device, cl_kernel kernel, const size_t global[2]) const
+{
+    std::stringstream sstream;
+    sstream << deviceString(device, CL_DEVICE_NAME) << "\t" << deviceString(device, CL_DRIVER_VERSION) << "\t"
+            << kernelName(kernel) << "\t" << global[0] << "x" << global[1];
+    return sstream.str();
+}
+
+void WorkGroupTuner::loadProfile()
+{
+    // one line per entry: device, driver, kernel, global size and local size separated by tabs
+    std::ifstream file(m_profilePath.c_str());
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::string::size_type split = line.rfind('\t');
+        if(split == std::string::npos)
+        {
+            continue;
+        }
+
+        Size local(0, 0);
+        char separator = 0;
+        std::stringstream sstream(line.substr(split + 1));
+        if(sstream >> local.first >> separator >> local.second && separator == 'x')
+        {
+            m_profile[line.substr(0, split)] = local;
+        }
+    }
+}
+
+void WorkGroupTuner::storeProfile(const std::string& key, const Size& local) const
+{
+    std::ofstream file(m_profilePath.c_str(), std::ios::app);
+    if(!file)
+    {
+        std::cerr << "Failed to write work group profile " << m_profilePath << "\n";
+        return;
+    }
+    file << key << "\t" << local.first << "x" << local.second << "\n";
+}
+
+double WorkGroupTuner::timeLaunches(cl_command_queue queue, cl_kernel kernel, const size_t global[2], const size_t* local) const
+{
+    // sizes the kernel cannot run with are rejected at the first launch
+    if(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, 0, 0) != CL_SUCCESS || clFinish(queue) != CL_SUCCESS)
+    {
+        return -1.0;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < TUNING_LAUNCHES; ++i)
+    {
+        if(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, 0, 0) != CL_SUCCESS)
+        {
+            clFinish(queue);
+            return -1.0;
+        }
+    }
+    clFinish(queue);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef WORK_GROUP_TUNER_H
+#define WORK_GROUP_TUNER_H
+
+// std
+#include <string>
+#include <map>
+#include <utility>
+
+// ocl
+#include <CL/cl.h>
+
+/**
+*   @brief Picks the local work size of 2D kernels by timing candidates on the device.
+*
+*   Candidates are power of two sizes within CL_KERNEL_WORK_GROUP_SIZE and
+*   CL_DEVICE_MAX_WORK_ITEM_SIZES that are a multiple of
+*   CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE and divide the global size,
+*   plus the choice of the driver. The winner is stored per device, driver,
+*   kernel and global size in a text profile, so later runs skip the timing.
+*/
+class WorkGroupTuner
+{
+public:
+    explicit WorkGroupTuner(const std::string& profilePath = "workgroups.profile");
+
+    /**
+    *   @brief Writes the tuned local size of the kernel to local.
+    *
+    *   The kernel arguments have to be set already and the kernel is launched
+    *   repeatedly with them, so it must not change the state it reads.
+    *   A local size of {0, 0} means the driver chooses, pass localSize(local) to clEnqueueNDRangeKernel.
+    */
+    void tune(cl_command_queue queue, cl_kernel kernel, const size_t global[2], size_t local[2]);
+
+    // NULL for the driver choice, local otherwise
+    static const size_t* localSize(const size_t local[2]);
+
+private:
+    typedef std::pair<size_t, size_t> Size;
+
+    std::string profileKey(cl_device_id device, cl_kernel kernel, const size_t global[2]) const;
+    void loadProfile();
+    void storeProfile(const std::string& key, const Size& local) const;
+    double timeLaunches(cl_command_queue queue, cl_kernel kernel, const size_t global[2], const size_t* local) const;
+
+    std::string m_profilePath;
+    std::map<std::string, Size> m_profile;
+};
+
+#endif // WORK_GROUP_TUNER_H
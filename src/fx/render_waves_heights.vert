@@ -0,0 +1,82 @@
+// Copyright (c) 2013, Hannes Würfel <hannes.wuerfel@student.hpi.uni-potsdam.de>
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#version 400
+
+// Renders the grid from its heights alone. The vertex buffers are replaced by a texture
+// buffer of rows*cols heights, the x and z coordinates follow from gl_VertexID like in
+// grid_position of WaveSimulation.cl and the normal from the central differences of
+// compute_finite_difference_scheme. gl_VertexID includes the base vertex of the draw.
+// With the image storage of the solver the heights are read from its current height
+// image instead, which is shared as a 2D texture.
+
+out vec4 posW;
+out vec3 normalW;
+
+// heights in row major order, R32F or R16F
+uniform samplerBuffer heights;
+uniform sampler2D heightImage;
+uniform bool useHeightImage;
+uniform int gridWidth;
+uniform int gridHeight;
+uniform float spatialStep;
+
+// transformation matrices
+uniform mat4 MVP;
+uniform mat4 WorldMatrix;
+uniform mat3 WorldInvTranspose;
+
+float height(int x, int y)
+{
+	if(useHeightImage)
+	{
+		return texelFetch(heightImage, ivec2(x, y), 0).r;
+	}
+	return texelFetch(heights, y*gridWidth + x).r;
+}
+
+void main()
+{
+	int x = gl_VertexID % gridWidth;
+	int y = gl_VertexID / gridWidth;
+
+	float halfWidth = (gridWidth-1)*spatialStep*0.5;
+	float halfDepth = (gridHeight-1)*spatialStep*0.5;
+	vec4 pos = vec4(-halfWidth + x*spatialStep, height(x, y), halfDepth - y*spatialStep, 1.0);
+
+	// the border keeps the initial normal
+	vec3 normal = vec3(0.0, 1.0, 0.0);
+	if(x > 0 && x < gridWidth-1 && y > 0 && y < gridHeight-1)
+	{
+		float l = height(x-1, y);
+		float r = height(x+1, y);
+		float t = height(x, y-1);
+		float b = height(x, y+1);
+		normal = vec3(l-r, 2.0*spatialStep, b-t);
+	}
+
+	gl_Position = MVP * pos;
+
+	posW = WorldMatrix * pos;
+	normalW = WorldInvTranspose * normal;
+}
\ No newline at end of file
@@ -21,34 +21,666 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// Heights are stored as float, or as half if the program is built with -D HALF_HEIGHTS.
+// Half heights are only loaded and stored with vload_half/vstore_half_rte, all arithmetic
+// stays in float. The slab kernels of the multi-device solver always store floats.
+#ifdef HALF_HEIGHTS
+typedef half height_t;
+
+float load_height(__global const height_t* grid, int i)
+{
+    return vload_half(i, grid);
+}
+
+void store_height(__global height_t* grid, int i, float h)
+{
+    vstore_half_rte(h, i, grid);
+}
+#else
+typedef float height_t;
+
+float load_height(__global const height_t* grid, int i)
+{
+    return grid[i];
+}
+
+void store_height(__global height_t* grid, int i, float h)
+{
+    grid[i] = h;
+}
+#endif
+
+// The simulation state is a plane of heights per time step. The x and z coordinates of
+// a vertex follow from its index, this matches the grid built by GPUWaves::init.
+float4 grid_position(int x, int y, int width, int height, float spatialStep, float h)
+{
+    float halfWidth = (width-1)*spatialStep*0.5f;
+    float halfDepth = (height-1)*spatialStep*0.5f;
+
+    return (float4)(-halfWidth + x*spatialStep, h, halfDepth - y*spatialStep, 1.0f);
+}
+
+// Drops are applied as a source term to the new heights of a time step. A drop is
+// (row, column, magnitude, radius) and adds magnitude * (1 - d / (2 * radius)) to the cells
+// within the distance d <= radius, see DisturbanceQueue.
+float drop_height(float4 drop, int x, int y)
+{
+    float di = y - drop.x;
+    float dj = x - drop.y;
+    float distanceSquared = di*di + dj*dj;
+    if(distanceSquared > drop.w * drop.w)
+    {
+        return 0.0f;
+    }
+    return drop.z * (1.0f - sqrt(distanceSquared) / (2.0f * drop.w));
+}
+
+uint drop_hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// rain drop number n, the same drop as DisturbanceQueue::rainDrop.
+// shape holds the minimum and maximum magnitude and the radius.
+float4 rain_drop(uint seed, uint n, int width, int height, float4 shape)
+{
+    uint row = drop_hash(seed ^ drop_hash(3*n));
+    uint column = drop_hash(seed ^ drop_hash(3*n + 1));
+    uint magnitude = drop_hash(seed ^ drop_hash(3*n + 2));
+
+    return (float4)((float)(1 + row % (height-2)),
+                    (float)(1 + column % (width-2)),
+                    shape.x + (shape.y - shape.x) * ((magnitude >> 8) * (1.0f / 16777216.0f)),
+                    shape.z);
+}
+
+// height added to cell (x, y) by the dropCount queued drops and the rain.z rain drops
+// numbered from rain.y with seed rain.x. Every work item walks the same short lists.
+float drop_source(int x, int y, int width, int height, __constant float4* drops, int dropCount, uint4 rain, float4 rainShape)
+{
+    float h = 0.0f;
+    for(int d = 0; d < dropCount; ++d)
+    {
+        h += drop_height(drops[d], x, y);
+    }
+    for(uint n = rain.y; n < rain.y + rain.z; ++n)
+    {
+        h += drop_height(rain_drop(rain.x, n, width, height, rainShape), x, y);
+    }
+    return h;
+}
+
+// Every cell walking all drops costs cells * drops, so a work group first keeps the drops
+// that reach its box of cells (minX, minY, maxX, maxY) in local memory. The kept drops stay
+// in order and the culled ones would only have added 0, so the sum equals drop_source.
+// groupDrops needs GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK entries, the tail stages the
+// candidates of a chunk. Both are build options, see GPUWaves::programOptions.
+
+// true unless the drop misses every cell of the box, with a cell of slack against rounding
+bool drop_reaches(float4 drop, int4 box)
+{
+    float di = drop.x - clamp(drop.x, (float)box.y, (float)box.w);
+    float dj = drop.y - clamp(drop.y, (float)box.x, (float)box.z);
+    float reach = fabs(drop.w) + 1.0f;
+    return !(di*di + dj*dj > reach*reach);
+}
+
+// cells of the work group in a kernel launched over the grid
+int4 group_box(void)
+{
+    int minX = get_group_id(0) * get_local_size(0);
+    int minY = get_group_id(1) * get_local_size(1);
+    return (int4)(minX, minY, minX + get_local_size(0) - 1, minY + get_local_size(1) - 1);
+}
+
+// collects the drops of drop_source that reach box into groupDrops and returns their count,
+// -1 if they don't fit. Every work item of the group has to call it.
+int gather_group_drops(__local float4* groupDrops, __local int* groupDropCount, int4 box,
+                       int width, int height, __constant float4* drops, int dropCount, uint4 rain, float4 rainShape)
+{
+    int candidates = dropCount + (int)rain.z;
+    if(candidates == 0)
+    {
+        return 0;
+    }
+
+    int item = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    int groupSize = get_local_size(0) * get_local_size(1);
+    __local float4* chunk = groupDrops + GROUP_DROP_CAPACITY;
+
+    // a previous list may still be read
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(item == 0)
+    {
+        *groupDropCount = 0;
+    }
+
+    for(int first = 0; first < candidates; first += GROUP_DROP_CHUNK)
+    {
+        // the rain drops are generated in parallel, one work item compacts them in order
+        for(int i = item; i < GROUP_DROP_CHUNK && first + i < candidates; i += groupSize)
+        {
+            int c = first + i;
+            chunk[i] = c < dropCount ? drops[c] : rain_drop(rain.x, rain.y + (uint)(c - dropCount), width, height, rainShape);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(item == 0)
+        {
+            int count = *groupDropCount;
+            for(int i = 0; i < GROUP_DROP_CHUNK && first + i < candidates && count >= 0; ++i)
+            {
+                if(drop_reaches(chunk[i], box))
+                {
+                    if(count == GROUP_DROP_CAPACITY)
+                    {
+                        count = -1;
+                        break;
+                    }
+                    groupDrops[count++] = chunk[i];
+                }
+            }
+            *groupDropCount = count;
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    return *groupDropCount;
+}
+
+// drop_source over the list of gather_group_drops, or over all drops if the list overflowed
+float group_drop_source(int x, int y, int width, int height, __local const float4* groupDrops, int groupDropCount,
+                        __constant float4* drops, int dropCount, uint4 rain, float4 rainShape)
+{
+    if(groupDropCount < 0)
+    {
+        return drop_source(x, y, width, height, drops, dropCount, rain, rainShape);
+    }
+
+    float h = 0.0f;
+    for(int d = 0; d < groupDropCount; ++d)
+    {
+        h += drop_height(groupDrops[d], x, y);
+    }
+    return h;
+}
+
 // wave propagation over grid
-__kernel void compute_vertex_displacement(__global float4* prevGrid,
-                                          __global float4* currGrid,
+__kernel void compute_vertex_displacement(__global height_t* prevGrid,
+                                          __global height_t* currGrid,
                                           __global float4* glBuffer,
                                           int width,
                                           float k1,
                                           float k2,
-                                          float k3)
+                                          float k3,
+                                          float spatialStep,
+                                          __constant float4* drops,
+                                          int dropCount,
+                                          uint4 rain,
+                                          float4 rainShape)
 {
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
 
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, get_global_size(1),
+                                            drops, dropCount, rain, rainShape);
+
     if(x > 0 && x < get_global_size(0)-1 && y > 0 && y < get_global_size(1)-1)
     {
-        prevGrid[y*width+x].y = k1 *  prevGrid[y*width+x].y     +
-                                k2 *  currGrid[y*width+x].y     +
-                                k3 * (currGrid[(y+1)*width+x].y +
-                                      currGrid[(y-1)*width+x].y +
-                                      currGrid[y*width+(x+1)].y +
-                                      currGrid[y*width+(x-1)].y);
+        float h = k1 *  load_height(prevGrid, y*width+x)     +
+                  k2 *  load_height(currGrid, y*width+x)     +
+                  k3 * (load_height(currGrid, (y+1)*width+x) +
+                        load_height(currGrid, (y-1)*width+x) +
+                        load_height(currGrid, y*width+(x+1)) +
+                        load_height(currGrid, y*width+(x-1))) +
+                  group_drop_source(x, y, width, get_global_size(1), groupDrops, groupDropTotal, drops, dropCount, rain, rainShape);
 
+        store_height(prevGrid, y*width+x, h);
+        glBuffer[y*width+x] = grid_position(x, y, width, get_global_size(1), spatialStep, h);
+    }
+}
 
-        glBuffer[y*width+x] = prevGrid[y*width+x];
+// height-only time step without local memory, for devices where the tiles of
+// compute_multi_step don't fit
+__kernel void compute_height_step(__global height_t* prevGrid,
+                                  __global const height_t* currGrid,
+                                  int width,
+                                  float k1,
+                                  float k2,
+                                  float k3,
+                                  __constant float4* drops,
+                                  int dropCount,
+                                  uint4 rain,
+                                  float4 rainShape)
+{
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, get_global_size(1),
+                                            drops, dropCount, rain, rainShape);
+
+    if(x > 0 && x < get_global_size(0)-1 && y > 0 && y < get_global_size(1)-1)
+    {
+        float h = k1 *  load_height(prevGrid, y*width+x)     +
+                  k2 *  load_height(currGrid, y*width+x)     +
+                  k3 * (load_height(currGrid, (y+1)*width+x) +
+                        load_height(currGrid, (y-1)*width+x) +
+                        load_height(currGrid, y*width+(x+1)) +
+                        load_height(currGrid, y*width+(x-1))) +
+                  group_drop_source(x, y, width, get_global_size(1), groupDrops, groupDropTotal, drops, dropCount, rain, rainShape);
+
+        store_height(prevGrid, y*width+x, h);
+    }
+}
+
+// wave propagation over grid, the heights of a work group plus a one cell halo are
+// staged in local memory so that neighbouring work items don't reload the same cells.
+// tile needs (get_local_size(0)+2)*(get_local_size(1)+2) floats. The global size may
+// be rounded up to a multiple of the local size, so the grid height is passed explicitly.
+__kernel void compute_vertex_displacement_local(__global height_t* prevGrid,
+                                                __global height_t* currGrid,
+                                                __global float4* glBuffer,
+                                                int width,
+                                                int height,
+                                                float k1,
+                                                float k2,
+                                                float k3,
+                                                float spatialStep,
+                                                __constant float4* drops,
+                                                int dropCount,
+                                                uint4 rain,
+                                                float4 rainShape,
+                                                __local float* tile)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int lx = get_local_id(0) + 1;
+    int ly = get_local_id(1) + 1;
+
+    int tileWidth = get_local_size(0) + 2;
+    int tileHeight = get_local_size(1) + 2;
+    int originX = get_group_id(0) * get_local_size(0) - 1;
+    int originY = get_group_id(1) * get_local_size(1) - 1;
+
+    // cooperative load of the tile including the halo, cells outside the grid are never read
+    int groupSize = get_local_size(0) * get_local_size(1);
+    for(int i = get_local_id(1) * get_local_size(0) + get_local_id(0); i < tileWidth*tileHeight; i += groupSize)
+    {
+        int gx = originX + i % tileWidth;
+        int gy = originY + i / tileWidth;
+        if(gx >= 0 && gx < width && gy >= 0 && gy < height)
+        {
+            tile[i] = load_height(currGrid, gy*width+gx);
+        }
+    }
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, height,
+                                            drops, dropCount, rain, rainShape);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(x > 0 && x < width-1 && y > 0 && y < height-1)
+    {
+        float h = k1 *  load_height(prevGrid, y*width+x) +
+                  k2 *  tile[ly*tileWidth+lx]       +
+                  k3 * (tile[(ly+1)*tileWidth+lx]   +
+                        tile[(ly-1)*tileWidth+lx]   +
+                        tile[ly*tileWidth+(lx+1)]   +
+                        tile[ly*tileWidth+(lx-1)]) +
+                  group_drop_source(x, y, width, height, groupDrops, groupDropTotal, drops, dropCount, rain, rainShape);
+
+        store_height(prevGrid, y*width+x, h);
+        glBuffer[y*width+x] = grid_position(x, y, width, height, spatialStep, h);
     }
 }
 
+// one launch per time step: computes the new heights into prevGrid and writes position,
+// normal and tangent of the current heights. The rendered surface therefore lags one step
+// behind the simulation state, but every height is read from global memory only once.
+// tile needs (get_local_size(0)+2)*(get_local_size(1)+2) floats.
+__kernel void compute_fused_step(__global height_t* prevGrid,
+                                 __global height_t* currGrid,
+                                 __global float4* glPositionBuffer,
+                                 __global float4* glNormalBuffer,
+                                 __global float4* glTangentBuffer,
+                                 int width,
+                                 int height,
+                                 float k1,
+                                 float k2,
+                                 float k3,
+                                 float spatialStep,
+                                 __constant float4* drops,
+                                 int dropCount,
+                                 uint4 rain,
+                                 float4 rainShape,
+                                 __local float* tile)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int lx = get_local_id(0) + 1;
+    int ly = get_local_id(1) + 1;
+
+    int tileWidth = get_local_size(0) + 2;
+    int tileHeight = get_local_size(1) + 2;
+    int originX = get_group_id(0) * get_local_size(0) - 1;
+    int originY = get_group_id(1) * get_local_size(1) - 1;
+
+    int groupSize = get_local_size(0) * get_local_size(1);
+    for(int i = get_local_id(1) * get_local_size(0) + get_local_id(0); i < tileWidth*tileHeight; i += groupSize)
+    {
+        int gx = originX + i % tileWidth;
+        int gy = originY + i / tileWidth;
+        if(gx >= 0 && gx < width && gy >= 0 && gy < height)
+        {
+            tile[i] = load_height(currGrid, gy*width+gx);
+        }
+    }
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, height,
+                                            drops, dropCount, rain, rainShape);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(x > 0 && x < width-1 && y > 0 && y < height-1)
+    {
+        float c = tile[ly*tileWidth+lx];
+        float l = tile[ly*tileWidth+(lx-1)];
+        float r = tile[ly*tileWidth+(lx+1)];
+        float t = tile[(ly-1)*tileWidth+lx];
+        float b = tile[(ly+1)*tileWidth+lx];
+
+        store_height(prevGrid, y*width+x, k1 * load_height(prevGrid, y*width+x) + k2 * c + k3 * (b + t + r + l) +
+                                          group_drop_source(x, y, width, height, groupDrops, groupDropTotal,
+                                                            drops, dropCount, rain, rainShape));
+
+        float4 estimatedNormal  = (float4)(l-r, 2.0f*spatialStep, b-t, 1.0f);
+        float4 estimatedTangent = (float4)(2.0f*spatialStep, r-l, 0.0f, 1.0f);
+
+        glPositionBuffer[y*width+x] = grid_position(x, y, width, height, spatialStep, c);
+        glNormalBuffer[y*width+x]   = normalize(estimatedNormal);
+        glTangentBuffer[y*width+x]  = normalize(estimatedTangent);
+    }
+}
+
+// advances the heights by steps time steps per launch. A work group loads its core plus a
+// halo of steps cells of both time levels into local memory and iterates the stencil there,
+// the valid region shrinks by one cell per step until only the core is left. Neighbouring
+// groups read the same halo cells, so the result goes to a second pair of buffers.
+// tilePrev and tileCurr need (get_local_size(0)+2*steps)*(get_local_size(1)+2*steps) floats each.
+// The queued drops belong to the first step, every step gets rain.z new rain drops.
+__kernel void compute_multi_step(__global const height_t* prevGrid,
+                                 __global const height_t* currGrid,
+                                 __global height_t* nextPrevGrid,
+                                 __global height_t* nextCurrGrid,
+                                 int width,
+                                 int height,
+                                 float k1,
+                                 float k2,
+                                 float k3,
+                                 int steps,
+                                 __constant float4* drops,
+                                 int dropCount,
+                                 uint4 rain,
+                                 float4 rainShape,
+                                 __local float* tilePrev,
+                                 __local float* tileCurr)
+{
+    int tileWidth = get_local_size(0) + 2*steps;
+    int tileHeight = get_local_size(1) + 2*steps;
+    int originX = get_group_id(0) * get_local_size(0) - steps;
+    int originY = get_group_id(1) * get_local_size(1) - steps;
+
+    int groupSize = get_local_size(0) * get_local_size(1);
+    int first = get_local_id(1) * get_local_size(0) + get_local_id(0);
+
+    // cells outside the grid are never read, the grid boundary is never updated
+    for(int i = first; i < tileWidth*tileHeight; i += groupSize)
+    {
+        int gx = originX + i % tileWidth;
+        int gy = originY + i / tileWidth;
+        if(gx >= 0 && gx < width && gy >= 0 && gy < height)
+        {
+            tilePrev[i] = load_height(prevGrid, gy*width+gx);
+            tileCurr[i] = load_height(currGrid, gy*width+gx);
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int4 tileBox = (int4)(originX, originY, originX + tileWidth - 1, originY + tileHeight - 1);
+
+    __local float* prev = tilePrev;
+    __local float* curr = tileCurr;
+    int stepDrops = dropCount;
+    uint4 stepRain = rain;
+    for(int s = 1; s <= steps; ++s)
+    {
+        int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, tileBox, width, height,
+                                                drops, stepDrops, stepRain, rainShape);
+
+        for(int i = first; i < tileWidth*tileHeight; i += groupSize)
+        {
+            int tx = i % tileWidth;
+            int ty = i / tileWidth;
+            int gx = originX + tx;
+            int gy = originY + ty;
+
+            if(tx >= s && tx < tileWidth-s && ty >= s && ty < tileHeight-s &&
+               gx > 0 && gx < width-1 && gy > 0 && gy < height-1)
+            {
+                prev[i] = k1 *  prev[i]             +
+                          k2 *  curr[i]             +
+                          k3 * (curr[i+tileWidth]   +
+                                curr[i-tileWidth]   +
+                                curr[i+1]           +
+                                curr[i-1])          +
+                          group_drop_source(gx, gy, width, height, groupDrops, groupDropTotal,
+                                            drops, stepDrops, stepRain, rainShape);
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        stepDrops = 0;
+        stepRain.y += rain.z;
+
+        __local float* swap = prev;
+        prev = curr;
+        curr = swap;
+    }
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if(x < width && y < height)
+    {
+        int i = (get_local_id(1)+steps)*tileWidth + get_local_id(0)+steps;
+        store_height(nextPrevGrid, y*width+x, prev[i]);
+        store_height(nextCurrGrid, y*width+x, curr[i]);
+    }
+}
+
+// wave propagation over rows [rowBegin, rowBegin+get_global_size(1)) of a horizontal slab.
+// The slab buffers hold the rows of one device plus a halo row towards each neighbour,
+// so rows close to the halo can be advanced first and sent while the rest is computed.
+__kernel void compute_slab_rows(__global float* prevGrid,
+                                __global const float* currGrid,
+                                int width,
+                                int rowBegin,
+                                float k1,
+                                float k2,
+                                float k3)
+{
+    int x = get_global_id(0);
+    int y = rowBegin + get_global_id(1);
+
+    if(x > 0 && x < width-1)
+    {
+        prevGrid[y*width+x] = k1 *  prevGrid[y*width+x]     +
+                              k2 *  currGrid[y*width+x]     +
+                              k3 * (currGrid[(y+1)*width+x] +
+                                    currGrid[(y-1)*width+x] +
+                                    currGrid[y*width+(x+1)] +
+                                    currGrid[y*width+(x-1)]);
+    }
+}
+
+#ifdef __IMAGE_SUPPORT__
+
+// Heights stored in images (CL_R, CL_FLOAT or CL_HALF_FLOAT with HALF_HEIGHTS) are read through
+// the texture cache. The sampler clamps to the edge, so the stencil needs no bounds checks. A kernel
+// can't read and write the same image, so the new heights go to a third image and the three
+// images rotate every step.
+__constant sampler_t heightSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// new height of cell p, the boundary keeps its height
+float image_height_step(__read_only image2d_t prevHeights,
+                        __read_only image2d_t currHeights,
+                        int2 p,
+                        int width,
+                        int height,
+                        float k1,
+                        float k2,
+                        float k3)
+{
+    float c = read_imagef(currHeights, heightSampler, p).x;
+    if(p.x == 0 || p.x == width-1 || p.y == 0 || p.y == height-1)
+    {
+        return c;
+    }
+
+    return k1 * read_imagef(prevHeights, heightSampler, p).x +
+           k2 * c +
+           k3 * (read_imagef(currHeights, heightSampler, p + (int2)(0, 1)).x +
+                 read_imagef(currHeights, heightSampler, p - (int2)(0, 1)).x +
+                 read_imagef(currHeights, heightSampler, p + (int2)(1, 0)).x +
+                 read_imagef(currHeights, heightSampler, p - (int2)(1, 0)).x);
+}
+
+// wave propagation over an image grid, writes the positions of the new heights
+__kernel void compute_vertex_displacement_image(__read_only image2d_t prevHeights,
+                                                __read_only image2d_t currHeights,
+                                                __write_only image2d_t nextHeights,
+                                                __global float4* glBuffer,
+                                                float k1,
+                                                float k2,
+                                                float k3,
+                                                float spatialStep,
+                                                __constant float4* drops,
+                                                int dropCount,
+                                                uint4 rain,
+                                                float4 rainShape)
+{
+    int2 p = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(currHeights);
+    int height = get_image_height(currHeights);
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, height,
+                                            drops, dropCount, rain, rainShape);
+
+    float h = image_height_step(prevHeights, currHeights, p, width, height, k1, k2, k3);
+    if(p.x > 0 && p.x < width-1 && p.y > 0 && p.y < height-1)
+    {
+        h += group_drop_source(p.x, p.y, width, height, groupDrops, groupDropTotal, drops, dropCount, rain, rainShape);
+    }
+
+    write_imagef(nextHeights, p, (float4)(h, 0.0f, 0.0f, 1.0f));
+    glBuffer[p.y*width+p.x] = grid_position(p.x, p.y, width, height, spatialStep, h);
+}
+
+// height-only time step over an image grid
+__kernel void compute_height_image(__read_only image2d_t prevHeights,
+                                   __read_only image2d_t currHeights,
+                                   __write_only image2d_t nextHeights,
+                                   float k1,
+                                   float k2,
+                                   float k3,
+                                   __constant float4* drops,
+                                   int dropCount,
+                                   uint4 rain,
+                                   float4 rainShape)
+{
+    int2 p = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(currHeights);
+    int height = get_image_height(currHeights);
+
+    __local float4 groupDrops[GROUP_DROP_CAPACITY + GROUP_DROP_CHUNK];
+    __local int groupDropCount;
+    int groupDropTotal = gather_group_drops(groupDrops, &groupDropCount, group_box(), width, height,
+                                            drops, dropCount, rain, rainShape);
+
+    float h = image_height_step(prevHeights, currHeights, p, width, height, k1, k2, k3);
+    if(p.x > 0 && p.x < width-1 && p.y > 0 && p.y < height-1)
+    {
+        h += group_drop_source(p.x, p.y, width, height, groupDrops, groupDropTotal, drops, dropCount, rain, rainShape);
+    }
+
+    write_imagef(nextHeights, p, (float4)(h, 0.0f, 0.0f, 1.0f));
+}
+
+// normals and tangents of an image grid
+__kernel void compute_finite_difference_scheme_image(__read_only image2d_t heights,
+                                                     __global float4* glNormalBuffer,
+                                                     __global float4* glTangentBuffer,
+                                                     float spatialStep)
+{
+    int2 p = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(heights);
+    int height = get_image_height(heights);
+
+    if(p.x > 0 && p.x < width-1 && p.y > 0 && p.y < height-1)
+    {
+        float l = read_imagef(heights, heightSampler, p - (int2)(1, 0)).x;
+        float r = read_imagef(heights, heightSampler, p + (int2)(1, 0)).x;
+        float t = read_imagef(heights, heightSampler, p - (int2)(0, 1)).x;
+        float b = read_imagef(heights, heightSampler, p + (int2)(0, 1)).x;
+
+        float4 estimatedNormal  = (float4)(l-r, 2.0f*spatialStep, b-t, 1.0f);
+        float4 estimatedTangent = (float4)(2.0f*spatialStep, r-l, 0.0f, 1.0f);
+
+        glNormalBuffer[p.y*width+p.x]  = normalize(estimatedNormal);
+        glTangentBuffer[p.y*width+p.x] = normalize(estimatedTangent);
+    }
+}
+
+// initialization kernel of an image grid
+__kernel void initialize_gl_grid_image(__global float4* glPositionBuffer,
+                                       __global float4* glNormalBuffer,
+                                       __global float4* glTangentBuffer,
+                                       __read_only image2d_t heights,
+                                       float spatialStep)
+{
+    int2 p = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(heights);
+    int height = get_image_height(heights);
+    float h = read_imagef(heights, heightSampler, p).x;
+
+    glPositionBuffer[p.y*width+p.x] = grid_position(p.x, p.y, width, height, spatialStep, h);
+    glNormalBuffer[p.y*width+p.x]   = (float4)(0.0f, 1.0f, 0.0f, 1.0f);
+    glTangentBuffer[p.y*width+p.x]  = (float4)(1.0f, 0.0f, 0.0f, 1.0f);
+}
+
+#endif // __IMAGE_SUPPORT__
+
 // compute normals for shading and tangents for texture coords
-__kernel void compute_finite_difference_scheme(__global float4* currGrid,
+__kernel void compute_finite_difference_scheme(__global height_t* currGrid,
                                                __global float4* glNormalBuffer,
                                                __global float4* glTangentBuffer,
                                                int width,
@@ -59,10 +691,10 @@ __kernel void compute_finite_difference_scheme(__global float4* currGrid,
 
     if(x > 0 && x < get_global_size(0)-1 && y > 0 && y < get_global_size(1)-1)
     {
-        float l = currGrid[y*width+(x-1)].y;
-        float r = currGrid[y*width+(x+1)].y;
-        float t = currGrid[(y-1)*width+x].y;
-        float b = currGrid[(y+1)*width+x].y;
+        float l = load_height(currGrid, y*width+(x-1));
+        float r = load_height(currGrid, y*width+(x+1));
+        float t = load_height(currGrid, (y-1)*width+x);
+        float b = load_height(currGrid, (y+1)*width+x);
 
         float4 estimatedNormal  = (float4)(l-r, 2.0f*spatialStep, b-t, 1.0f);
         float4 estimatedTangent = (float4)(2.0f*spatialStep, r-l, 0.0f, 1.0f);
@@ -76,30 +708,44 @@ __kernel void compute_finite_difference_scheme(__global float4* currGrid,
 __kernel void initialize_gl_grid(__global float4* glPositionBuffer,
                                  __global float4* glNormalBuffer,
                                  __global float4* glTangentBuffer,
-                                 __global float4* clPositionBuffer,
-                                 int width)
+                                 __global height_t* clHeightBuffer,
+                                 int width,
+                                 float spatialStep)
 {
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
 
-    glPositionBuffer[y*width+x] = clPositionBuffer[y*width+x];
+    glPositionBuffer[y*width+x] = grid_position(x, y, width, get_global_size(1), spatialStep, load_height(clHeightBuffer, y*width+x));
     glNormalBuffer[y*width+x]   = (float4)(0.0f, 1.0f, 0.0f, 1.0f);
     glTangentBuffer[y*width+x]  = (float4)(1.0f, 0.0f, 0.0f, 1.0f);
 
 }
 
-// create water drop
-__kernel void disturb_grid(__global float4* currGrid,
-                           unsigned int i,
-                           unsigned int j,
+// create water drop in a slab holding the grid rows [rowBegin, rowBegin+rowCount),
+// i is a grid row and only the cells of the drop inside the slab are changed
+__kernel void disturb_slab(__global float* currGrid,
+                           int i,
+                           int j,
                            int width,
+                           int rowBegin,
+                           int rowCount,
                            float magnitude)
 {
     float halfMagnitude = 0.5f * magnitude;
+    int row = i - rowBegin;
 
-    currGrid[i*width+j].y     += magnitude;
-    currGrid[i*width+(j+1)].y += halfMagnitude;
-    currGrid[i*width+(j-1)].y += halfMagnitude;
-    currGrid[(i+1)*width+j].y += halfMagnitude;
-    currGrid[(i-1)*width+j].y += halfMagnitude;
-}
\ No newline at end of file
+    if(row >= 0 && row < rowCount)
+    {
+        currGrid[row*width+j]     += magnitude;
+        currGrid[row*width+(j+1)] += halfMagnitude;
+        currGrid[row*width+(j-1)] += halfMagnitude;
+    }
+    if(row+1 >= 0 && row+1 < rowCount)
+    {
+        currGrid[(row+1)*width+j] += halfMagnitude;
+    }
+    if(row-1 >= 0 && row-1 < rowCount)
+    {
+        currGrid[(row-1)*width+j] += halfMagnitude;
+    }
+}
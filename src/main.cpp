@@ -23,6 +23,7 @@
 
 // own
 #include "OpenCLWaveSimulation.h"
+#include "OpenCLDeviceSelector.h"
 
 // std
 #include <string>
@@ -34,6 +35,16 @@ GlutApp* g_app;
 
 int main(int argc, char** argv)
 {
+    // listing the devices needs no window
+    for(int i = 1; i < argc; ++i)
+    {
+        if(std::string(argv[i]) == "--list-devices")
+        {
+            OpenCLDeviceSelector::listDevices(std::cout);
+            return 0;
+        }
+    }
+
     OpenCLWaveSimulation app(argc, argv, "OpenCL-Wave-Simulation", 800, 600, SIZE, SIZE);
     if(!app.init())
     {